@@ -0,0 +1,241 @@
+/******************************************************************************
+ * pdfbench.c
+ *
+ * pdfresurrect - PDF history extraction tool
+ * https://github.com/enferex/pdfresurrect
+ *
+ * See https://github.com/enferex/pdfresurrect/blob/master/LICENSE for license
+ * information.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Special thanks to all of the contributors:  See AUTHORS.
+ * Special thanks to 757labs (757 crew), they are a great group
+ * of people to hack on projects and brainstorm with.
+ *****************************************************************************/
+
+/*
+ * Benchmark driver: times the phases of an analysis of each PDF given on the
+ * command line, and prints one JSON object per phase and document:
+ *
+ *   {"file": ..., "phase": ..., "bytes": ..., "objects": ..., "versions": ...,
+ *    "iterations": ..., "seconds": ..., "mb_per_sec": ...,
+ *    "objects_per_sec": ..., "process_peak_rss_kb": ...}
+ *
+ * "seconds" is the fastest of the iterations.  "objects" counts the entries
+ * of every xref, plain or stream.  "process_peak_rss_kb" is the high-water
+ * mark of the whole benchmark process so far, not of the one document: it
+ * only grows from one record to the next.  The phases are:
+ *   load_xrefs:    pdf_get_version() and pdf_load_xrefs() on a fresh pdf_t
+ *                  (this includes loading creator data)
+ *   load_creator:  pdf_load_creator() alone
+ *   summarize:     pdf_summarize(), output discarded
+ *   write_version: pdf_write_version() for every version, output discarded
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "../main.h"
+#include "../pdf.h"
+
+
+/* The tool's main.c provides this, the benchmark links pdf.o without it */
+void *safe_calloc(size_t size)
+{
+    void *addr;
+
+    if (!size || !(addr = calloc(1, size)))
+    {
+        ERR("Failed to allocate %zu bytes.\n", size);
+        exit(EXIT_FAILURE);
+    }
+    return addr;
+}
+
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static long process_peak_rss_kb(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+
+static pdf_t *load(FILE *fp, const char *name)
+{
+    pdf_t *pdf;
+
+    pdf = pdf_new(name);
+    pdf_get_version(fp, pdf);
+    if (pdf_load_xrefs(fp, pdf) == -1)
+    {
+        pdf_delete(pdf);
+        return NULL;
+    }
+    return pdf;
+}
+
+
+static void report(
+    FILE        *out,
+    const char  *name,
+    const char  *phase,
+    long         bytes,
+    long         n_objects,
+    int          n_versions,
+    int          iters,
+    double       secs)
+{
+    if (secs <= 0.0)
+      secs = 1e-9;
+
+    fprintf(out,
+            "{\"file\": \"%s\", \"phase\": \"%s\", \"bytes\": %ld, "
+            "\"objects\": %ld, \"versions\": %d, \"iterations\": %d, "
+            "\"seconds\": %.9f, \"mb_per_sec\": %.3f, "
+            "\"objects_per_sec\": %.1f, \"process_peak_rss_kb\": %ld}\n",
+            name, phase, bytes, n_objects, n_versions, iters, secs,
+            bytes / secs / (1024.0 * 1024.0), n_objects / secs,
+            process_peak_rss_kb());
+    fflush(out);
+}
+
+
+static void bench_file(FILE *out, FILE *null, const char *name, int iters)
+{
+    int     i, j, n_versions;
+    long    bytes, n_objects;
+    double  t, best;
+    FILE   *fp;
+    pdf_t  *pdf;
+
+    if (!(fp = fopen(name, "r")))
+    {
+        ERR("Could not open '%s'\n", name);
+        return;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    bytes = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    if (!pdf_is_pdf(fp))
+    {
+        ERR("'%s' is not a valid PDF\n", name);
+        fclose(fp);
+        return;
+    }
+
+    /* load_xrefs, keep the last one around for the other phases */
+    pdf = NULL;
+    best = 0.0;
+    for (i=0; i<iters; ++i)
+    {
+        if (pdf)
+          pdf_delete(pdf);
+        t = now();
+        pdf = load(fp, name);
+        t = now() - t;
+        if (!pdf)
+        {
+            fclose(fp);
+            return;
+        }
+        best = (i == 0 || t < best) ? t : best;
+    }
+
+    for (i=0, n_objects=0, n_versions=0; i<pdf->n_xrefs; ++i)
+    {
+        n_objects += pdf->xrefs[i].is_stream ?
+                     pdf->xrefs[i].n_stream_entries : pdf->xrefs[i].n_entries;
+        if (pdf->xrefs[i].version)
+          ++n_versions;
+    }
+    report(out, name, "load_xrefs", bytes, n_objects, n_versions, iters, best);
+
+    /* load_creator */
+    for (i=0; i<iters; ++i)
+    {
+        t = now();
+        pdf_load_creator(fp, pdf);
+        t = now() - t;
+        best = (i == 0 || t < best) ? t : best;
+    }
+    report(out, name, "load_creator", bytes, n_objects, n_versions, iters,
+           best);
+
+    /* summarize, stdout points to /dev/null here */
+    for (i=0; i<iters; ++i)
+    {
+        t = now();
+        pdf_summarize(fp, pdf, NULL, PDF_FLAG_NONE);
+        fflush(stdout);
+        t = now() - t;
+        best = (i == 0 || t < best) ? t : best;
+    }
+    report(out, name, "summarize", bytes, n_objects, n_versions, iters, best);
+
+    /* write_version */
+    for (i=0; i<iters; ++i)
+    {
+        t = now();
+        for (j=0; j<pdf->n_xrefs; ++j)
+          if (pdf->xrefs[j].version)
+            pdf_write_version(fp, pdf, j, null);
+        fflush(null);
+        t = now() - t;
+        best = (i == 0 || t < best) ? t : best;
+    }
+    report(out, name, "write_version", bytes * n_versions, n_objects,
+           n_versions, iters, best);
+
+    pdf_delete(pdf);
+    fclose(fp);
+}
+
+
+int main(int argc, char **argv)
+{
+    int   i, iters, fd;
+    FILE *out, *null;
+
+    iters = 5;
+    if (argc > 2 && strcmp(argv[1], "-n") == 0)
+    {
+        iters = atoi(argv[2]);
+        argv += 2;
+        argc -= 2;
+    }
+
+    if (argc < 2 || iters < 1)
+    {
+        printf("Usage: pdfbench [-n iterations] <file.pdf> [file.pdf ...]\n");
+        return 0;
+    }
+
+    /* Results go to the original stdout, the summaries to /dev/null */
+    if ((fd = dup(STDOUT_FILENO)) < 0 || !(out = fdopen(fd, "w")) ||
+        !freopen("/dev/null", "w", stdout) || !(null = fopen("/dev/null", "w")))
+    {
+        ERR("Failed to set up output streams\n");
+        return -1;
+    }
+
+    for (i=1; i<argc; ++i)
+      bench_file(out, null, argv[i], iters);
+
+    fclose(null);
+    fclose(out);
+    return 0;
+}
@@ -0,0 +1,348 @@
+/******************************************************************************
+ * pdfgen.c
+ *
+ * pdfresurrect - PDF history extraction tool
+ * https://github.com/enferex/pdfresurrect
+ *
+ * See https://github.com/enferex/pdfresurrect/blob/master/LICENSE for license
+ * information.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Special thanks to all of the contributors:  See AUTHORS.
+ * Special thanks to 757labs (757 crew), they are a great group
+ * of people to hack on projects and brainstorm with.
+ *****************************************************************************/
+
+/*
+ * Synthetic multi-revision PDF generator for benchmarking.
+ *
+ * The output is fully determined by the options (and seed), so the same
+ * command always produces the same bytes.  Revision 1 holds a catalog, a page
+ * tree, an Info dictionary and the requested number of objects, each later
+ * revision rewrites that many objects (plus the Info dictionary) as an
+ * incremental update.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/* Fixed object ids, generated objects follow */
+#define OBJ_CATALOG 1
+#define OBJ_PAGES   2
+#define OBJ_INFO    3
+#define OBJ_FIRST   4
+
+
+typedef struct _gen_t
+{
+    int   n_revisions;
+    int   n_objects;      /* Per revision */
+    int   stream_size;    /* Bytes of stream data per stream object */
+    int   is_linear;
+    int   use_xref_stream;
+    int   garbage_size;   /* Bytes after the final %%EOF */
+    unsigned long seed;
+
+    FILE *fp;
+    long *offsets;        /* Indexed by object id, the latest copy */
+    int   max_id;
+} gen_t;
+
+
+static void usage(void)
+{
+    printf("Usage: pdfgen -o <out.pdf> [-r revisions] [-n objects] "
+           "[-s stream_bytes]\n"
+           "              [-g garbage_bytes] [-S seed] [-l] [-x]\n"
+           "\t -r Number of revisions (default 4)\n"
+           "\t -n Objects written per revision (default 100)\n"
+           "\t -s Bytes of data in each stream object (default 1024)\n"
+           "\t -g Bytes of trailing garbage after the last %%%%EOF\n"
+           "\t -S Seed for the pseudo random content (default 1)\n"
+           "\t -l Emit a linearized first revision\n"
+           "\t -x Use cross reference streams instead of xref tables\n");
+    exit(0);
+}
+
+
+/* Deterministic LCG, good enough for filler */
+static unsigned long next_rand(gen_t *gen)
+{
+    gen->seed = gen->seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return gen->seed >> 33;
+}
+
+
+static void begin_obj(gen_t *gen, int id)
+{
+    gen->offsets[id] = ftell(gen->fp);
+    fprintf(gen->fp, "%d 0 obj\n", id);
+}
+
+
+static void end_obj(gen_t *gen)
+{
+    fprintf(gen->fp, "\nendobj\n");
+}
+
+
+static void write_stream(gen_t *gen, int id)
+{
+    int i;
+
+    begin_obj(gen, id);
+    fprintf(gen->fp, "<< /Length %d >>\nstream\n", gen->stream_size);
+    for (i=0; i<gen->stream_size; ++i)
+      fputc('A' + next_rand(gen) % 26, gen->fp);
+    fprintf(gen->fp, "\nendstream");
+    end_obj(gen);
+}
+
+
+/* Generated objects cycle through fonts, pages and streams */
+static void write_object(gen_t *gen, int id, int rev)
+{
+    switch (id % 3)
+    {
+        case 0:
+            begin_obj(gen, id);
+            fprintf(gen->fp, "<< /Type /Font /Subtype /Type1 "
+                    "/BaseFont /F%lu /Rev %d >>", next_rand(gen) % 1000, rev);
+            end_obj(gen);
+            break;
+
+        case 1:
+            begin_obj(gen, id);
+            fprintf(gen->fp, "<< /Type /Page /Parent %d 0 R "
+                    "/MediaBox [0 0 612 792] /Contents %d 0 R >>",
+                    OBJ_PAGES, id + 1);
+            end_obj(gen);
+            break;
+
+        default:
+            write_stream(gen, id);
+            break;
+    }
+}
+
+
+static void write_common(gen_t *gen, int rev)
+{
+    int i, n_kids;
+
+    begin_obj(gen, OBJ_CATALOG);
+    fprintf(gen->fp, "<< /Type /Catalog /Pages %d 0 R >>", OBJ_PAGES);
+    end_obj(gen);
+
+    begin_obj(gen, OBJ_PAGES);
+    fprintf(gen->fp, "<< /Type /Pages /Kids [");
+    for (i=OBJ_FIRST, n_kids=0; i<OBJ_FIRST+gen->n_objects; ++i)
+      if (i % 3 == 1)
+      {
+          fprintf(gen->fp, "%d 0 R ", i);
+          ++n_kids;
+      }
+    fprintf(gen->fp, "] /Count %d >>", n_kids);
+    end_obj(gen);
+
+    begin_obj(gen, OBJ_INFO);
+    fprintf(gen->fp, "<< /Title (Synthetic revision %d) /Author (pdfgen) "
+            "/Producer (pdfresurrect bench) /ModDate (D:2022%04d) >>",
+            rev, rev);
+    end_obj(gen);
+}
+
+
+/* Emit the xref (table or stream) for ids [first, last] plus a trailer */
+static long write_xref(gen_t *gen, const int *ids, int n_ids, long prev)
+{
+    int  i;
+    long start;
+
+    start = ftell(gen->fp);
+
+    if (gen->use_xref_stream)
+    {
+        /* Uncompressed stream, /W [1 4 2] */
+        int xref_id = ++gen->max_id;
+        gen->offsets[xref_id] = start;
+        fprintf(gen->fp, "%d 0 obj\n<< /Type /XRef /Size %d /W [1 4 2] "
+                "/Index [", xref_id, gen->max_id + 1);
+        for (i=0; i<n_ids; ++i)
+          fprintf(gen->fp, "%d 1 ", ids[i]);
+        fprintf(gen->fp, "%d 1] /Root %d 0 R /Info %d 0 R",
+                xref_id, OBJ_CATALOG, OBJ_INFO);
+        if (prev >= 0)
+          fprintf(gen->fp, " /Prev %ld", prev);
+        fprintf(gen->fp, " /Length %d >>\nstream\n", (n_ids + 1) * 7);
+        for (i=0; i<=n_ids; ++i)
+        {
+            long off = gen->offsets[(i < n_ids) ? ids[i] : xref_id];
+            fputc(1, gen->fp);
+            fputc((off >> 24) & 0xFF, gen->fp);
+            fputc((off >> 16) & 0xFF, gen->fp);
+            fputc((off >> 8) & 0xFF, gen->fp);
+            fputc(off & 0xFF, gen->fp);
+            fputc(0, gen->fp);
+            fputc(0, gen->fp);
+        }
+        fprintf(gen->fp, "\nendstream\nendobj\n");
+    }
+    else
+    {
+        fprintf(gen->fp, "xref\n");
+        for (i=0; i<n_ids; ++i)
+        {
+            /* One subsection per run of consecutive ids */
+            if (i == 0 || ids[i] != ids[i-1] + 1)
+            {
+                int j = i;
+                while (j + 1 < n_ids && ids[j+1] == ids[j] + 1)
+                  ++j;
+                fprintf(gen->fp, "%d %d\n", ids[i], j - i + 1);
+            }
+            if (ids[i] == 0)
+              fprintf(gen->fp, "0000000000 65535 f \n");
+            else
+              fprintf(gen->fp, "%010ld 00000 n \n", gen->offsets[ids[i]]);
+        }
+        fprintf(gen->fp, "trailer\n<< /Size %d /Root %d 0 R /Info %d 0 R",
+                gen->max_id + 1, OBJ_CATALOG, OBJ_INFO);
+        if (prev >= 0)
+          fprintf(gen->fp, " /Prev %ld", prev);
+        fprintf(gen->fp, " >>\n");
+    }
+
+    fprintf(gen->fp, "startxref\n%ld\n%%%%EOF\n", start);
+    return start;
+}
+
+
+static int cmp_int(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+
+int main(int argc, char **argv)
+{
+    int         i, opt, rev, n_ids, *ids, lin_id;
+    long        prev;
+    const char *out_name;
+    gen_t       gen;
+
+    memset(&gen, 0, sizeof(gen));
+    gen.n_revisions = 4;
+    gen.n_objects = 100;
+    gen.stream_size = 1024;
+    gen.seed = 1;
+    out_name = NULL;
+
+    while ((opt = getopt(argc, argv, "o:r:n:s:g:S:lxh")) != -1)
+    {
+        switch (opt)
+        {
+            case 'o': out_name = optarg; break;
+            case 'r': gen.n_revisions = atoi(optarg); break;
+            case 'n': gen.n_objects = atoi(optarg); break;
+            case 's': gen.stream_size = atoi(optarg); break;
+            case 'g': gen.garbage_size = atoi(optarg); break;
+            case 'S': gen.seed = strtoul(optarg, NULL, 10); break;
+            case 'l': gen.is_linear = 1; break;
+            case 'x': gen.use_xref_stream = 1; break;
+            default: usage();
+        }
+    }
+
+    if (!out_name || gen.n_revisions < 1 || gen.n_objects < 1 ||
+        gen.stream_size < 0 || gen.garbage_size < 0)
+      usage();
+
+    if (!(gen.fp = fopen(out_name, "w")))
+    {
+        fprintf(stderr, "Could not create '%s'\n", out_name);
+        return -1;
+    }
+
+    /* Every revision can add one xref stream object */
+    gen.max_id = OBJ_FIRST + gen.n_objects - 1;
+    gen.offsets = calloc(gen.max_id + gen.n_revisions + 2, sizeof(long));
+    ids = calloc(gen.max_id + gen.n_revisions + 2, sizeof(int));
+    if (!gen.offsets || !ids)
+      return -1;
+
+    fprintf(gen.fp, "%%PDF-1.%d\n%%\xe2\xe3\xcf\xd3\n",
+            gen.use_xref_stream ? 5 : 4);
+
+    /* Linearized documents start with a first page section whose startxref
+     * is 0, as written by common linearizers.
+     */
+    lin_id = 0;
+    if (gen.is_linear)
+    {
+        lin_id = ++gen.max_id;
+        begin_obj(&gen, lin_id);
+        fprintf(gen.fp, "<< /Linearized 1 /N 1 >>");
+        end_obj(&gen);
+        fprintf(gen.fp, "xref\n%d 1\n%010ld 00000 n \ntrailer\n"
+                "<< /Size %d /Root %d 0 R /Info %d 0 R >>\n"
+                "startxref\n0\n%%%%EOF\n",
+                lin_id, gen.offsets[lin_id], lin_id + 1,
+                OBJ_CATALOG, OBJ_INFO);
+    }
+
+    /* Revision 1 */
+    for (i=OBJ_FIRST; i<OBJ_FIRST+gen.n_objects; ++i)
+      write_object(&gen, i, 1);
+    write_common(&gen, 1);
+    n_ids = 0;
+    ids[n_ids++] = 0;
+    for (i=1; i<OBJ_FIRST+gen.n_objects; ++i)
+      ids[n_ids++] = i;
+    prev = write_xref(&gen, ids, n_ids, -1);
+
+    /* Incremental updates: rewrite a pseudo random set of objects */
+    for (rev=2; rev<=gen.n_revisions; ++rev)
+    {
+        n_ids = 0;
+        ids[n_ids++] = OBJ_INFO;
+        for (i=0; i<gen.n_objects; ++i)
+        {
+            int id = OBJ_FIRST + next_rand(&gen) % gen.n_objects;
+            int j;
+            for (j=0; j<n_ids && ids[j] != id; ++j)
+              ;
+            if (j == n_ids)
+              ids[n_ids++] = id;
+        }
+        qsort(ids, n_ids, sizeof(int), cmp_int);
+
+        for (i=0; i<n_ids; ++i)
+          if (ids[i] == OBJ_INFO)
+          {
+              begin_obj(&gen, OBJ_INFO);
+              fprintf(gen.fp, "<< /Title (Synthetic revision %d) "
+                      "/Author (pdfgen) /ModDate (D:2022%04d) >>", rev, rev);
+              end_obj(&gen);
+          }
+          else
+            write_object(&gen, ids[i], rev);
+
+        prev = write_xref(&gen, ids, n_ids, prev);
+    }
+
+    /* Trailing garbage, without any '%' so it cannot form a %%EOF */
+    for (i=0; i<gen.garbage_size; ++i)
+    {
+        int ch = '!' + next_rand(&gen) % 94;
+        fputc((ch == '%') ? '#' : ch, gen.fp);
+    }
+
+    fclose(gen.fp);
+    free(gen.offsets);
+    free(ids);
+    return 0;
+}
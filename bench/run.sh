@@ -0,0 +1,43 @@
+#!/bin/sh
+#
+# pdfresurrect - PDF history extraction tool
+# https://github.com/enferex/pdfresurrect
+#
+# See https://github.com/enferex/pdfresurrect/blob/master/LICENSE for license
+# information.
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# Generate the benchmark corpus and time each document.  One JSON object per
+# line and phase is written to stdout (see pdfbench.c).
+#
+# Environment:
+#   BENCH_DIR   Where the generated PDFs go (default: a temporary directory)
+#   BENCH_ITERS Iterations per phase (default: 5)
+
+BENCH=$(dirname "$0")
+ITERS=${BENCH_ITERS:-5}
+DIR=${BENCH_DIR:-$(mktemp -d)}
+mkdir -p "$DIR" || exit 1
+
+#     name           options
+set -- \
+    "small"          "-r 2 -n 50 -s 256" \
+    "revisions"      "-r 200 -n 20 -s 256" \
+    "objects"        "-r 4 -n 20000 -s 64" \
+    "streams"        "-r 4 -n 300 -s 65536" \
+    "linearized"     "-r 20 -n 500 -s 1024 -l" \
+    "xref-streams"   "-r 20 -n 500 -s 1024 -x" \
+    "garbage"        "-r 20 -n 500 -s 1024 -g 1048576"
+
+FILES=
+while [ $# -gt 1 ]; do
+    "$BENCH/pdfgen" -o "$DIR/$1.pdf" $2 || exit 1
+    FILES="$FILES $DIR/$1.pdf"
+    shift 2
+done
+
+"$BENCH/pdfbench" -n "$ITERS" $FILES
+status=$?
+
+[ -z "$BENCH_DIR" ] && rm -rf "$DIR"
+exit $status
@@ -0,0 +1,636 @@
+/******************************************************************************
+ * container.c
+ *
+ * pdfresurrect - PDF history extraction tool
+ * https://github.com/enferex/pdfresurrect
+ *
+ * See https://github.com/enferex/pdfresurrect/blob/master/LICENSE for license
+ * information.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Special thanks to all of the contributors:  See AUTHORS.
+ * Special thanks to 757labs (757 crew), they are a great group
+ * of people to hack on projects and brainstorm with.
+ *****************************************************************************/
+
+#define _GNU_SOURCE /* fopencookie() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#include "pdf.h"
+#include "main.h"
+
+
+/*
+ * Containers
+ *
+ * Zip archives are listed from their central directory (zip64 included), tar
+ * archives by walking their headers (ustar, with pax and GNU long names).
+ * Only the members whose name ends in ".pdf" are kept.  A member is opened
+ * as a stdio stream over a byte range: stored members are read straight from
+ * a mapping of the archive, deflated ones are inflated once into a buffer
+ * that the caller reuses from one member to the next.  Members too large for
+ * the buffer are inflated into an anonymous temporary file instead, like
+ * pdf_spool() does for pipes, so memory stays bounded.
+ */
+
+#define INFLATE_MAX   (64 * 1024 * 1024)
+#define INFLATE_CHUNK (64 * 1024)
+#define TAR_BLOCK     512
+#define MAX_EXT_HDR   (1024 * 1024)
+
+
+/* Read-only view of a member, behind the FILE of pdf_member_open() */
+typedef struct _member_io_t
+{
+    const char *data;
+    size_t      size;
+    off64_t     pos;
+    void       *map;     /* Unmapped on close, if set */
+    size_t      map_len;
+} member_io_t;
+
+
+static ssize_t member_read(void *cookie, char *buf, size_t size)
+{
+    member_io_t *io = cookie;
+
+    if (io->pos >= io->size)
+      return 0;
+    if (size > io->size - io->pos)
+      size = io->size - io->pos;
+    memcpy(buf, io->data + io->pos, size);
+    io->pos += size;
+    return size;
+}
+
+
+static int member_seek(void *cookie, off64_t *off, int whence)
+{
+    off64_t      pos;
+    member_io_t *io = cookie;
+
+    if (whence == SEEK_SET)
+      pos = *off;
+    else if (whence == SEEK_CUR)
+      pos = io->pos + *off;
+    else if (whence == SEEK_END)
+      pos = io->size + *off;
+    else
+      return -1;
+
+    if (pos < 0)
+      return -1;
+    *off = io->pos = pos;
+    return 0;
+}
+
+
+static int member_close(void *cookie)
+{
+    member_io_t *io = cookie;
+
+    if (io->map)
+      munmap(io->map, io->map_len);
+    free(io);
+    return 0;
+}
+
+
+static unsigned get16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+
+static uint32_t get32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+static uint64_t get64(const unsigned char *p)
+{
+    return get32(p) | ((uint64_t)get32(p + 4) << 32);
+}
+
+
+static int is_pdf_name(const char *name, size_t len)
+{
+    return (len > 4) && (strncasecmp(name + len - 4, ".pdf", 4) == 0);
+}
+
+
+static void add_member(
+    pdf_member_t **members,
+    int           *n_members,
+    const char    *name,
+    size_t         name_len,
+    long           offset,
+    long           size,
+    long           raw_size,
+    int            method)
+{
+    int           cap;
+    pdf_member_t *m;
+
+    /* Grown to the next power of two when full */
+    if (!(*n_members & (*n_members - 1)))
+    {
+        cap = *n_members ? *n_members * 2 : 1;
+        if (!(m = realloc(*members, sizeof(pdf_member_t) * cap)))
+        {
+            ERR("Failed to allocate requested number of bytes, "
+                "out of memory?\n");
+            exit(EXIT_FAILURE);
+        }
+        *members = m;
+    }
+
+    m = &(*members)[(*n_members)++];
+    m->name = safe_calloc(name_len + 1);
+    memcpy(m->name, name, name_len);
+    m->offset = offset;
+    m->size = size;
+    m->raw_size = raw_size;
+    m->method = method;
+}
+
+
+static int list_zip(FILE *fp, const char *path, pdf_member_t **members)
+{
+    int            n;
+    long           size, tail_len;
+    unsigned int   flags, method, name_len, extra_len, comment_len;
+    uint64_t       n_entries, cd_size, cd_off, comp, raw, local;
+    unsigned char *tail, *cd, *p, *end, *x, *x_end, *v, *v_end, hdr[56];
+
+    /* The end of central directory record is within the last 64K */
+    fseek(fp, 0, SEEK_END);
+    if ((size = ftell(fp)) < 22)
+      return -1;
+    tail_len = size < 65536 + 22 ? size : 65536 + 22;
+    tail = safe_calloc(tail_len);
+    fseek(fp, size - tail_len, SEEK_SET);
+    if (fread(tail, 1, tail_len, fp) != tail_len)
+    {
+        free(tail);
+        return -1;
+    }
+    for (p=tail+tail_len-22; p>=tail; --p)
+      if (memcmp(p, "PK\5\6", 4) == 0)
+        break;
+    if (p < tail)
+    {
+        free(tail);
+        return -1;
+    }
+
+    n_entries = get16(p + 10);
+    cd_size = get32(p + 12);
+    cd_off = get32(p + 16);
+
+    /* Zip64 keeps the real values in a record of its own */
+    if ((p - tail >= 20) && (memcmp(p - 20, "PK\6\7", 4) == 0))
+    {
+        fseek(fp, get64(p - 20 + 8), SEEK_SET);
+        if ((fread(hdr, 1, 56, fp) == 56) && (memcmp(hdr, "PK\6\6", 4) == 0))
+        {
+            n_entries = get64(hdr + 32);
+            cd_size = get64(hdr + 40);
+            cd_off = get64(hdr + 48);
+        }
+    }
+    free(tail);
+
+    n = 0;
+    if (!n_entries || !cd_size || (cd_off + cd_size > size))
+      return 0;
+
+    cd = safe_calloc(cd_size);
+    fseek(fp, cd_off, SEEK_SET);
+    if (fread(cd, 1, cd_size, fp) != cd_size)
+    {
+        free(cd);
+        return -1;
+    }
+
+    end = cd + cd_size;
+    for (p=cd; (p + 46 <= end) && (memcmp(p, "PK\1\2", 4) == 0);
+         p+=46+name_len+extra_len+comment_len)
+    {
+        flags = get16(p + 8);
+        method = get16(p + 10);
+        comp = get32(p + 20);
+        raw = get32(p + 24);
+        name_len = get16(p + 28);
+        extra_len = get16(p + 30);
+        comment_len = get16(p + 32);
+        local = get32(p + 42);
+        if (p + 46 + name_len + extra_len + comment_len > end)
+          break;
+        if (!is_pdf_name((char *)p + 46, name_len) || !raw)
+          continue;
+
+        /* Zip64 extra field, with only the values that did not fit */
+        x = p + 46 + name_len;
+        for (x_end=x+extra_len; x+4<=x_end; x+=4+get16(x+2))
+        {
+            v = x + 4;
+            if ((v_end = x + 4 + get16(x + 2)) > x_end)
+              break;
+            if (get16(x) != 1)
+              continue;
+            if ((raw == 0xffffffff) && (v + 8 <= v_end))
+            {
+                raw = get64(v);
+                v += 8;
+            }
+            if ((comp == 0xffffffff) && (v + 8 <= v_end))
+            {
+                comp = get64(v);
+                v += 8;
+            }
+            if ((local == 0xffffffff) && (v + 8 <= v_end))
+              local = get64(v);
+        }
+
+        if (flags & 1)
+        {
+            ERR("'%s/%.*s' is encrypted, skipping it\n",
+                path, (int)name_len, p + 46);
+            continue;
+        }
+        if ((method != PDF_MEMBER_STORED) && (method != PDF_MEMBER_DEFLATED))
+        {
+            ERR("'%s/%.*s' is compressed with method %u, skipping it\n",
+                path, (int)name_len, p + 46, method);
+            continue;
+        }
+
+        /* The data follows the local header, whose extra field can differ */
+        fseek(fp, local, SEEK_SET);
+        if ((fread(hdr, 1, 30, fp) != 30) || (memcmp(hdr, "PK\3\4", 4) != 0))
+        {
+            ERR("'%s/%.*s' has a bad local header, skipping it\n",
+                path, (int)name_len, p + 46);
+            continue;
+        }
+        local += 30 + get16(hdr + 26) + get16(hdr + 28);
+        if ((local + comp > size) ||
+            ((method == PDF_MEMBER_STORED) && (comp != raw)))
+        {
+            ERR("'%s/%.*s' is truncated, skipping it\n",
+                path, (int)name_len, p + 46);
+            continue;
+        }
+
+        add_member(members, &n, (char *)p + 46, name_len, local, comp, raw,
+                   method);
+    }
+
+    free(cd);
+    return n;
+}
+
+
+/* Octal, or base-256 for values too large for it (GNU and star) */
+static uint64_t tar_number(const unsigned char *field, size_t len)
+{
+    size_t   i;
+    uint64_t v;
+
+    v = 0;
+    if (field[0] & 0x80)
+    {
+        for (i=1; i<len; ++i)
+          v = (v << 8) | field[i];
+        return v;
+    }
+
+    for (i=0; i<len && field[i]==' '; ++i)
+      ;
+    for (; i<len && field[i]>='0' && field[i]<='7'; ++i)
+      v = (v << 3) | (field[i] - '0');
+    return v;
+}
+
+
+static int tar_checksum_ok(const unsigned char *hdr)
+{
+    int      i;
+    unsigned sum;
+
+    for (i=0, sum=0; i<TAR_BLOCK; ++i)
+      sum += (i >= 148 && i < 156) ? ' ' : hdr[i];
+    return sum == tar_number(hdr + 148, 8);
+}
+
+
+/* Pulls "path" and "size" out of the records of a pax extended header */
+static void parse_pax(char *recs, size_t len, char **name, int64_t *size)
+{
+    char   *c, *eq, *end;
+    size_t  rec_len;
+
+    end = recs + len;
+    for (c=recs; c<end; c+=rec_len)
+    {
+        if (!(rec_len = strtoul(c, &eq, 10)) || (c + rec_len > end))
+          break;
+        if (!(eq = memchr(eq, '=', c + rec_len - eq)))
+          continue;
+        if (strncmp(eq - 5, " path", 5) == 0)
+        {
+            free(*name);
+            *name = safe_calloc(c + rec_len - eq);
+            memcpy(*name, eq + 1, c + rec_len - eq - 2);
+        }
+        else if (strncmp(eq - 5, " size", 5) == 0)
+          *size = strtoll(eq + 1, NULL, 10);
+    }
+}
+
+
+static int list_tar(FILE *fp, const char *path, pdf_member_t **members)
+{
+    int            n, is_end;
+    char          *ext, *name, full[256 + 2];
+    long           pos, file_size;
+    int64_t        size, ext_size;
+    unsigned char  hdr[TAR_BLOCK];
+    static const unsigned char zeros[TAR_BLOCK];
+
+    n = is_end = 0;
+    pos = 0;
+    name = NULL;
+    ext_size = -1;
+    fseek(fp, 0, SEEK_END);
+    file_size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    while (fread(hdr, 1, TAR_BLOCK, fp) == TAR_BLOCK)
+    {
+        if ((is_end = (memcmp(hdr, zeros, TAR_BLOCK) == 0)))
+          break;
+        if (!tar_checksum_ok(hdr))
+        {
+            if (pos == 0)
+              return -1;
+            ERR("'%s' has a bad header at %ld, the rest is skipped\n",
+                path, pos);
+            break;
+        }
+
+        size = tar_number(hdr + 124, 12);
+        pos += TAR_BLOCK;
+
+        /* Extended headers describe the member after them */
+        if ((hdr[156] == 'x') || (hdr[156] == 'L'))
+        {
+            if ((size <= 0) || (size > MAX_EXT_HDR))
+              break;
+            ext = safe_calloc(size + 1);
+            if (fread(ext, 1, size, fp) != size)
+            {
+                free(ext);
+                break;
+            }
+            if (hdr[156] == 'x')
+              parse_pax(ext, size, &name, &ext_size);
+            else
+            {
+                free(name);
+                name = ext;
+                ext = NULL;
+            }
+            free(ext);
+        }
+        else if ((hdr[156] == '0') || (hdr[156] == '\0') || (hdr[156] == '7'))
+        {
+            if (ext_size >= 0)
+              size = ext_size;
+            if (!name)
+            {
+                if (hdr[345])
+                  snprintf(full, sizeof(full), "%.155s/%.100s",
+                           (char *)hdr + 345, (char *)hdr);
+                else
+                  snprintf(full, sizeof(full), "%.100s", (char *)hdr);
+            }
+            if (pos + size > file_size)
+            {
+                ERR("'%s/%s' is truncated, skipping it\n",
+                    path, name ? name : full);
+                size = 0;
+            }
+            if (size && is_pdf_name(name ? name : full,
+                                    strlen(name ? name : full)))
+              add_member(members, &n, name ? name : full,
+                         strlen(name ? name : full), pos, size, size,
+                         PDF_MEMBER_STORED);
+            free(name);
+            name = NULL;
+            ext_size = -1;
+        }
+
+        /* Data is padded to whole blocks */
+        pos += (size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+        if (fseek(fp, pos, SEEK_SET) != 0)
+          break;
+    }
+
+    free(name);
+
+    /* Not even one header */
+    return (pos || is_end) ? n : -1;
+}
+
+
+int pdf_container_list(const char *path, pdf_member_t **members)
+{
+    int            n;
+    FILE          *fp;
+    unsigned char  magic[4];
+
+    *members = NULL;
+    if (!(fp = fopen(path, "r")))
+      return -1;
+
+    n = -1;
+    if ((fread(magic, 1, 4, fp) == 4) &&
+        ((memcmp(magic, "PK\3\4", 4) == 0) || (memcmp(magic, "PK\5\6", 4) == 0)))
+      n = list_zip(fp, path, members);
+    else
+      n = list_tar(fp, path, members);
+
+    fclose(fp);
+    return n;
+}
+
+
+void pdf_container_free(pdf_member_t *members, int n_members)
+{
+    int i;
+
+    for (i=0; i<n_members; ++i)
+      free(members[i].name);
+    free(members);
+}
+
+
+#ifdef HAVE_ZLIB
+/* Inflate 'in' into 'out' if set, or else into 'spool'.  Returns 0 if the
+ * data inflated to exactly 'raw_size' bytes.
+ */
+static int inflate_member(
+    const unsigned char *in,
+    size_t               in_len,
+    char                *out,
+    size_t               raw_size,
+    FILE                *spool)
+{
+    int       err;
+    char     *chunk;
+    size_t    total;
+    z_stream  zs;
+
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, -MAX_WBITS) != Z_OK)
+      return -1;
+
+    chunk = out ? NULL : safe_calloc(INFLATE_CHUNK);
+    zs.next_in = (unsigned char *)in;
+    zs.avail_in = in_len;
+    total = 0;
+    do
+    {
+        zs.next_out = (unsigned char *)(out ? out + total : chunk);
+        zs.avail_out = out ? raw_size - total : INFLATE_CHUNK;
+        err = inflate(&zs, Z_NO_FLUSH);
+        if (!out && (fwrite(chunk, 1, INFLATE_CHUNK - zs.avail_out, spool) !=
+                     INFLATE_CHUNK - zs.avail_out))
+          err = Z_ERRNO;
+        total = zs.total_out;
+    } while ((err == Z_OK) && (total <= raw_size));
+
+    inflateEnd(&zs);
+    free(chunk);
+    return ((err == Z_STREAM_END) && (total == raw_size)) ? 0 : -1;
+}
+#endif
+
+
+FILE *pdf_member_open(
+    const char         *path,
+    const pdf_member_t *member,
+    pdf_member_buf_t   *buf)
+{
+    int          fd;
+    long         page, start;
+    char        *data;
+    void        *map;
+    size_t       map_len;
+    FILE        *fp;
+    member_io_t *io;
+    struct stat  st;
+    static const cookie_io_functions_t funcs =
+    {
+        .read = member_read,
+        .seek = member_seek,
+        .close = member_close,
+    };
+
+#ifndef HAVE_ZLIB
+    (void)buf; /* Only deflated members are inflated into it */
+    if (member->method == PDF_MEMBER_DEFLATED)
+    {
+        ERR("'%s/%s' is compressed, pdfresurrect was built without zlib\n",
+            path, member->name);
+        return NULL;
+    }
+#endif
+
+    /* Map the (page aligned) range of the archive that holds the data, which
+     * must still be there (reading past the end of a mapping is fatal).
+     */
+    if ((fd = open(path, O_RDONLY)) < 0)
+      return NULL;
+    if ((fstat(fd, &st) != 0) || (member->size <= 0) ||
+        (member->offset + member->size > st.st_size))
+    {
+        close(fd);
+        return NULL;
+    }
+    page = sysconf(_SC_PAGESIZE);
+    start = member->offset / page * page;
+    map_len = member->offset - start + member->size;
+    map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, start);
+    close(fd);
+    if (map == MAP_FAILED)
+      return NULL;
+    data = (char *)map + (member->offset - start);
+
+    io = safe_calloc(sizeof(member_io_t));
+    if (member->method == PDF_MEMBER_STORED)
+    {
+        madvise(map, map_len, MADV_WILLNEED);
+        io->data = data;
+        io->size = member->size;
+        io->map = map;
+        io->map_len = map_len;
+    }
+#ifdef HAVE_ZLIB
+    else if (member->raw_size > INFLATE_MAX)
+    {
+        fp = tmpfile();
+        if (!fp || (inflate_member((unsigned char *)data, member->size, NULL,
+                                   member->raw_size, fp) != 0))
+        {
+            ERR("Could not inflate '%s/%s'\n", path, member->name);
+            if (fp)
+              fclose(fp);
+            munmap(map, map_len);
+            free(io);
+            return NULL;
+        }
+        munmap(map, map_len);
+        free(io);
+        rewind(fp);
+        return fp;
+    }
+    else
+    {
+        /* The buffer only ever grows, up to INFLATE_MAX */
+        if (buf->size < member->raw_size)
+        {
+            free(buf->data);
+            buf->data = safe_calloc(member->raw_size);
+            buf->size = member->raw_size;
+        }
+        if (inflate_member((unsigned char *)data, member->size, buf->data,
+                           member->raw_size, NULL) != 0)
+        {
+            ERR("Could not inflate '%s/%s'\n", path, member->name);
+            munmap(map, map_len);
+            free(io);
+            return NULL;
+        }
+        munmap(map, map_len);
+        io->data = buf->data;
+        io->size = member->raw_size;
+    }
+#endif
+
+    if (!(fp = fopencookie(io, "r", funcs)))
+      member_close(io);
+    return fp;
+}
@@ -0,0 +1,351 @@
+/******************************************************************************
+ * index.c
+ *
+ * pdfresurrect - PDF history extraction tool
+ * https://github.com/enferex/pdfresurrect
+ *
+ * See https://github.com/enferex/pdfresurrect/blob/master/LICENSE for license
+ * information.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Special thanks to all of the contributors:  See AUTHORS.
+ * Special thanks to 757labs (757 crew), they are a great group
+ * of people to hack on projects and brainstorm with.
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "pdf.h"
+#include "main.h"
+
+
+/*
+ * Sidecar index
+ *
+ * PDF revisions are only ever appended, so everything parsed from the first
+ * 'file_size' bytes of a document stays valid as long as those bytes do.  The
+ * sidecar holds that parsed state:
+ *
+ *   header:  magic, format, byte order mark, file_size, file identity
+ *            (device, inode, mtime), prefix hash, counts and document wide
+ *            flags
+ *   eofs:    n_eofs offsets
+ *   xrefs:   n_xrefs records, each followed by its entries and creator data
+ *            (as far as they had been loaded, see PDF_LOAD_*)
+ *   strpool: strpool_len bytes
+ *
+ * Values are stored in host byte order, the byte order mark rejects an index
+ * written on a foreign host.  A document that is still the same file, with
+ * the same size and mtime, is taken as unchanged.  Anything else, such as a
+ * document that grew, must hash the same over the whole of its old size.
+ */
+
+#define INDEX_MAGIC      "PDFRIDX"
+#define INDEX_FORMAT     8
+#define INDEX_BOM        0x01020304
+
+
+typedef struct _index_header_t
+{
+    char     magic[8];
+    uint32_t format;
+    uint32_t bom;
+    int64_t  file_size;
+    uint64_t dev;
+    uint64_t ino;
+    int64_t  mtime_ns;
+    uint64_t prefix_hash;
+    int32_t  n_eofs;
+    int32_t  n_xrefs;
+    int32_t  has_xref_streams;
+    int16_t  pdf_major_version;
+    int16_t  pdf_minor_version;
+    uint64_t strpool_len;
+} index_header_t;
+
+
+typedef struct _index_xref_t
+{
+    int64_t start;
+    int64_t end;
+    int32_t n_entries;
+    int32_t n_creator_entries;
+    int32_t is_stream;
+    int32_t n_stream_entries;
+    int32_t is_linear;
+    int32_t version;
+    int32_t is_recovered;
+    int32_t loaded;
+} index_xref_t;
+
+
+typedef struct _index_entry_t
+{
+    uint64_t hash;
+    int64_t  offset;
+    int32_t  obj_id;
+    uint16_t gen_num;
+    char     f_or_n;
+} index_entry_t;
+
+
+/* FNV-1a over the first 'size' bytes of 'fp' */
+static uint64_t hash_prefix(FILE *fp, long size)
+{
+    char     buf[64 * 1024];
+    long     left;
+    size_t   i, n;
+    uint64_t hash;
+
+    hash = 0xcbf29ce484222325ULL;
+    fseek(fp, 0, SEEK_SET);
+    for (left=size; (left > 0) &&
+         (n = fread(buf, 1, (left < sizeof(buf)) ? left : sizeof(buf), fp));
+         left-=n)
+      for (i=0; i<n; ++i)
+      {
+          hash ^= (unsigned char)buf[i];
+          hash *= 0x100000001b3ULL;
+      }
+
+    return hash ^ (uint64_t)size;
+}
+
+
+/* Device, inode and mtime of 'fp' into 'hdr', 0 if they cannot be had */
+static int get_identity(FILE *fp, index_header_t *hdr)
+{
+    struct stat st;
+
+    if (fstat(fileno(fp), &st) != 0)
+      return 0;
+
+    hdr->dev = st.st_dev;
+    hdr->ino = st.st_ino;
+    hdr->mtime_ns = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    return 1;
+}
+
+
+static long get_file_size(FILE *fp)
+{
+    long size;
+
+    if (fseek(fp, 0, SEEK_END) != 0)
+      return -1;
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    return size;
+}
+
+
+/* Bytes of 'idx' left to read */
+#define IDX_LEFT(_idx) (idx_size - ftell(_idx))
+
+
+int pdf_load_index(FILE *fp, pdf_t *pdf, FILE *idx)
+{
+    int            i, j, ok;
+    long           size, idx_size;
+    xref_t        *xrefs;
+    index_header_t hdr, now;
+    index_xref_t   ix;
+    index_entry_t  ie;
+    xref_entry_t   entry;
+
+    /* Nothing is sized by a count before it is checked against what the
+     * document (one "%%EOF" per marker) and the index can hold.
+     */
+    if ((idx_size = get_file_size(idx)) < 0                     ||
+        fread(&hdr, sizeof(hdr), 1, idx) != 1                   ||
+        memcmp(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic)) != 0  ||
+        hdr.format != INDEX_FORMAT || hdr.bom != INDEX_BOM      ||
+        hdr.n_eofs < 0 || hdr.n_xrefs != hdr.n_eofs             ||
+        hdr.file_size < 0 || hdr.n_eofs > hdr.file_size / 5     ||
+        hdr.n_eofs > IDX_LEFT(idx) / sizeof(int64_t)            ||
+        hdr.strpool_len < 1 || hdr.strpool_len > IDX_LEFT(idx))
+      return 0;
+
+    /* The document must have only grown, and its prefix must be unchanged:
+     * either it is the very file that was indexed, or it hashes the same.
+     */
+    size = get_file_size(fp);
+    if ((size < hdr.file_size) ||
+        (!((size == hdr.file_size) && get_identity(fp, &now) &&
+           (now.dev == hdr.dev) && (now.ino == hdr.ino) &&
+           (now.mtime_ns == hdr.mtime_ns)) &&
+         (hash_prefix(fp, hdr.file_size) != hdr.prefix_hash)))
+    {
+        fseek(fp, 0, SEEK_SET);
+        return 0;
+    }
+    fseek(fp, 0, SEEK_SET);
+
+    /* Read everything aside, and only adopt it once it all checks out */
+    ok = 1;
+    xrefs = hdr.n_xrefs ? safe_calloc(sizeof(xref_t) * hdr.n_xrefs) : NULL;
+    pdf->eof_cap = hdr.n_eofs ? hdr.n_eofs : 16;
+    free(pdf->eofs);
+    pdf->eofs = safe_calloc(sizeof(long) * pdf->eof_cap);
+    for (i=0; ok && i<hdr.n_eofs; ++i)
+    {
+        int64_t pos;
+        ok = (fread(&pos, sizeof(pos), 1, idx) == 1);
+        pdf->eofs[i] = pos;
+    }
+
+    for (i=0; ok && i<hdr.n_xrefs; ++i)
+    {
+        if (!(ok = (fread(&ix, sizeof(ix), 1, idx) == 1)) ||
+            !(ok = ((ix.n_entries >= 0) && (ix.n_creator_entries >= 0) &&
+                    (ix.n_stream_entries >= 0) &&
+                    (ix.n_entries <= IDX_LEFT(idx) / sizeof(ie)) &&
+                    (ix.n_creator_entries <=
+                     IDX_LEFT(idx) / sizeof(pdf_creator_t)))))
+          break;
+
+        xrefs[i].start = ix.start;
+        xrefs[i].end = ix.end;
+        xrefs[i].is_stream = ix.is_stream;
+        xrefs[i].n_stream_entries = ix.n_stream_entries;
+        xrefs[i].is_linear = ix.is_linear;
+        xrefs[i].version = ix.version;
+        xrefs[i].is_recovered = ix.is_recovered;
+        xrefs[i].loaded = ix.loaded;
+
+        for (j=0; ok && j<ix.n_entries; ++j)
+          if ((ok = (fread(&ie, sizeof(ie), 1, idx) == 1)))
+          {
+              entry.obj_id = ie.obj_id;
+              entry.offset = ie.offset;
+              entry.gen_num = ie.gen_num;
+              entry.f_or_n = ie.f_or_n;
+              entry.hash = ie.hash;
+              pdf_xref_add_entry(&xrefs[i], &entry);
+          }
+
+        if (ix.n_creator_entries)
+        {
+            xrefs[i].creator =
+                safe_calloc(sizeof(pdf_creator_t) * ix.n_creator_entries);
+            xrefs[i].n_creator_entries = ix.n_creator_entries;
+            ok = ok && (fread(xrefs[i].creator, sizeof(pdf_creator_t),
+                              ix.n_creator_entries, idx) ==
+                        ix.n_creator_entries);
+            for (j=0; ok && j<ix.n_creator_entries; ++j)
+              ok = ((uint64_t)xrefs[i].creator[j].key.off +
+                    xrefs[i].creator[j].key.len < hdr.strpool_len) &&
+                   ((uint64_t)xrefs[i].creator[j].value.off +
+                    xrefs[i].creator[j].value.len < hdr.strpool_len);
+        }
+    }
+
+    if (ok)
+    {
+        free(pdf->strpool);
+        pdf->strpool_cap = hdr.strpool_len;
+        pdf->strpool_len = hdr.strpool_len;
+        pdf->strpool = safe_calloc(pdf->strpool_cap);
+        ok = (fread(pdf->strpool, 1, hdr.strpool_len, idx) ==
+              hdr.strpool_len) && (pdf->strpool[hdr.strpool_len - 1] == '\0');
+    }
+
+    if (!ok)
+    {
+        for (i=0; i<hdr.n_xrefs; ++i)
+        {
+            pdf_xref_free_entries(&xrefs[i]);
+            free(xrefs[i].creator);
+        }
+        free(xrefs);
+        free(pdf->eofs);
+        pdf->eofs = NULL;
+        pdf->n_eofs = pdf->eof_cap = 0;
+
+        /* Back to a fresh, empty pool */
+        pdf->strpool_len = 1;
+        pdf->strpool[0] = '\0';
+        return 0;
+    }
+
+    pdf->n_eofs = hdr.n_eofs;
+    pdf->n_xrefs = hdr.n_xrefs;
+    pdf->xrefs = xrefs;
+    pdf->has_xref_streams = hdr.has_xref_streams;
+    pdf->indexed_size = hdr.file_size;
+    pdf->stats.cache_hits += hdr.n_xrefs;
+    return 1;
+}
+
+
+int pdf_save_index(FILE *fp, const pdf_t *pdf, FILE *idx)
+{
+    int            i, j;
+    long           size;
+    index_header_t hdr;
+    index_xref_t   ix;
+    index_entry_t  ie;
+
+    if ((size = get_file_size(fp)) < 0)
+      return -1;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic));
+    hdr.format = INDEX_FORMAT;
+    hdr.bom = INDEX_BOM;
+    hdr.file_size = size;
+    get_identity(fp, &hdr);
+    hdr.prefix_hash = hash_prefix(fp, size);
+    hdr.n_eofs = pdf->n_eofs;
+    hdr.n_xrefs = pdf->n_xrefs;
+    hdr.has_xref_streams = pdf->has_xref_streams;
+    hdr.pdf_major_version = pdf->pdf_major_version;
+    hdr.pdf_minor_version = pdf->pdf_minor_version;
+    hdr.strpool_len = pdf->strpool_len;
+    fseek(fp, 0, SEEK_SET);
+
+    fwrite(&hdr, sizeof(hdr), 1, idx);
+    for (i=0; i<pdf->n_eofs; ++i)
+    {
+        int64_t pos = pdf->eofs[i];
+        fwrite(&pos, sizeof(pos), 1, idx);
+    }
+
+    for (i=0; i<pdf->n_xrefs; ++i)
+    {
+        const xref_t *xref = &pdf->xrefs[i];
+
+        memset(&ix, 0, sizeof(ix));
+        ix.start = xref->start;
+        ix.end = xref->end;
+        ix.n_entries = xref->n_entries;
+        ix.n_creator_entries = xref->creator ? xref->n_creator_entries : 0;
+        ix.is_stream = xref->is_stream;
+        ix.n_stream_entries = xref->n_stream_entries;
+        ix.is_linear = xref->is_linear;
+        ix.version = xref->version;
+        ix.is_recovered = xref->is_recovered;
+        ix.loaded = xref->loaded;
+        fwrite(&ix, sizeof(ix), 1, idx);
+
+        for (j=0; j<xref->n_entries; ++j)
+        {
+            memset(&ie, 0, sizeof(ie));
+            ie.obj_id = xref->obj_ids[j];
+            ie.offset = xref->offsets[j];
+            ie.gen_num = XREF_GEN_NUM(xref, j);
+            ie.f_or_n = XREF_F_OR_N(xref, j);
+            ie.hash = XREF_HASH(xref, j);
+            fwrite(&ie, sizeof(ie), 1, idx);
+        }
+
+        if (ix.n_creator_entries)
+          fwrite(xref->creator, sizeof(pdf_creator_t),
+                 ix.n_creator_entries, idx);
+    }
+
+    fwrite(pdf->strpool, 1, pdf->strpool_len, idx);
+    return ferror(idx) ? -1 : 0;
+}
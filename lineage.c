@@ -0,0 +1,162 @@
+/******************************************************************************
+ * lineage.c
+ *
+ * pdfresurrect - PDF history extraction tool
+ * https://github.com/enferex/pdfresurrect
+ *
+ * See https://github.com/enferex/pdfresurrect/blob/master/LICENSE for license
+ * information.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Special thanks to all of the contributors:  See AUTHORS.
+ * Special thanks to 757labs (757 crew), they are a great group
+ * of people to hack on projects and brainstorm with.
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "pdf.h"
+#include "main.h"
+
+
+/*
+ * Object lineage
+ *
+ * Every entry of every versioned xref becomes a record, and the records are
+ * grouped by object id with a counting sort: one pass counts the entries of
+ * each id, a prefix sum turns the counts into the start of each group, and a
+ * second pass drops the records into place.  The xrefs are visited in order,
+ * so each group ends up oldest first without comparing anything.  The history
+ * of an object is then the slice of records between the start of its group
+ * and that of the next id.
+ *
+ * Ids come from the document and can be as large as INT_MAX, so the groups
+ * are those of the distinct ids in ascending order, found with a binary
+ * search, rather than of every id up to the largest one.
+ */
+
+struct _pdf_lineage_t
+{
+    int                n_ids;
+    int               *ids;   /* Distinct object ids, ascending */
+    int               *first; /* Records of ids[k]: first[k] .. first[k+1] */
+    pdf_lineage_rec_t *recs;
+};
+
+
+static int cmp_id(const void *a, const void *b)
+{
+    const int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+
+/* Group of 'obj_id', -1 if it has none */
+static int find_id(const pdf_lineage_t *lin, int obj_id)
+{
+    const int *id;
+
+    id = bsearch(&obj_id, lin->ids, lin->n_ids, sizeof(int), cmp_id);
+    return id ? (int)(id - lin->ids) : -1;
+}
+
+
+pdf_lineage_t *pdf_lineage_new(const pdf_t *pdf)
+{
+    int            i, j, k, n, *next;
+    char          *status;
+    const xref_t  *xref;
+    pdf_lineage_t *lin;
+
+    lin = safe_calloc(sizeof(pdf_lineage_t));
+
+    for (i=0, n=0; i<pdf->n_xrefs; ++i)
+      for (j=0; pdf->xrefs[i].version && j<pdf->xrefs[i].n_entries; ++j)
+        if (pdf->xrefs[i].obj_ids[j] >= 0)
+          ++n;
+    if (!n)
+      return lin;
+
+    /* The distinct ids */
+    lin->ids = safe_calloc(sizeof(int) * n);
+    for (i=0, n=0; i<pdf->n_xrefs; ++i)
+      for (j=0; pdf->xrefs[i].version && j<pdf->xrefs[i].n_entries; ++j)
+        if (pdf->xrefs[i].obj_ids[j] >= 0)
+          lin->ids[n++] = pdf->xrefs[i].obj_ids[j];
+    qsort(lin->ids, n, sizeof(int), cmp_id);
+    for (i=0, k=0; i<n; ++i)
+      if (!k || (lin->ids[k - 1] != lin->ids[i]))
+        lin->ids[k++] = lin->ids[i];
+    lin->n_ids = k;
+
+    /* Count the entries of each id, and where its group starts */
+    lin->first = safe_calloc(sizeof(int) * (lin->n_ids + 1));
+    for (i=0; i<pdf->n_xrefs; ++i)
+      for (j=0; pdf->xrefs[i].version && j<pdf->xrefs[i].n_entries; ++j)
+        if (pdf->xrefs[i].obj_ids[j] >= 0)
+          ++lin->first[find_id(lin, pdf->xrefs[i].obj_ids[j]) + 1];
+    for (k=1; k<=lin->n_ids; ++k)
+      lin->first[k] += lin->first[k - 1];
+
+    /* Place the records, version by version */
+    lin->recs = safe_calloc(sizeof(pdf_lineage_rec_t) * n);
+    next = safe_calloc(sizeof(int) * lin->n_ids);
+    memcpy(next, lin->first, sizeof(int) * lin->n_ids);
+    status = NULL;
+    for (i=0; i<pdf->n_xrefs; ++i)
+    {
+        xref = &pdf->xrefs[i];
+        if (!xref->version || !xref->n_entries)
+          continue;
+
+        free(status);
+        status = safe_calloc(xref->n_entries);
+        pdf_get_object_statuses(pdf, i, status);
+
+        for (j=0; j<xref->n_entries; ++j)
+        {
+            pdf_lineage_rec_t *rec;
+
+            if (xref->obj_ids[j] < 0)
+              continue;
+            rec = &lin->recs[next[find_id(lin, xref->obj_ids[j])]++];
+            rec->version = xref->version;
+            rec->xref_idx = i;
+            rec->offset = xref->offsets[j];
+            rec->gen_num = XREF_GEN_NUM(xref, j);
+            rec->status = status[j];
+        }
+    }
+
+    free(status);
+    free(next);
+    return lin;
+}
+
+
+int pdf_lineage_get(
+    const pdf_lineage_t      *lin,
+    int                       obj_id,
+    const pdf_lineage_rec_t **recs)
+{
+    int k;
+
+    *recs = NULL;
+    if (!lin->recs || ((k = find_id(lin, obj_id)) == -1))
+      return 0;
+
+    *recs = lin->recs + lin->first[k];
+    return lin->first[k + 1] - lin->first[k];
+}
+
+
+void pdf_lineage_delete(pdf_lineage_t *lin)
+{
+    if (!lin)
+      return;
+
+    free(lin->ids);
+    free(lin->first);
+    free(lin->recs);
+    free(lin);
+}
@@ -15,8 +15,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include <string.h>
+#include <strings.h>
 #include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include "main.h"
@@ -26,79 +31,228 @@
 static void usage(void)
 {
     printf("-- " EXEC_NAME " v" VER" --\n"
-           "Usage: ./" EXEC_NAME " <file.pdf> [-i] [-w] [-q]\n"
+           "Usage: ./" EXEC_NAME " <file.pdf | dir | archive | -> [file.pdf ...] "
+           "[-i] [-w] [-q] [-s] [-x] [--stats] [--diff | --diff-streams]\n"
+           "       [--store=<file>] [--prefetch[=<threads>]] [-j[<jobs>] [--unordered]]\n"
+           "       [--scan-threads=<threads>] [--max-time=<ms>] "
+           "[--max-bytes=<bytes>]\n"
+           "       [--max-alloc=<bytes>] [--max-versions=<versions>]\n"
+           "       [--history <obj>] [-v <version> [-o <file | ->]] "
+           "[--tar=<file | ->]\n"
            "\t -i Display PDF creator information\n"
            "\t -w Write the PDF versions and summary to disk\n"
-           "\t -q Display only the number of versions contained in the PDF\n");
-// Experimental feature:
-//           "\t -s Scrub the previous history data from the specified PDF\n");
+           "\t --tar=<file> Like -w, into a single tar archive ('-' for "
+           "stdout)\n"
+           "\t -q Display only the number of versions contained in the PDF\n"
+           "\t -s Scrub the previous history data from the specified PDF\n"
+           "\t -v <version> Write only that version, as it was saved, to "
+           "<file>-version-<version>.pdf\n"
+           "\t    or with -o to <file> ('-' for stdout), and nothing else\n"
+           "\t -x Keep a <file.pdf>" INDEX_SUFFIX " index of the parsed "
+           "xrefs, so that later runs\n"
+           "\t    only parse what was appended to the PDF since\n"
+           "\t --stats Display phase timings and I/O counters per document "
+           "and in total\n"
+           "\t --diff  Display a diff of each modified object against its "
+           "previous version\n"
+           "\t --diff-streams Like --diff, also comparing (inflated) stream "
+           "data\n"
+           "\t --store=<file> Record every object in a store shared by all "
+           "documents, and\n"
+           "\t    report objects that were first seen in another document\n"
+           "\t --prefetch[=<threads>] Read upcoming documents and objects "
+           "ahead of the parser\n"
+           "\t    with a pool of threads (default %d)\n"
+           "\t -j[<jobs>] Process that many documents in parallel (one per "
+           "CPU by default)\n"
+           "\t --unordered With -j, print each document as soon as it is "
+           "done\n"
+           "\t --scan-threads=<threads> Threads that search a large "
+           "document for %%%%EOF markers\n"
+           "\t    and parse its revisions (by default the CPUs that -j "
+           "leaves idle)\n"
+           "\t --max-time=<ms>, --max-bytes=<bytes>, --max-alloc=<bytes>, "
+           "--max-versions=<versions>\n"
+           "\t    Give up on a document that takes longer, reads more, "
+           "needs a larger single\n"
+           "\t    allocation, or has more versions (bytes may end in K, M "
+           "or G)\n"
+           "\t --history <obj> Display every version of object <obj> instead "
+           "of the summary\n",
+           DEFAULT_PREFETCH_THREADS);
     exit(0);
 }
 
 
 static void write_version(
-    FILE       *fp,
-    const char *fname,
-    const char *dirname,
-    xref_t     *xref)
+    FILE        *fp,
+    const char  *fname,
+    const char  *dirname,
+    pdf_t       *pdf,
+    int          xref_idx)
 {
-    long  start;
-    char *c, *new_fname, data;
+    char *new_fname;
     FILE *new_fp;
 
-    start = ftell(fp);
-
-    /* Create file */
-    if ((c = strstr(fname, ".pdf")))
-      *c = '\0';
+    /* Create file, 'fname' is already without its extension */
     new_fname = safe_calloc(strlen(fname) + strlen(dirname) + 32);
     snprintf(new_fname, strlen(fname) + strlen(dirname) + 32,
-             "%s/%s-version-%d.pdf", dirname, fname, xref->version);
+             "%s/%s-version-%d.pdf", dirname, fname,
+             pdf->xrefs[xref_idx].version);
 
     if (!(new_fp = fopen(new_fname, "w")))
     {
         ERR("Could not create file '%s'\n", new_fname);
-        fseek(fp, start, SEEK_SET);
         free(new_fname);
         return;
     }
 
-    /* Copy original PDF */
-    fseek(fp, 0, SEEK_SET);
-    while (fread(&data, 1, 1, fp))
-      fwrite(&data, 1, 1, new_fp);
-
-    /* Emit an older startxref, referring to an older version. */
-    fprintf(new_fp, "\r\nstartxref\r\n%ld\r\n%%%%EOF", xref->start);
+    if (pdf_write_version(fp, pdf, xref_idx, new_fp) != 0)
+      ERR("Failed to write '%s'\n", new_fname);
 
     /* Clean */
     fclose(new_fp);
     free(new_fname);
-    fseek(fp, start, SEEK_SET);
 }
 
 
-#ifdef PDFRESURRECT_EXPERIMENTAL
-static void scrub_document(FILE *fp, const pdf_t *pdf)
+/* Copy the one version asked for to 'out_name', stdout if "-", or to
+ * "<base>-version-N.pdf" otherwise ('base' as from output_name()).
+ */
+static int extract_version(
+    FILE        *fp,
+    pdf_t       *pdf,
+    int          version,
+    const char  *out_name,
+    const char  *base)
 {
+    int   i, j, ret;
+    char *new_name;
     FILE *new_fp;
-    int   ch, i, j, last_version ;
-    char *new_name, *c;
-    const char *suffix = "-scrubbed.pdf";
 
-    printf("The scrub feature (-s) is experimental and likely not to work as "
-           "expected.\n");
+    /* The first version of a linearized document has two xrefs, the
+     * first-page one and the one that closes the version: take the last
+     */
+    for (i=-1, j=0; j<pdf->n_xrefs; ++j)
+      if (pdf->xrefs[j].version == version)
+        i = j;
+    if (i == -1)
+    {
+        ERR("'%s' has no version %d\n", pdf->name, version);
+        return -1;
+    }
 
-    /* Create a new name */
-    if (!(new_name = malloc(strlen(pdf->name) + strlen(suffix) + 1)))
+    if (out_name && (strcmp(out_name, "-") == 0))
     {
-        ERR("Insufficient memory to create scrubbed file name\n");
-        return;
+        if ((ret = pdf_copy_version(fp, pdf, i, stdout)) != 0)
+          ERR("Failed to write version %d of '%s'\n", version, pdf->name);
+        return ret;
     }
 
-    strcpy(new_name, pdf->name);
-    if ((c = strrchr(new_name, '.')))
-      *c = '\0';
+    if (out_name)
+    {
+        new_name = safe_calloc(strlen(out_name) + 1);
+        strcpy(new_name, out_name);
+    }
+    else
+    {
+        new_name = safe_calloc(strlen(base) + 32);
+        sprintf(new_name, "%s-version-%d.pdf", base, version);
+    }
+
+    if (!(new_fp = fopen(new_name, "w")))
+    {
+        ERR("Could not create file '%s'\n", new_name);
+        free(new_name);
+        return -1;
+    }
+
+    if ((ret = pdf_copy_version(fp, pdf, i, new_fp)) != 0)
+      ERR("Failed to write '%s'\n", new_name);
+
+    fclose(new_fp);
+    free(new_name);
+    return ret;
+}
+
+
+/* The versions that -w writes to the 'dname' directory, as members of the
+ * archive instead.
+ */
+static int archive_versions(
+    FILE        *fp,
+    pdf_t       *pdf,
+    pdf_tar_t   *tar,
+    const char  *fname,
+    const char  *dname)
+{
+    int   i, ret;
+    char *member;
+
+    ret = 0;
+    member = safe_calloc(strlen(fname) + strlen(dname) + 32);
+    for (i=0; i<pdf->n_xrefs; i++)
+    {
+        if (!pdf->xrefs[i].version)
+          continue;
+        sprintf(member, "%s/%s-version-%d.pdf", dname, fname,
+                pdf->xrefs[i].version);
+        if (pdf_tar_add_version(tar, member, fp, pdf, i) != 0)
+          ret = -1;
+    }
+
+    free(member);
+    return ret;
+}
+
+
+/* Likewise for the summary, which is put together in memory first since its
+ * size goes in front of it.
+ */
+static int archive_summary(
+    FILE       *fp,
+    pdf_t      *pdf,
+    pdf_tar_t  *tar,
+    const char *dname,
+    pdf_flag_t  flags)
+{
+    int     ret;
+    char   *member, *buf;
+    size_t  len;
+    FILE   *saved_out, *mem;
+
+    if (!(mem = open_memstream(&buf, &len)))
+    {
+        ERR("Could not buffer the summary of '%s'\n", pdf->name);
+        return -1;
+    }
+    saved_out = pdf->out;
+    pdf->out = mem;
+    pdf_summarize(fp, pdf, NULL, flags);
+    pdf->out = saved_out;
+    fclose(mem);
+
+    member = safe_calloc(strlen(dname) * 2 + 16);
+    sprintf(member, "%s/%s.summary", dname, dname);
+    ret = pdf_tar_add(tar, member, buf, len);
+
+    free(member);
+    free(buf);
+    return ret;
+}
+
+
+static void scrub_document(FILE *fp, pdf_t *pdf, const char *base)
+{
+    FILE  *new_fp;
+    int    n_objs, n_valid, i;
+    char  *new_name;
+    pdf_t *scrubbed;
+    const char *suffix = "-scrubbed.pdf";
+
+    /* Create a new name */
+    new_name = safe_calloc(strlen(base) + strlen(suffix) + 1);
+    strcpy(new_name, base);
     strcat(new_name, suffix);
 
     if ((new_fp = fopen(new_name, "r")))
@@ -113,61 +267,75 @@ static void scrub_document(FILE *fp, const pdf_t *pdf)
     {
         ERR("Could not create file for saving scrubbed document\n");
         free(new_name);
-        fclose(new_fp);
         return;
     }
 
-    /* Copy */
-    fseek(fp, SEEK_SET, 0);
-    while ((ch = fgetc(fp)) != EOF)
-      fputc(ch, new_fp);
-
-    /* Find last version (don't zero these baddies) */
-    last_version = 0;
-    for (i=0; i<pdf->n_xrefs; i++)
-      if (pdf->xrefs[i].version)
-        last_version = pdf->xrefs[i].version;
-
-    /* Zero mod objects from all but the most recent version
-     * Zero del objects from all versions
-     */
-    fseek(new_fp, 0, SEEK_SET);
-    for (i=0; i<pdf->n_xrefs; i++)
+    /* Rewrite the live objects of the newest version */
+    if ((n_objs = pdf_write_scrubbed(fp, pdf, new_fp)) < 0)
     {
-        for (j=0; j<pdf->xrefs[i].n_entries; j++)
-          if (!pdf->xrefs[i].entries[j].obj_id)
-            continue;
-          else
-          {
-              switch (pdf_get_object_status(pdf, i, j))
-              {
-                  case 'M':
-                      if (pdf->xrefs[i].version != last_version)
-                        pdf_zero_object(new_fp, pdf, i, j);
-                      break;
+        ERR("Failed to write scrubbed document '%s'\n", new_name);
+        fclose(new_fp);
+        remove(new_name);
+        free(new_name);
+        return;
+    }
 
-                  case 'D':
-                      pdf_zero_object(new_fp, pdf, i, j);
-                      break;
+    /* Make sure what we wrote loads back as a single version */
+    fflush(new_fp);
+    scrubbed = pdf_new(new_name);
+    n_valid = 0;
+    if (pdf_is_pdf(new_fp))
+    {
+        pdf_get_version(new_fp, scrubbed);
+        if (pdf_load_xrefs(new_fp, scrubbed) > 0)
+          for (i=0; i<scrubbed->n_xrefs; ++i)
+            if (scrubbed->xrefs[i].version)
+              ++n_valid;
+    }
 
-                  default:
-                      break;
-              }
-          }
+    if (n_valid != 1)
+    {
+        ERR("Verification of scrubbed document '%s' failed\n", new_name);
+        remove(new_name);
     }
+    else
+      fprintf(pdf->out, "%s: Wrote %d objects to '%s'\n",
+              pdf->name, n_objs, new_name);
 
     /* Clean */
+    pdf_delete(scrubbed);
     free(new_name);
     fclose(new_fp);
 }
-#endif // PDFRESURRECT_EXPERIMENTAL
+
+
+/* Every version of object 'obj_id', oldest first */
+static void display_history(const pdf_t *pdf, int obj_id)
+{
+    int                      i, n;
+    pdf_lineage_t           *lin;
+    const pdf_lineage_rec_t *recs;
+
+    lin = pdf_lineage_new(pdf);
+    if (!(n = pdf_lineage_get(lin, obj_id, &recs)))
+      fprintf(pdf->out, "%s: Object %d is not in any version\n",
+              pdf->name, obj_id);
+
+    for (i=0; i<n; ++i)
+      fprintf(pdf->out,
+              "%s: --%c-- Version %d -- Object %d -- Offset %ld Gen %d\n",
+              pdf->name, recs[i].status, recs[i].version, obj_id,
+              recs[i].offset, recs[i].gen_num);
+
+    pdf_lineage_delete(lin);
+}
 
 
 static void display_creator(FILE *fp, const pdf_t *pdf)
 {
     int i;
 
-    printf("PDF Version: %d.%d\n",
+    fprintf(pdf->out, "PDF Version: %d.%d\n",
            pdf->pdf_major_version, pdf->pdf_minor_version);
 
     for (i=0; i<pdf->n_xrefs; ++i)
@@ -176,20 +344,96 @@ static void display_creator(FILE *fp, const pdf_t *pdf)
           continue;
 
         if (pdf_display_creator(pdf, i))
-          printf("\n");
+          fprintf(pdf->out, "\n");
+    }
+}
+
+
+/* The PDF_BUDGET_* limit as it is reported */
+static const char *budget_name(int limit)
+{
+    switch (limit)
+    {
+        case PDF_BUDGET_TIME:      return "time";
+        case PDF_BUDGET_BYTES:     return "byte";
+        case PDF_BUDGET_ALLOC:     return "allocation";
+        case PDF_BUDGET_REVISIONS: return "version";
+        default:                   return "unknown";
     }
 }
 
 
-static pdf_t *init_pdf(FILE *fp, const char *name)
+/* Loads 'stages' of the document, PDF_LOAD_*.  A document over its budget, or
+ * too broken to load, is dropped (and not indexed).
+ */
+static pdf_t *init_pdf(
+    FILE       *fp,
+    pdf_t      *pdf,
+    const char *idx_name,
+    int         stages,
+    int         do_hash,
+    pdf_prefetch_t *pf)
 {
-    pdf_t *pdf;
+    FILE *idx;
 
-    pdf = pdf_new(name);
     pdf_get_version(fp, pdf);
-    if (pdf_load_xrefs(fp, pdf) == -1) {
-      pdf_delete(pdf);
-      return NULL;
+
+    /* Pick up where the last run left off, if the document only grew */
+    if (idx_name && (idx = fopen(idx_name, "r")))
+    {
+        pdf_load_index(fp, pdf, idx);
+        fclose(idx);
+    }
+
+    if (pdf_load(fp, pdf, stages) == -1)
+    {
+        if (pdf->over_budget)
+        {
+            ERR("'%s' is over its %s budget, skipping it\n", pdf->name,
+                budget_name(pdf->over_budget));
+        }
+        else
+        {
+            ERR("'%s' could not be loaded, skipping it\n", pdf->name);
+        }
+        pdf_delete(pdf);
+        return NULL;
+    }
+
+    /* Have the objects on their way while they are being hashed */
+    if (pf && do_hash)
+      pdf_prefetch_objects(pf, fp, pdf);
+
+    /* Content hashes tell rewritten objects from modified ones */
+    if (do_hash)
+      pdf_hash_objects(fp, pdf);
+
+    if (pdf->over_budget)
+    {
+        ERR("'%s' is over its %s budget, skipping it\n", pdf->name,
+            budget_name(pdf->over_budget));
+        pdf_delete(pdf);
+        return NULL;
+    }
+
+    /* A document without a %%EOF has no revision that later ones append to */
+    if (idx_name && pdf->n_eofs)
+    {
+        if (!(idx = fopen(idx_name, "w")))
+        {
+            ERR("Could not open index '%s' for writing\n", idx_name);
+        }
+        else
+        {
+            if (pdf_save_index(fp, pdf, idx) != 0)
+            {
+                ERR("Failed to write index '%s'\n", idx_name);
+                fclose(idx);
+                remove(idx_name);
+            }
+            else
+              fclose(idx);
+        }
     }
 
     return pdf;
@@ -213,61 +457,213 @@ void *safe_calloc(size_t size) {
 }
 
 
-int main(int argc, char **argv)
+/* A document of the run, a file or a member of a zip or tar archive */
+typedef struct _doc_t
 {
-    int         i, n_valid, do_write, do_scrub;
-    char       *c, *dname, *name;
-    DIR        *dir;
-    FILE       *fp;
-    pdf_t      *pdf;
-    pdf_flag_t  flags;
+    char         *name;    /* "<archive>/<member>" for members */
+    char         *archive; /* NULL for files */
+    pdf_member_t  member;
+} doc_t;
 
-    if (argc < 2)
-      usage();
 
-    /* Args */
-    do_write = do_scrub = flags = 0;
-    name = NULL;
-    for (i=1; i<argc; i++)
+/* What the documents of a run share */
+typedef struct _run_t
+{
+    pdf_flag_t       flags;
+    int              do_write;
+    int              do_scrub;
+    int              do_index;
+    int              do_stats;
+    int              do_release; /* Drop each document from the page cache */
+    int              do_history; /* Display the history of 'history_obj' */
+    int              history_obj;
+    int              version;    /* -v, the only version to write */
+    const char      *out_name;   /* -o, where to write it */
+    pdf_tar_t       *tar;        /* --tar, what -w writes to instead */
+    FILE            *text;       /* stderr when stdout carries a PDF or tar */
+    pdf_store_t     *store;
+    pdf_prefetch_t  *pf;
+    int              n_prefetch;
+    int              scan_threads;
+    pdf_budget_t     budget;     /* Limits on each document */
+    pdf_sink_t      *sink;       /* Parallel runs print through this */
+
+    /* The documents in input order, and the next one to be taken */
+    doc_t           *docs;
+    int              n_docs;
+    atomic_int       next_doc;
+
+    /* Guards 'total' and 'ret' */
+    pthread_mutex_t  lock;
+    pdf_stats_t      total;
+    int              ret;
+} run_t;
+
+
+/* What the output files of a document are named after, without extension:
+ * the file itself, written to the current directory, or for a member the
+ * archive and the path of the member within it, written next to the archive
+ * ("dir/docs.zip-a-x" for "a/x.pdf" in "dir/docs.zip"), since members in
+ * different directories of an archive may share a name.
+ */
+static char *output_name(const doc_t *doc, const char *name)
+{
+    char       *base, *c, *end;
+    const char *n;
+
+    if (!doc->archive)
     {
-        if (strncmp(argv[i], "-w", 2) == 0)
-          do_write = 1;
-        else if (strncmp(argv[i], "-i", 2) == 0)
-          flags |= PDF_FLAG_DISP_CREATOR;
-        else if (strncmp(argv[i], "-q", 2) == 0)
-          flags |= PDF_FLAG_QUIET;
-#ifdef PDFRESURRECT_EXPERIMENTAL
-        else if (strncmp(argv[i], "-s", 2) == 0)
-          do_scrub = 1;
-#endif
-        else if (argv[i][0] != '-')
-          name = argv[i];
-        else if (argv[i][0] == '-')
-          usage();
+        n = (c = strrchr(name, '/')) ? c + 1 : name;
+        base = safe_calloc(strlen(n) + 1);
+        strcpy(base, n);
+        if ((c = strrchr(base, '.')))
+          *c = '\0';
+        return base;
     }
 
-    if (!name)
-      usage();
+    base = safe_calloc(strlen(doc->archive) + strlen(doc->member.name) + 2);
+    strcpy(base, doc->archive);
+    end = base + strlen(base);
+    *end++ = '-';
+    strcpy(end, doc->member.name);
+    if ((c = strrchr(end, '.')) && !strchr(c, '/'))
+      *c = '\0';
+    for (c=end; *c; ++c)
+      if (*c == '/')
+        *c = '-';
+    return base;
+}
+
+
+/* Everything about the document is printed to 'out' */
+static int process_document(
+    run_t            *run,
+    doc_t            *doc,
+    pdf_member_buf_t *buf,
+    FILE             *out)
+{
+    pdf_flag_t flags = run->flags;
+    int         i, n_valid, ret, stages;
+    char       *c, *base, *dname, *fname, *idx_name, *name;
+    DIR        *dir;
+    FILE       *fp, *in;
+    pdf_t      *pdf;
+    static char stdin_name[] = "stdin";
 
-    if (!(fp = fopen(name, "r")))
+    /* Members of an archive are read in place, "-" reads the PDF from stdin */
+    name = doc->name;
+    if (doc->archive)
     {
-        ERR("Could not open file '%s'\n", argv[1]);
+        if (!(in = pdf_member_open(doc->archive, &doc->member, buf)))
+        {
+            ERR("Could not open '%s'\n", name);
+            return -1;
+        }
+    }
+    else if (strcmp(name, "-") == 0)
+    {
+        in = stdin;
+        name = stdin_name;
+    }
+    else if (!(in = fopen(name, "r")))
+    {
+        ERR("Could not open file '%s'\n", name);
         return -1;
     }
-    else if (!pdf_is_pdf(fp))
+
+    /* Pipes and other non-seekable inputs are spooled to a temporary file,
+     * the %%EOF markers are indexed while doing so.
+     */
+    pdf = pdf_new(name);
+    pdf->out = out;
+    if (doc->archive)
+    {
+        /* Only "<archive>/<member>" tells the members apart */
+        free(pdf->name);
+        pdf->name = safe_calloc(strlen(name) + 1);
+        strcpy(pdf->name, name);
+    }
+    pdf->scan_threads = run->scan_threads;
+    pdf->budget = run->budget;
+    fp = in;
+    if (fseek(in, 0, SEEK_SET) != 0)
+    {
+        fp = pdf_spool(in, pdf);
+        if (in != stdin)
+          fclose(in);
+        if (fp && pdf->over_budget)
+        {
+            ERR("'%s' is over its %s budget, skipping it\n", name,
+                budget_name(pdf->over_budget));
+            fclose(fp);
+            fp = NULL;
+        }
+        if (!fp)
+        {
+            pdf_delete(pdf);
+            return -1;
+        }
+    }
+
+    if (!pdf_is_pdf(fp))
     {
         ERR("'%s' specified is not a valid PDF\n", name);
         fclose(fp);
+        pdf_delete(pdf);
         return -1;
     }
 
-    /* Load PDF */
-    if (!(pdf = init_pdf(fp, name)))
+    /* The index lives next to the PDF, there is nothing to index for pipes
+     * and archive members.
+     */
+    idx_name = NULL;
+    if (run->do_index && (fp == in) && (in != stdin) && !doc->archive)
+    {
+        idx_name = safe_calloc(strlen(name) + strlen(INDEX_SUFFIX) + 1);
+        sprintf(idx_name, "%s" INDEX_SUFFIX, name);
+    }
+    else if (run->do_index)
+    {
+        ERR("An index cannot be kept for '%s'\n", name);
+    }
+
+    /* Load PDF, only as far as the options need it: -q alone counts the
+     * versions from the end of the document, -v gets by with the xrefs, the
+     * per-object summary and scrubbing read the entries, and -i the creator
+     * data.
+     */
+    stages = PDF_LOAD_XREFS;
+    if ((flags & PDF_FLAG_QUIET) && !run->do_write && !idx_name)
+      stages = PDF_LOAD_VERSIONS;
+    if (run->version)
+    {
+        flags = PDF_FLAG_QUIET;
+        stages = PDF_LOAD_XREFS;
+    }
+    if (!(flags & PDF_FLAG_QUIET) || run->do_scrub || run->do_history)
+      stages |= PDF_LOAD_ENTRIES;
+    if (flags & PDF_FLAG_DISP_CREATOR)
+      stages |= PDF_LOAD_CREATOR;
+    pdf = init_pdf(fp, pdf, idx_name, stages,
+                   !(flags & PDF_FLAG_QUIET) || run->do_history, run->pf);
+    free(idx_name);
+    if (!pdf)
     {
         fclose(fp);
         return -1;
     }
 
+    ret = 0;
+    dname = NULL;
+    base = fname = output_name(doc, name);
+
+    /* -v writes out the one version and is done with the document */
+    if (run->version)
+    {
+        ret = extract_version(fp, pdf, run->version, run->out_name, base);
+        goto done;
+    }
+
     /* Count valid xrefs */
     for (i=0, n_valid=0; i<pdf->n_xrefs; i++)
       if (pdf->xrefs[i].version)
@@ -277,63 +673,523 @@ int main(int argc, char **argv)
     if (n_valid < 2)
     {
         if (!(flags & (PDF_FLAG_QUIET | PDF_FLAG_DISP_CREATOR)))
-          printf("%s: There is only one version of this PDF\n", pdf->name);
+          fprintf(out, "%s: There is only one version of this PDF\n",
+                  pdf->name);
 
-        if (do_write)
-        {
-            fclose(fp);
-            pdf_delete(pdf);
-            return 0;
-        }
+        if (run->do_write)
+          goto done;
     }
 
-    dname = NULL;
-    if (do_write)
+    if (run->do_write)
     {
-        /* Create directory to place the various versions in */
-        if ((c = strrchr(name, '/')))
-          name = c + 1;
-
-        if ((c = strrchr(name, '.')))
-          *c = '\0';
-
-        dname = safe_calloc(strlen(name) + 16);
-        sprintf(dname, "%s-versions", name);
-        if (!(dir = opendir(dname)))
-          mkdir(dname, S_IRWXU);
-        else
+        /* Create directory to place the various versions in, the archive
+         * only has the directory's own name
+         */
+        dname = safe_calloc(strlen(base) + 16);
+        sprintf(dname, "%s-versions", base);
+        fname = (c = strrchr(base, '/')) ? c + 1 : base;
+        if (run->tar)
+          ret = archive_versions(fp, pdf, run->tar, fname,
+                                 dname + (fname - base));
+        else if ((dir = opendir(dname)))
         {
             ERR("This directory already exists, PDF version extraction will "
                 "not occur.\n");
-            fclose(fp);
             closedir(dir);
-            free(dname);
-            pdf_delete(pdf);
-            return -1;
+            ret = -1;
+            goto done;
         }
+        else
+        {
+            mkdir(dname, S_IRWXU);
 
-        /* Write the pdf as a previous version */
-        for (i=0; i<pdf->n_xrefs; i++)
-          if (pdf->xrefs[i].version)
-            write_version(fp, name, dname, &pdf->xrefs[i]);
+            /* Write the pdf as a previous version */
+            for (i=0; i<pdf->n_xrefs; i++)
+              if (pdf->xrefs[i].version)
+                write_version(fp, fname, dname, pdf, i);
+        }
     }
 
-    /* Generate a per-object summary */
-    pdf_summarize(fp, pdf, dname, flags);
+    /* Generate a per-object summary, or the history of the one object */
+    pdf->store = run->store;
+    if (run->do_history)
+      display_history(pdf, run->history_obj);
+    else if (run->tar && dname)
+    {
+        if (archive_summary(fp, pdf, run->tar, dname + (fname - base),
+                            flags) != 0)
+          ret = -1;
+    }
+    else
+      pdf_summarize(fp, pdf, dname, flags);
 
-#ifdef PDFRESURRECT_EXPERIMENTAL
     /* Have we been summoned to scrub history from this PDF */
-    if (do_scrub)
-      scrub_document(fp, pdf);
-#endif
+    if (run->do_scrub)
+      scrub_document(fp, pdf, base);
 
     /* Display extra information */
     if (flags & PDF_FLAG_DISP_CREATOR)
       display_creator(fp, pdf);
 
+done:
+    /* Whatever was cut short by the budget is reported as a failure */
+    if (pdf->over_budget)
+    {
+        ERR("'%s' went over its %s budget, its output is incomplete\n",
+            pdf->name, budget_name(pdf->over_budget));
+        ret = -1;
+    }
+
+    if (run->do_stats)
+    {
+        pdf_stats_print(out, pdf->name, pdf_get_stats(pdf));
+        pthread_mutex_lock(&run->lock);
+        pdf_stats_add(&run->total, pdf_get_stats(pdf));
+        pthread_mutex_unlock(&run->lock);
+    }
+
+    /* A batch of documents should not push everything else out of the cache,
+     * and neither should the prefetcher bring this one back into it
+     */
+    if (run->do_release)
+    {
+        if (run->pf)
+          pdf_prefetch_drop(run->pf, fp);
+        pdf_release(fp);
+    }
+
     fclose(fp);
+    free(base);
     free(dname);
     pdf_delete(pdf);
 
-    return 0;
+    return ret;
+}
+
+
+/* Appends a copy of 'name' to the documents of the run, as a file */
+static doc_t *add_document(run_t *run, const char *name)
+{
+    doc_t *docs;
+
+    if (!(docs = realloc(run->docs, sizeof(doc_t) * (run->n_docs + 1))))
+    {
+        ERR("Failed to allocate requested number of bytes, out of memory?\n");
+        exit(EXIT_FAILURE);
+    }
+    run->docs = docs;
+    memset(&docs[run->n_docs], 0, sizeof(doc_t));
+    docs[run->n_docs].name = safe_calloc(strlen(name) + 1);
+    strcpy(docs[run->n_docs].name, name);
+    return &docs[run->n_docs++];
+}
+
+
+/* Adds the PDFs in the zip or tar archive at 'path', in archive order */
+static void add_members(run_t *run, const char *path)
+{
+    int           i, n;
+    char         *name;
+    doc_t        *doc;
+    pdf_member_t *members;
+
+    if ((n = pdf_container_list(path, &members)) < 0)
+    {
+        ERR("'%s' is not a zip or tar archive\n", path);
+        return;
+    }
+    if (!n)
+      ERR("No PDF documents in archive '%s'\n", path);
+
+    for (i=0; i<n; ++i)
+    {
+        name = safe_calloc(strlen(path) + strlen(members[i].name) + 2);
+        sprintf(name, "%s/%s", path, members[i].name);
+        doc = add_document(run, name);
+        free(name);
+
+        /* The document takes the name of the member over */
+        doc->archive = safe_calloc(strlen(path) + 1);
+        strcpy(doc->archive, path);
+        doc->member = members[i];
+        members[i].name = NULL;
+    }
+    pdf_container_free(members, n);
+}
+
+
+static void free_docs(run_t *run)
+{
+    int i;
+
+    for (i=0; i<run->n_docs; ++i)
+    {
+        free(run->docs[i].name);
+        free(run->docs[i].archive);
+        free(run->docs[i].member.name);
+    }
+    free(run->docs);
+}
+
+
+static int is_archive_name(const char *name)
+{
+    const size_t len = strlen(name);
+    return (len > 4) && ((strcasecmp(name + len - 4, ".zip") == 0) ||
+                         (strcasecmp(name + len - 4, ".tar") == 0));
+}
+
+
+static int cmp_names(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+
+/* Adds 'path' to the run, or if it is a directory, the regular files in it
+ * that end in ".pdf" (subdirectories are not descended into), by name.  Zip
+ * and tar archives stand for the PDFs in them.
+ */
+static void add_documents(run_t *run, const char *path)
+{
+    int             i, n;
+    char           *name, **names;
+    size_t          len;
+    DIR            *dir;
+    struct stat     st;
+    struct dirent  *ent;
+
+    if ((strcmp(path, "-") != 0) && is_archive_name(path) &&
+        (stat(path, &st) == 0) && S_ISREG(st.st_mode))
+    {
+        add_members(run, path);
+        return;
+    }
+
+    if ((strcmp(path, "-") == 0) || (stat(path, &st) != 0) ||
+        !S_ISDIR(st.st_mode) || !(dir = opendir(path)))
+    {
+        add_document(run, path);
+        return;
+    }
+
+    names = NULL;
+    n = 0;
+    while ((ent = readdir(dir)))
+    {
+        len = strlen(ent->d_name);
+        if ((len < 4) || (strcasecmp(ent->d_name + len - 4, ".pdf") != 0))
+          continue;
+
+        name = safe_calloc(strlen(path) + len + 2);
+        sprintf(name, "%s/%s", path, ent->d_name);
+        if ((stat(name, &st) != 0) || !S_ISREG(st.st_mode))
+        {
+            free(name);
+            continue;
+        }
+
+        if (!(names = realloc(names, sizeof(char *) * (n + 1))))
+        {
+            ERR("Failed to allocate requested number of bytes, "
+                "out of memory?\n");
+            exit(EXIT_FAILURE);
+        }
+        names[n++] = name;
+    }
+    closedir(dir);
+
+    if (!n)
+    {
+        ERR("No PDF documents in directory '%s'\n", path);
+    }
+    else
+      qsort(names, n, sizeof(char *), cmp_names);
+
+    for (i=0; i<n; ++i)
+    {
+        add_document(run, names[i]);
+        free(names[i]);
+    }
+    free(names);
+}
+
+
+/* Take documents off the run until there are none left */
+static void *worker(void *arg)
+{
+    int               j, n;
+    char             *buf;
+    size_t            len;
+    FILE             *out;
+    pdf_member_buf_t  member_buf;
+    run_t            *run = arg;
+
+    /* Deflated archive members are inflated here, one after the other */
+    memset(&member_buf, 0, sizeof(member_buf));
+
+    n = run->n_prefetch;
+    while ((j = atomic_fetch_add(&run->next_doc, 1)) < run->n_docs)
+    {
+        /* Keep as many documents in flight as there are prefetch threads */
+        if (run->pf && (j + n < run->n_docs) && !run->docs[j + n].archive &&
+            (strcmp(run->docs[j + n].name, "-") != 0))
+          pdf_prefetch_file(run->pf, run->docs[j + n].name);
+
+        /* In parallel, the output of each document is kept in one piece.
+         * Whatever happens to the document, its turn in the sink is taken,
+         * so that the documents after it are not held back.
+         */
+        out = run->text;
+        buf = NULL;
+        len = 0;
+        if (run->sink && !(out = open_memstream(&buf, &len)))
+        {
+            ERR("Could not buffer the output of '%s'\n", run->docs[j].name);
+            buf = NULL;
+            len = 0;
+        }
+
+        if (!out || (process_document(run, &run->docs[j], &member_buf,
+                                      out) != 0))
+        {
+            pthread_mutex_lock(&run->lock);
+            run->ret = -1;
+            pthread_mutex_unlock(&run->lock);
+        }
+
+        if (run->sink)
+        {
+            if (out)
+              fclose(out);
+            pdf_sink_put(run->sink, j, buf, len);
+        }
+    }
+
+    free(member_buf.data);
+    return NULL;
+}
+
+
+/* A count of bytes, with an optional K, M or G suffix.  Returns 0 (which
+ * means no limit) if 's' is not one.
+ */
+static unsigned long long parse_size(const char *s)
+{
+    char               *end;
+    unsigned long long  n;
+
+    if (!isdigit(*s))
+      return 0;
+    n = strtoull(s, &end, 10);
+    switch (toupper(*end))
+    {
+        case 'G': n *= 1024;
+        /* Fall through */
+        case 'M': n *= 1024;
+        /* Fall through */
+        case 'K': n *= 1024;
+                  ++end;
+        /* Fall through */
+        default:  break;
+    }
+
+    return *end ? 0 : n;
+}
+
+
+int main(int argc, char **argv)
+{
+    int          i, j, n_args, n_jobs, ordered;
+    run_t        run;
+    pthread_t   *threads;
+    const char  *store_name, *tar_name;
+    FILE        *tar_fp;
+
+    if (argc < 2)
+      usage();
+
+    /* Args */
+    memset(&run, 0, sizeof(run));
+    store_name = tar_name = NULL;
+    n_args = 0;
+    n_jobs = 1;
+    ordered = 1;
+    for (i=1; i<argc; i++)
+    {
+        if (strcmp(argv[i], "--stats") == 0)
+          run.do_stats = 1;
+        else if (strncmp(argv[i], "--store=", 8) == 0 && argv[i][8])
+          store_name = argv[i] + 8;
+        else if (strncmp(argv[i], "--tar=", 6) == 0 && argv[i][6])
+        {
+            tar_name = argv[i] + 6;
+            run.do_write = 1;
+        }
+        else if (strcmp(argv[i], "--prefetch") == 0)
+          run.n_prefetch = DEFAULT_PREFETCH_THREADS;
+        else if (strncmp(argv[i], "--prefetch=", 11) == 0)
+        {
+            if ((run.n_prefetch = atoi(argv[i] + 11)) < 1)
+              usage();
+        }
+        else if (strncmp(argv[i], "--scan-threads=", 15) == 0)
+        {
+            if ((run.scan_threads = atoi(argv[i] + 15)) < 1)
+              usage();
+        }
+        else if (strncmp(argv[i], "--max-time=", 11) == 0)
+        {
+            if (!(run.budget.max_ms = parse_size(argv[i] + 11)))
+              usage();
+        }
+        else if (strncmp(argv[i], "--max-bytes=", 12) == 0)
+        {
+            if (!(run.budget.max_bytes = parse_size(argv[i] + 12)))
+              usage();
+        }
+        else if (strncmp(argv[i], "--max-alloc=", 12) == 0)
+        {
+            if (!(run.budget.max_alloc = parse_size(argv[i] + 12)))
+              usage();
+        }
+        else if (strncmp(argv[i], "--max-versions=", 15) == 0)
+        {
+            if ((run.budget.max_revisions = atoi(argv[i] + 15)) < 1)
+              usage();
+        }
+        else if (strcmp(argv[i], "--unordered") == 0)
+          ordered = 0;
+        else if (strcmp(argv[i], "--history") == 0)
+        {
+            if ((++i == argc) || !isdigit(argv[i][0]))
+              usage();
+            run.do_history = 1;
+            run.history_obj = atoi(argv[i]);
+        }
+        else if (strcmp(argv[i], "-v") == 0)
+        {
+            if ((++i == argc) || ((run.version = atoi(argv[i])) < 1))
+              usage();
+        }
+        else if (strcmp(argv[i], "-o") == 0)
+        {
+            if (++i == argc)
+              usage();
+            run.out_name = argv[i];
+        }
+        else if (strcmp(argv[i], "--diff") == 0)
+          run.flags |= PDF_FLAG_DIFF;
+        else if (strcmp(argv[i], "--diff-streams") == 0)
+          run.flags |= PDF_FLAG_DIFF | PDF_FLAG_DIFF_STREAMS;
+        else if (strncmp(argv[i], "-j", 2) == 0)
+        {
+            if (!argv[i][2])
+              n_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+            else if ((n_jobs = atoi(argv[i] + 2)) < 1)
+              usage();
+        }
+        else if (strncmp(argv[i], "-w", 2) == 0)
+          run.do_write = 1;
+        else if (strncmp(argv[i], "-i", 2) == 0)
+          run.flags |= PDF_FLAG_DISP_CREATOR;
+        else if (strncmp(argv[i], "-q", 2) == 0)
+          run.flags |= PDF_FLAG_QUIET;
+        else if (strncmp(argv[i], "-s", 2) == 0)
+          run.do_scrub = 1;
+        else if (strncmp(argv[i], "-x", 2) == 0)
+          run.do_index = 1;
+        else if ((argv[i][0] != '-') || (strcmp(argv[i], "-") == 0))
+          ++n_args;
+        else if (argv[i][0] == '-')
+          usage();
+    }
+
+    if (!n_args || (run.out_name && !run.version))
+      usage();
+
+    /* Directories stand for the PDFs in them */
+    for (i=1; i<argc; i++)
+      if ((strcmp(argv[i], "--history") == 0) ||
+          (strcmp(argv[i], "-v") == 0) || (strcmp(argv[i], "-o") == 0))
+        ++i;
+      else if ((argv[i][0] != '-') || (strcmp(argv[i], "-") == 0))
+        add_documents(&run, argv[i]);
+    if (!run.n_docs)
+      return -1;
+
+    /* One version of one document per -o */
+    if (run.out_name && (run.n_docs > 1))
+    {
+        ERR("-o takes a single document\n");
+        free_docs(&run);
+        return -1;
+    }
+
+    /* Text goes to stderr when stdout carries a PDF or an archive */
+    run.text = stdout;
+    if ((run.out_name && (strcmp(run.out_name, "-") == 0)) ||
+        (tar_name && (strcmp(tar_name, "-") == 0)))
+      run.text = stderr;
+
+    tar_fp = NULL;
+    if (tar_name && (strcmp(tar_name, "-") == 0))
+      tar_fp = stdout;
+    else if (tar_name && !(tar_fp = fopen(tar_name, "w")))
+    {
+        ERR("Could not create archive '%s'\n", tar_name);
+        free_docs(&run);
+        return -1;
+    }
+    run.tar = tar_fp ? pdf_tar_new(tar_fp) : NULL;
+
+    run.store = store_name ? pdf_store_open(store_name) : NULL;
+    run.pf = run.n_prefetch ? pdf_prefetch_new(run.n_prefetch) : NULL;
+    run.do_release = (run.n_docs > 1) || run.pf;
+    pthread_mutex_init(&run.lock, NULL);
+    atomic_init(&run.next_doc, 0);
+
+    for (j=0; run.pf && j<run.n_docs && j<run.n_prefetch; ++j)
+      if (!run.docs[j].archive && (strcmp(run.docs[j].name, "-") != 0))
+        pdf_prefetch_file(run.pf, run.docs[j].name);
+
+    /* Process the documents, the options apply to all of them */
+    if (n_jobs > run.n_docs)
+      n_jobs = run.n_docs;
+    if ((n_jobs > 1) && !(run.sink = pdf_sink_new(run.text, ordered)))
+      n_jobs = 1;
+
+    /* Cores that no document keeps busy scan large documents */
+    if (!run.scan_threads)
+      run.scan_threads = sysconf(_SC_NPROCESSORS_ONLN) / n_jobs;
+
+    threads = safe_calloc(sizeof(pthread_t) * n_jobs);
+    for (i=1; i<n_jobs; ++i)
+      if (pthread_create(&threads[i], NULL, worker, &run) != 0)
+        break;
+    worker(&run);
+    for (j=1; j<i; ++j)
+      pthread_join(threads[j], NULL);
+    free(threads);
+
+    pdf_sink_delete(run.sink);
+    pdf_prefetch_delete(run.pf);
+    free_docs(&run);
+    pthread_mutex_destroy(&run.lock);
+
+    if (pdf_store_close(run.store) != 0)
+      run.ret = -1;
+
+    if (pdf_tar_delete(run.tar) != 0)
+    {
+        ERR("Failed to write archive '%s'\n", tar_name);
+        run.ret = -1;
+    }
+    if (tar_fp && (tar_fp != stdout))
+      fclose(tar_fp);
+
+    if (run.do_stats && (run.n_docs > 1))
+      pdf_stats_print(run.text, "total", &run.total);
+
+    return run.ret;
 }
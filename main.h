@@ -25,6 +25,12 @@
 #define VER       VER_MAJOR"."VER_MINOR
 
 
+#define INDEX_SUFFIX ".pdfr-index"
+
+
+#define DEFAULT_PREFETCH_THREADS 4
+
+
 #define TAG "[pdfresurrect]"
 #define ERR(...) {fprintf(stderr, TAG" -- Error -- " __VA_ARGS__);}
 
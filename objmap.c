@@ -0,0 +1,264 @@
+/******************************************************************************
+ * objmap.c
+ *
+ * pdfresurrect - PDF history extraction tool
+ * https://github.com/enferex/pdfresurrect
+ *
+ * See https://github.com/enferex/pdfresurrect/blob/master/LICENSE for license
+ * information.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Special thanks to all of the contributors:  See AUTHORS.
+ * Special thanks to 757labs (757 crew), they are a great group
+ * of people to hack on projects and brainstorm with.
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "pdf.h"
+#include "main.h"
+
+
+/*
+ * Object maps
+ *
+ * The object table of a version is that of the version before it, with the
+ * entries of its own xrefs applied on top.  Each version gets a persistent
+ * trie keyed by object id, 32 ways per level, so that it can share everything
+ * it did not change with the version before it: applying an entry copies the
+ * nodes on the path to it (once per version, after that they are the
+ * version's own and are changed in place), the rest is shared.  A version
+ * thus costs memory in the order of its changes, and still holds its whole
+ * object table.  The in-use count of each version is kept up to date while
+ * the entries are applied.
+ *
+ * Nodes are only freed along with the whole map.
+ */
+
+#define MAP_BITS  5
+#define MAP_WIDTH (1 << MAP_BITS)
+#define MAP_MASK  (MAP_WIDTH - 1)
+
+
+typedef struct _map_node_t
+{
+    struct _map_node_t *next;  /* Every node of the map, for freeing */
+    int                 owner; /* Version that may change it in place */
+    union
+    {
+        struct _map_node_t *kids[MAP_WIDTH];
+        struct
+        {
+            long     offsets[MAP_WIDTH];
+            uint16_t gen_nums[MAP_WIDTH];
+            char     f_or_n[MAP_WIDTH]; /* 0 if the id is not listed */
+        } leaf;
+    } u;
+} map_node_t;
+
+
+struct _pdf_objmap_t
+{
+    int          depth;      /* Levels of nodes above the leaves */
+    int          n_versions;
+    map_node_t **roots;      /* By version, NULL if it has no xref */
+    int         *counts;     /* Objects in use, by version */
+    map_node_t  *nodes;
+};
+
+
+/* A copy of 'node' (or a new empty node) owned by 'version' */
+static map_node_t *own_node(pdf_objmap_t *map, const map_node_t *node,
+                            int version)
+{
+    map_node_t *copy;
+
+    copy = safe_calloc(sizeof(map_node_t));
+    if (node)
+      memcpy(&copy->u, &node->u, sizeof(copy->u));
+    copy->owner = version;
+    copy->next = map->nodes;
+    map->nodes = copy;
+    return copy;
+}
+
+
+static void map_set(pdf_objmap_t *map, int version, const xref_t *xref, int i)
+{
+    int          k, level, obj_id;
+    char         old;
+    map_node_t  *node, **slot;
+
+    obj_id = xref->obj_ids[i];
+    slot = &map->roots[version];
+    for (level=map->depth; ; --level)
+    {
+        if (!*slot || ((*slot)->owner != version))
+          *slot = own_node(map, *slot, version);
+        node = *slot;
+        if (!level)
+          break;
+        slot = &node->u.kids[(obj_id >> (level * MAP_BITS)) & MAP_MASK];
+    }
+
+    k = obj_id & MAP_MASK;
+    old = node->u.leaf.f_or_n[k];
+    node->u.leaf.offsets[k] = xref->offsets[i];
+    node->u.leaf.gen_nums[k] = XREF_GEN_NUM(xref, i);
+    node->u.leaf.f_or_n[k] = XREF_F_OR_N(xref, i);
+
+    map->counts[version] += (node->u.leaf.f_or_n[k] == 'n') - (old == 'n');
+}
+
+
+/* The leaf holding 'obj_id' in 'version', NULL if there is none */
+static const map_node_t *map_leaf(
+    const pdf_objmap_t *map,
+    int                 version,
+    int                 obj_id)
+{
+    int               level;
+    const map_node_t *node;
+
+    if ((version < 1) || (version >= map->n_versions) || (obj_id < 0) ||
+        ((map->depth + 1) * MAP_BITS < 31 &&
+         (obj_id >> ((map->depth + 1) * MAP_BITS))))
+      return NULL;
+
+    node = map->roots[version];
+    for (level=map->depth; node && level>0; --level)
+      node = node->u.kids[(obj_id >> (level * MAP_BITS)) & MAP_MASK];
+
+    return node;
+}
+
+
+pdf_objmap_t *pdf_objmap_new(const pdf_t *pdf)
+{
+    int           i, j, v, max_id, prev;
+    pdf_objmap_t *map;
+
+    map = safe_calloc(sizeof(pdf_objmap_t));
+
+    /* The trie is as deep as the largest id needs */
+    max_id = 0;
+    for (i=0; i<pdf->n_xrefs; ++i)
+    {
+        if (pdf->xrefs[i].version >= map->n_versions)
+          map->n_versions = pdf->xrefs[i].version + 1;
+        for (j=0; j<pdf->xrefs[i].n_entries; ++j)
+          if (pdf->xrefs[i].obj_ids[j] > max_id)
+            max_id = pdf->xrefs[i].obj_ids[j];
+    }
+    while ((map->depth + 1) * MAP_BITS < 31 &&
+           (max_id >> ((map->depth + 1) * MAP_BITS)))
+      ++map->depth;
+
+    if (!map->n_versions)
+      return map;
+    map->roots = safe_calloc(sizeof(map_node_t *) * map->n_versions);
+    map->counts = safe_calloc(sizeof(int) * map->n_versions);
+
+    /* Each version starts out as the one before it, the xrefs of a version
+     * follow each other.
+     */
+    for (i=0, prev=0; i<pdf->n_xrefs; ++i)
+    {
+        if (!(v = pdf->xrefs[i].version))
+          continue;
+
+        if (v != prev)
+        {
+            map->roots[v] = map->roots[prev];
+            map->counts[v] = map->counts[prev];
+            prev = v;
+        }
+
+        for (j=0; j<pdf->xrefs[i].n_entries; ++j)
+          if (pdf->xrefs[i].obj_ids[j] >= 0)
+            map_set(map, v, &pdf->xrefs[i], j);
+    }
+
+    return map;
+}
+
+
+int pdf_objmap_count(const pdf_objmap_t *map, int version)
+{
+    if ((version < 1) || (version >= map->n_versions))
+      return 0;
+    return map->counts[version];
+}
+
+
+int pdf_objmap_get(
+    const pdf_objmap_t *map,
+    int                 version,
+    int                 obj_id,
+    xref_entry_t       *entry)
+{
+    int               k;
+    const map_node_t *leaf;
+
+    k = obj_id & MAP_MASK;
+    if (!(leaf = map_leaf(map, version, obj_id)) || !leaf->u.leaf.f_or_n[k])
+      return 0;
+
+    memset(entry, 0, sizeof(xref_entry_t));
+    entry->obj_id = obj_id;
+    entry->offset = leaf->u.leaf.offsets[k];
+    entry->gen_num = leaf->u.leaf.gen_nums[k];
+    entry->f_or_n = leaf->u.leaf.f_or_n[k];
+    return 1;
+}
+
+
+/* Append the ids in use under 'node' to 'obj_ids', in order */
+static int list_node(
+    const map_node_t *node,
+    int               level,
+    int               base,
+    int              *obj_ids)
+{
+    int k, n;
+
+    if (!node)
+      return 0;
+
+    n = 0;
+    for (k=0; k<MAP_WIDTH; ++k)
+      if (level)
+        n += list_node(node->u.kids[k], level - 1,
+                       base | (k << (level * MAP_BITS)), obj_ids + n);
+      else if (node->u.leaf.f_or_n[k] == 'n')
+        obj_ids[n++] = base | k;
+
+    return n;
+}
+
+
+int pdf_objmap_list(const pdf_objmap_t *map, int version, int *obj_ids)
+{
+    if ((version < 1) || (version >= map->n_versions))
+      return 0;
+    return list_node(map->roots[version], map->depth, 0, obj_ids);
+}
+
+
+void pdf_objmap_delete(pdf_objmap_t *map)
+{
+    map_node_t *node;
+
+    if (!map)
+      return;
+
+    while ((node = map->nodes))
+    {
+        map->nodes = node->next;
+        free(node);
+    }
+
+    free(map->roots);
+    free(map->counts);
+    free(map);
+}
@@ -13,13 +13,219 @@
  * of people to hack on projects and brainstorm with.
  *****************************************************************************/
 
+#define _GNU_SOURCE /* copy_file_range() */
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 #include "pdf.h"
 #include "main.h"
 
 
+/*
+ * Instrumentation
+ *
+ * The public entry points point 'cur_stats' at the document they work on, and
+ * the reads in the rest of this file call the stats_*() wrappers below, which
+ * count them.  Calls made without a document (e.g. pdf_is_pdf()) land in
+ * 'no_stats'.  Both are per thread, so that documents can be worked on in
+ * parallel.
+ */
+
+static __thread pdf_stats_t  no_stats;
+static __thread pdf_stats_t *cur_stats;
+
+#define STATS           (cur_stats ? cur_stats : &no_stats)
+#define STATS_FOR(_pdf) \
+    (budget_for(_pdf), cur_stats = &(_pdf)->stats)
+
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/*
+ * Budgets
+ *
+ * STATS_FOR() also holds the reads of the thread to the budget of the
+ * document (pdf_t 'budget').  The stdio wrappers below check it, and once a
+ * limit is exceeded they fail every read as at the end of the document, which
+ * ends the parsing loops.  The few loops that do not read check over_budget()
+ * themselves, and allocations sized by the document check budget_alloc().
+ * The deadline is checked against a coarse clock (a few ms of resolution,
+ * which is what a deadline in ms needs), read every BUDGET_CLOCK_TICKS
+ * checks.  The count goes on from one phase of a document to the next, so
+ * that short phases do not each start over.  Threads of a pool (see
+ * for_xrefs()) note the exceeded limit in a flag of their own, and are held
+ * to the bytes that were left when they started.
+ */
+
+#define BUDGET_CLOCK_TICKS 16
+
+#ifdef CLOCK_MONOTONIC_COARSE
+#define BUDGET_CLOCK CLOCK_MONOTONIC_COARSE
+#else
+#define BUDGET_CLOCK CLOCK_MONOTONIC
+#endif
+
+
+typedef struct _budget_ctx_t
+{
+    const pdf_budget_t *limits;
+    unsigned long long  deadline_ns;
+    unsigned long long  bytes_base; /* Read before this thread started */
+    int                *over;       /* Where the exceeded limit goes   */
+    unsigned int        ticks;
+} budget_ctx_t;
+
+static __thread budget_ctx_t cur_budget;
+
+
+static void budget_for(pdf_t *pdf)
+{
+    if (cur_budget.over == &pdf->over_budget)
+      return;
+
+    memset(&cur_budget, 0, sizeof(cur_budget));
+    cur_budget.limits = &pdf->budget;
+    cur_budget.over = &pdf->over_budget;
+    if (pdf->budget.max_ms)
+      cur_budget.deadline_ns = pdf->started_ns +
+                               pdf->budget.max_ms * 1000000ULL;
+}
+
+
+static unsigned long long budget_clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(BUDGET_CLOCK, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/* Returns the PDF_BUDGET_* limit the document is over, 0 if none */
+static int over_budget(void)
+{
+    budget_ctx_t *b = &cur_budget;
+
+    if (!b->over)
+      return 0;
+    if (*b->over)
+      return *b->over;
+
+    if (b->limits->max_bytes &&
+        (STATS->bytes_read + b->bytes_base > b->limits->max_bytes))
+      *b->over = PDF_BUDGET_BYTES;
+    else if (b->deadline_ns && ((++b->ticks % BUDGET_CLOCK_TICKS) == 1) &&
+             (budget_clock_ns() > b->deadline_ns))
+      *b->over = PDF_BUDGET_TIME;
+
+    return *b->over;
+}
+
+
+/* Returns 0, noting the exceeded limit, if 'size' bytes are too many for a
+ * single allocation
+ */
+static int budget_alloc(size_t size)
+{
+    budget_ctx_t *b = &cur_budget;
+
+    if (b->over && b->limits->max_alloc && (size > b->limits->max_alloc))
+    {
+        if (!*b->over)
+          *b->over = PDF_BUDGET_ALLOC;
+        return 0;
+    }
+
+    return 1;
+}
+
+
+/* Page cache hints.  The %%EOF scan and version writing read sequentially,
+ * everything else jumps between xrefs and objects.
+ */
+#ifdef POSIX_FADV_NORMAL
+#define ADVISE(_fp, _off, _len, _advice) \
+    posix_fadvise(fileno(_fp), (_off), (_len), POSIX_FADV_##_advice)
+#else
+#define ADVISE(_fp, _off, _len, _advice)
+#endif
+
+
+/* PHASE_BEGIN/PHASE_END must be paired in the same scope */
+#define PHASE_BEGIN(_p) \
+    const unsigned long long _phase_start_##_p = now_ns()
+#define PHASE_END(_p) \
+    (STATS->phase_ns[_p] += now_ns() - _phase_start_##_p)
+
+
+/* Over budget, reads go to the end of the document and come back empty */
+static size_t stats_fread(void *ptr, size_t size, size_t n, FILE *fp)
+{
+    size_t got;
+
+    if (over_budget())
+      fseek(fp, 0, SEEK_END);
+    got = fread(ptr, size, n, fp);
+    STATS->bytes_read += got * size;
+    return got;
+}
+
+
+static int stats_fgetc(FILE *fp)
+{
+    if (over_budget())
+      fseek(fp, 0, SEEK_END);
+    ++STATS->bytes_read;
+    return fgetc(fp);
+}
+
+
+static char *stats_fgets(char *buf, int size, FILE *fp)
+{
+    char *got;
+
+    if (over_budget())
+      fseek(fp, 0, SEEK_END);
+    if ((got = fgets(buf, size, fp)))
+      STATS->bytes_read += strlen(got);
+    return got;
+}
+
+
+static int stats_fseek(FILE *fp, long offset, int whence)
+{
+    ++STATS->seeks;
+    return fseek(fp, offset, whence);
+}
+
+
+static void *stats_realloc(void *ptr, size_t size)
+{
+    ++STATS->reallocs;
+    return realloc(ptr, size);
+}
+
+
 /*
  * Macros
  */
@@ -42,61 +248,149 @@
     ((!ferror(_fp) && !feof(_fp) && (_expr)))
 
 
-/* FAIL
- *
- * Emit the diagnostic '_msg' and exit.
- * _msg: Message to emit prior to exiting.
+/* Block size used for bulk reads (scans and copies) */
+#define SCAN_BLOCK_SIZE (64 * 1024)
+
+/* The %%EOF scan of a document is split into chunks of this size, which
+ * pdf_t 'scan_threads' threads take in turn, once there are at least two.
  */
-#define FAIL(_msg)      \
-  do {                  \
-    ERR(_msg);          \
-    exit(EXIT_FAILURE); \
-  } while (0)
+#define SCAN_CHUNK_SIZE (16 * 1024 * 1024)
 
+/* The revisions of a document are parsed by the same threads, each reading
+ * through a view of its own, once there are this many to share out.
+ */
+#define POOL_MIN_XREFS 8
 
-/* SAFE_E
- *
- * Safe expression handling.  This macro is a wrapper
- * that compares the result of an expression (_expr) to the expected
- * value (_cmp).
- *
- * _expr: Expression to test.
- * _cmp:  Expected value, error if this returns false.
- * _msg:  What to say when an error occurs.
+/* Counting versions alone (PDF_LOAD_VERSIONS) reads this much of the end of a
+ * document for its last startxref, and of each xref in the /Prev chain for the
+ * dictionary that holds the /Prev (more, up to the max, for a long one)
  */
-#define SAFE_E(_expr, _cmp, _msg) \
- do {                             \
-    if ((_expr) != (_cmp)) {      \
-      FAIL(_msg);                  \
-    }                             \
-  } while (0)
+#define TAIL_SIZE    1024
+#define TRAILER_SIZE 4096
+#define TRAILER_MAX  (1024 * 1024)
+
+
+/* Markers found in one chunk of a parallel %%EOF scan, see scan_chunks() */
+typedef struct _eof_chunk_t
+{
+    long  start;
+    long  end;
+    long  n_read;
+    long *eofs;
+    int   n_eofs;
+    int   eof_cap;
+} eof_chunk_t;
+
+
+typedef struct _eof_scan_t
+{
+    int                 fd;
+    long                size;
+    eof_chunk_t        *chunks;
+    int                 n_chunks;
+    atomic_int          next_chunk;
+
+    /* Past the document's deadline (if it has one), the scan is given up */
+    unsigned long long  deadline_ns;
+    atomic_int          is_late;
+} eof_scan_t;
+
+
+/* Work on every xref in [next, end) by a pool of threads, see for_xrefs() */
+typedef void (*xref_fn_t)(FILE *fp, pdf_t *pdf, int i, void *arg);
+
+typedef struct _xref_pool_t
+{
+    pdf_t       *pdf;
+    xref_fn_t    fn;
+    void        *arg;
+    const char  *map;
+    size_t       map_size;
+    int          end;
+    atomic_int   next;
+} xref_pool_t;
+
+
+typedef struct _xref_worker_t
+{
+    xref_pool_t  *pool;
+    pthread_t     thread;
+    pdf_stats_t   stats;
+    budget_ctx_t  budget;
+    int           over;
+} xref_worker_t;
+
+
+/* Info object of a version, looked up ahead of parsing it, see load_creator() */
+typedef struct _info_obj_t
+{
+    int     todo;
+    char   *buf;
+    size_t  size;
+} info_obj_t;
+
+
+/* Storage for an xref of a single entry, see one_xref() */
+typedef struct _one_xref_t
+{
+    xref_t  xref;
+    int     obj_id;
+    long    offset;
+    uint8_t in_use;
+} one_xref_t;
 
 
 /*
  * Forwards
  */
 
-static int is_valid_xref(FILE *fp, pdf_t *pdf, xref_t *xref);
-static void load_xref_entries(FILE *fp, xref_t *xref);
-static void load_xref_from_plaintext(FILE *fp, xref_t *xref);
+static void for_xrefs(
+    FILE      *fp,
+    pdf_t     *pdf,
+    int        first,
+    xref_fn_t  fn,
+    void      *arg);
+static int is_valid_xref(FILE *fp, xref_t *xref);
+static int load_xref_entries(FILE *fp, xref_t *xref);
+static int load_xref_from_plaintext(FILE *fp, xref_t *xref);
 static void load_xref_from_stream(FILE *fp, xref_t *xref);
-static void get_xref_linear_skipped(FILE *fp, xref_t *xref);
+static void get_xref_linear_skipped(FILE *fp, const pdf_t *pdf, xref_t *xref);
 static void resolve_linearized_pdf(pdf_t *pdf);
+static int load_xrefs(FILE *fp, pdf_t *pdf);
+static int count_xref_chain(FILE *fp, pdf_t *pdf);
+static int find_xref_entry(
+    FILE         *fp,
+    const xref_t *xref,
+    int           obj_id,
+    xref_entry_t *entry);
+static char *get_xref_object(
+    FILE   *fp,
+    xref_t *xref,
+    int     obj_id,
+    size_t *size);
 
-static pdf_creator_t *new_creator(int *n_elements);
+static pdf_str_t strpool_add(pdf_t *pdf, const char *str, size_t len);
+
+static pdf_creator_t *new_creator(pdf_t *pdf, int *n_elements);
 static void load_creator(FILE *fp, pdf_t *pdf);
+static char *get_info(FILE *fp, pdf_t *pdf, int i, size_t *size);
 static void load_creator_from_buf(
     FILE       *fp,
+    pdf_t      *pdf,
     xref_t     *xref,
     const char *buf,
     size_t      buf_size);
 static void load_creator_from_xml(xref_t *xref, const char *buf);
 static void load_creator_from_old_format(
     FILE       *fp,
+    pdf_t      *pdf,
     xref_t     *xref,
     const char *buf,
     size_t      buf_size);
+static const char *get_value_end(const char *c, const char *end);
+static int get_reference(const char *c, const char *end);
 
+static const xref_t *one_xref(one_xref_t *one, int obj_id, long offset);
 static char *get_object_from_here(FILE *fp, size_t *size, int *is_stream);
 
 static char *get_object(
@@ -107,11 +401,44 @@ static char *get_object(
     int          *is_stream);
 
 static const char *get_type(FILE *fp, int obj_id, const xref_t *xref);
-/* static int get_page(int obj_id, const xref_t *xref); */
-static char *get_header(FILE *fp);
 
-static char *decode_text_string(const char *str, size_t str_len);
-static int get_next_eof(FILE *fp);
+typedef struct _page_map_t page_map_t;
+static page_map_t *new_page_map(const pdf_t *pdf);
+static void delete_page_map(page_map_t *map);
+static int get_page(
+    FILE        *fp,
+    const pdf_t *pdf,
+    page_map_t  *map,
+    int          xref_idx,
+    int          obj_id);
+static char *get_header(FILE *fp);
+static char *get_trailer(FILE *fp, const xref_t *xref, size_t *size);
+
+static void index_eofs(
+    long      **eofs,
+    int        *n_eofs,
+    int        *eof_cap,
+    const char *blk,
+    size_t      blk_size,
+    long        pos,
+    int        *match);
+static void scan_eofs(FILE *fp, pdf_t *pdf, long from);
+static int scan_eofs_parallel(FILE *fp, pdf_t *pdf, long from);
+static long get_next_eof(const pdf_t *pdf, long pos);
+static long get_revision_end(const pdf_t *pdf, int i);
+static void recover_xrefs(FILE *fp, pdf_t *pdf, int first);
+static uint64_t hash_object(FILE *fp, long offset, long limit, char *blk);
+static int copy_head(FILE *fp, FILE *dst, long len);
+static char *get_object_value(
+    FILE   *fp,
+    long    offset,
+    size_t *size,
+    long   *val_end);
+static const char *get_dict_value(
+    const char  *dict,
+    size_t       size,
+    const char  *key,
+    const char **val_end);
 
 
 /*
@@ -142,6 +469,12 @@ pdf_t *pdf_new(const char *name)
         strcpy(pdf->name, "Unknown");
     }
 
+    /* Offset 0 of the string pool is reserved for the empty string */
+    pdf->strpool_cap = 256;
+    pdf->strpool_len = 1;
+    pdf->strpool = safe_calloc(pdf->strpool_cap);
+
+    pdf->started_ns = now_ns();
     return pdf;
 }
 
@@ -153,15 +486,136 @@ void pdf_delete(pdf_t *pdf)
     for (i=0; i<pdf->n_xrefs; i++)
     {
         free(pdf->xrefs[i].creator);
-        free(pdf->xrefs[i].entries);
+        pdf_xref_free_entries(&pdf->xrefs[i]);
     }
 
     free(pdf->name);
     free(pdf->xrefs);
+    free(pdf->strpool);
+    free(pdf->eofs);
+
+    if (cur_stats == &pdf->stats)
+      cur_stats = NULL;
+    if (cur_budget.over == &pdf->over_budget)
+      memset(&cur_budget, 0, sizeof(cur_budget));
     free(pdf);
 }
 
 
+/*
+ * Xref entries
+ *
+ * An xref keeps its entries as parallel arrays: object ids, offsets, a bitset
+ * of the entries in use, generation numbers (only once one of them is not 0)
+ * and object hashes (only once there are any).  That takes 12 bytes and a bit
+ * per entry in the common case, instead of a padded struct, and lookups by id
+ * only walk the ids.  The arrays grow with the entries actually parsed, the
+ * /Size claimed by the trailer is not trusted for their allocation.
+ */
+
+static void *grow_entries(void *ptr, size_t size)
+{
+    if (!(ptr = stats_realloc(ptr, size)))
+    {
+        ERR("Failed to reallocate xref entries.\n");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+
+void pdf_xref_add_entry(xref_t *xref, const xref_entry_t *entry)
+{
+    int i, cap;
+
+    i = xref->n_entries;
+    if (i == xref->n_alloc_entries)
+    {
+        cap = i ? i * 2 : 16;
+        xref->obj_ids = grow_entries(xref->obj_ids, sizeof(int) * cap);
+        xref->offsets = grow_entries(xref->offsets, sizeof(long) * cap);
+        xref->in_use = grow_entries(xref->in_use, (cap + 7) / 8);
+        if (xref->gen_nums)
+          xref->gen_nums = grow_entries(xref->gen_nums, sizeof(uint16_t) * cap);
+        if (xref->hashes)
+          xref->hashes = grow_entries(xref->hashes, sizeof(uint64_t) * cap);
+        xref->n_alloc_entries = cap;
+    }
+
+    /* The optional arrays appear with their first non-zero value */
+    if (entry->gen_num && !xref->gen_nums)
+      xref->gen_nums = safe_calloc(sizeof(uint16_t) * xref->n_alloc_entries);
+    if (entry->hash && !xref->hashes)
+      xref->hashes = safe_calloc(sizeof(uint64_t) * xref->n_alloc_entries);
+
+    xref->obj_ids[i] = entry->obj_id;
+    xref->offsets[i] = entry->offset;
+    if (xref->gen_nums)
+      xref->gen_nums[i] = entry->gen_num;
+    if (xref->hashes)
+      xref->hashes[i] = entry->hash;
+    if (entry->f_or_n == 'n')
+      xref->in_use[i >> 3] |= 1 << (i & 7);
+    else
+      xref->in_use[i >> 3] &= ~(1 << (i & 7));
+    ++xref->n_entries;
+}
+
+
+void pdf_xref_get_entry(const xref_t *xref, int i, xref_entry_t *entry)
+{
+    entry->obj_id = xref->obj_ids[i];
+    entry->offset = xref->offsets[i];
+    entry->gen_num = XREF_GEN_NUM(xref, i);
+    entry->f_or_n = XREF_F_OR_N(xref, i);
+    entry->hash = XREF_HASH(xref, i);
+}
+
+
+int pdf_xref_find(const xref_t *xref, int obj_id)
+{
+    int        i, j, hit;
+    const int *ids = xref->obj_ids;
+
+    /* Whole blocks of ids are compared without branches, which vectorizes */
+    for (i=0; i+16<=xref->n_entries; i+=16)
+    {
+        for (j=0, hit=0; j<16; ++j)
+          hit |= (ids[i + j] == obj_id);
+        if (hit)
+          break;
+    }
+
+    for ( ; i<xref->n_entries; ++i)
+      if (ids[i] == obj_id)
+        return i;
+
+    return -1;
+}
+
+
+void pdf_xref_free_entries(xref_t *xref)
+{
+    free(xref->obj_ids);
+    free(xref->offsets);
+    free(xref->gen_nums);
+    free(xref->in_use);
+    free(xref->hashes);
+    xref->obj_ids = NULL;
+    xref->offsets = NULL;
+    xref->gen_nums = NULL;
+    xref->in_use = NULL;
+    xref->hashes = NULL;
+    xref->n_entries = xref->n_alloc_entries = 0;
+}
+
+
+const char *pdf_str(const pdf_t *pdf, pdf_str_t s)
+{
+    return pdf->strpool + s.off;
+}
+
+
 int pdf_is_pdf(FILE *fp)
 {
     char *header;
@@ -178,7 +632,10 @@ int pdf_is_pdf(FILE *fp)
 
 void pdf_get_version(FILE *fp, pdf_t *pdf)
 {
-    char *header = get_header(fp);
+    char *header;
+
+    if (!(header = get_header(fp)))
+      return;
 
     /* Locate version string start and make sure we don't go past header
      * The format is %PDF-M.m, where 'M' is the major number and 'm' minor.
@@ -197,1102 +654,5031 @@ void pdf_get_version(FILE *fp, pdf_t *pdf)
 }
 
 
-int pdf_load_xrefs(FILE *fp, pdf_t *pdf)
+/* Locate, validate and load the xref that the i'th %%EOF closes.  Returns 0 if
+ * the startxref does not lead to an xref and the revision must be recovered.
+ */
+static int load_xref(FILE *fp, pdf_t *pdf, int i, int ver)
 {
-    int  i, ver, is_linear;
+    int  is_linear;
     long pos, pos_count;
     char x, *c, buf[256];
 
-    c = NULL;
+    /* Seek past %%EOF */
+    pos = pdf->eofs[i];
+    stats_fseek(fp, pos + strlen("%%EOF"), SEEK_SET);
 
-    /* Count number of xrefs */
-    pdf->n_xrefs = 0;
-    fseek(fp, 0, SEEK_SET);
-    while (get_next_eof(fp) >= 0)
-      ++pdf->n_xrefs;
+    /* Set the version */
+    pdf->xrefs[i].version = ver;
 
-    if (!pdf->n_xrefs)
+    /* Rewind until we find end of "startxref" */
+    pos_count = 0;
+    while ((pos_count < sizeof(buf) - 9) &&
+           SAFE_F(fp, ((x = stats_fgetc(fp)) != 'f')))
+      stats_fseek(fp, pos - (++pos_count), SEEK_SET);
+
+    /* Suck in "startxref" through the first byte of %%EOF */
+    if (pos_count >= sizeof(buf) - 9 || pos - pos_count < 8)
+      return 0;
+    memset(buf, 0, sizeof(buf));
+    stats_fseek(fp, pos - pos_count - 8, SEEK_SET);
+    if (stats_fread(buf, 1, pos_count + 9, fp) != pos_count + 9 ||
+        strncmp(buf, "startxref", strlen("startxref")) != 0)
+      return 0;
+    c = buf + strlen("startxref");
+    while (*c == ' ' || *c == '\n' || *c == '\r')
+      ++c;
+    if (!isdigit(*c))
       return 0;
 
-    /* Load in the start/end positions */
-    fseek(fp, 0, SEEK_SET);
-    pdf->xrefs = safe_calloc(sizeof(xref_t) * pdf->n_xrefs);
-    ver = 1;
-    for (i=0; i<pdf->n_xrefs; i++)
-    {
-        /* Seek to %%EOF */
-        if ((pos = get_next_eof(fp)) < 0)
-          break;
+    /* xref start position */
+    pdf->xrefs[i].start = atol(c);
 
-        /* Set and increment the version */
-        pdf->xrefs[i].version = ver++;
+    /* If xref is 0 handle linear xref table */
+    if (pdf->xrefs[i].start == 0)
+      get_xref_linear_skipped(fp, pdf, &pdf->xrefs[i]);
 
-        /* Rewind until we find end of "startxref" */
-        pos_count = 0;
-        while (SAFE_F(fp, ((x = fgetc(fp)) != 'f')))
-          fseek(fp, pos - (++pos_count), SEEK_SET);
+    /* Non-linear, normal operation, so just find the end of the xref */
+    else
+      pdf->xrefs[i].end = get_next_eof(pdf, pdf->xrefs[i].start);
 
-        /* Suck in end of "startxref" to start of %%EOF */
-        if (pos_count >= sizeof(buf)) {
-          FAIL("Failed to locate the startxref token. "
-              "This might be a corrupt PDF.\n");
-        }
-        memset(buf, 0, sizeof(buf));
-        SAFE_E(fread(buf, 1, pos_count, fp), pos_count,
-               "Failed to read startxref.\n");
-        c = buf;
-        while (*c == ' ' || *c == '\n' || *c == '\r')
-          ++c;
+    /* Check validity, only the linearized xref is not worth recovering */
+    if (!is_valid_xref(fp, &pdf->xrefs[i]))
+    {
+        is_linear = pdf->xrefs[i].is_linear;
+        if (!is_linear)
+          return 0;
+        memset(&pdf->xrefs[i], 0, sizeof(xref_t));
+        pdf->xrefs[i].is_linear = is_linear;
+        pdf->xrefs[i].loaded = PDF_LOAD_ENTRIES;
+        return 1;
+    }
 
-        /* xref start position */
-        pdf->xrefs[i].start = atol(c);
+    /* The entries are left to pdf_load() */
+    return 1;
+}
 
-        /* If xref is 0 handle linear xref table */
-        if (pdf->xrefs[i].start == 0)
-          get_xref_linear_skipped(fp, &pdf->xrefs[i]);
 
-        /* Non-linear, normal operation, so just find the end of the xref */
-        else
-        {
-            /* xref end position */
-            pos = ftell(fp);
-            fseek(fp, pdf->xrefs[i].start, SEEK_SET);
-            pdf->xrefs[i].end = get_next_eof(fp);
+static void *xref_worker(void *arg)
+{
+    int            i;
+    FILE          *fp;
+    xref_worker_t *w = arg;
+    xref_pool_t   *pool = w->pool;
+
+    cur_stats = &w->stats;
+    cur_budget = w->budget;
+    if (!(fp = fmemopen((void *)pool->map, pool->map_size, "r")))
+      return NULL;
+    while (!over_budget() &&
+           ((i = atomic_fetch_add(&pool->next, 1)) < pool->end))
+      pool->fn(fp, pool->pdf, i, pool->arg);
+    fclose(fp);
+    return NULL;
+}
 
-            /* Look for next EOF and xref data */
-            fseek(fp, pos, SEEK_SET);
-        }
 
-        /* Check validity */
-        if (!is_valid_xref(fp, pdf, &pdf->xrefs[i]))
-        {
-            is_linear = pdf->xrefs[i].is_linear;
-            memset(&pdf->xrefs[i], 0, sizeof(xref_t));
-            pdf->xrefs[i].is_linear = is_linear;
-            rewind(fp);
-            get_next_eof(fp);
-            continue;
-        }
+/* Call 'fn' for every xref from 'first' on.  The xrefs are shared out over
+ * pdf_t 'scan_threads' threads (this one included) if there are enough of
+ * them, 'fn' must then only touch the xref it is given.  The other threads
+ * read through a view of a mapping of the document, so that none of them
+ * moves another's position, and their counters are added to the document's.
+ */
+static void for_xrefs(
+    FILE      *fp,
+    pdf_t     *pdf,
+    int        first,
+    xref_fn_t  fn,
+    void      *arg)
+{
+    int            i, j, n_threads;
+    void          *map;
+    struct stat    st;
+    xref_pool_t    pool;
+    xref_worker_t *workers;
+
+    n_threads = pdf->scan_threads;
+    if (n_threads > (pdf->n_xrefs - first) / POOL_MIN_XREFS)
+      n_threads = (pdf->n_xrefs - first) / POOL_MIN_XREFS;
+    map = MAP_FAILED;
+    if ((n_threads > 1) && (fileno(fp) >= 0) &&
+        (fstat(fileno(fp), &st) == 0) && (st.st_size > 0))
+      map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fileno(fp), 0);
+
+    if (map == MAP_FAILED)
+    {
+        for (i=first; (i < pdf->n_xrefs) && !over_budget(); ++i)
+          fn(fp, pdf, i, arg);
+        return;
+    }
 
-        /*  Load the entries from the xref */
-        load_xref_entries(fp, &pdf->xrefs[i]);
+    memset(&pool, 0, sizeof(pool));
+    pool.pdf = pdf;
+    pool.fn = fn;
+    pool.arg = arg;
+    pool.map = map;
+    pool.map_size = st.st_size;
+    pool.end = pdf->n_xrefs;
+    atomic_init(&pool.next, first);
+
+    workers = safe_calloc(sizeof(xref_worker_t) * n_threads);
+    for (i=1; i<n_threads; ++i)
+    {
+        workers[i].pool = &pool;
+        workers[i].budget = cur_budget;
+        workers[i].budget.bytes_base = STATS->bytes_read;
+        workers[i].budget.over = &workers[i].over;
+        if (pthread_create(&workers[i].thread, NULL, xref_worker,
+                           &workers[i]) != 0)
+          break;
     }
 
-    /* Now we have all xref tables, if this is linearized, we need
-     * to make adjustments so that things spit out properly
-     */
-    if (pdf->xrefs[0].is_linear)
-      resolve_linearized_pdf(pdf);
+    /* This thread works through the document's own stream */
+    while (!over_budget() &&
+           ((j = atomic_fetch_add(&pool.next, 1)) < pool.end))
+      fn(fp, pdf, j, arg);
 
-    /* Ok now we have all xref data.  Go through those versions of the
-     * PDF and try to obtain creator information
-     */
-    load_creator(fp, pdf);
+    /* The phases are timed by this thread, the others only add counters */
+    for (j=1; j<i; ++j)
+    {
+        pthread_join(workers[j].thread, NULL);
+        memset(workers[j].stats.phase_ns, 0, sizeof(workers[j].stats.phase_ns));
+        pdf_stats_add(&pdf->stats, &workers[j].stats);
+        if (workers[j].over && !pdf->over_budget)
+          pdf->over_budget = workers[j].over;
+    }
 
-    return pdf->n_xrefs;
+    free(workers);
+    munmap(map, st.st_size);
 }
 
 
-/* Load page information */
-char pdf_get_object_status(
-    const pdf_t *pdf,
-    int          xref_idx,
-    int          entry_idx)
+/* for_xrefs() callbacks for the stages of pdf_load() */
+static void load_xref_at(FILE *fp, pdf_t *pdf, int i, void *arg)
 {
-    int                 i, curr_ver;
-    const xref_t       *prev_xref;
-    const xref_entry_t *prev, *curr;
-
-    curr = &pdf->xrefs[xref_idx].entries[entry_idx];
-    curr_ver = pdf->xrefs[xref_idx].version;
-
-    if (curr_ver == 1)
-      return 'A';
-
-    /* Deleted (freed) */
-    if (curr->f_or_n == 'f')
-      return 'D';
-
-    /* Get previous version */
-    prev_xref = NULL;
-    for (i=xref_idx; i>-1; --i)
-      if (pdf->xrefs[i].version < curr_ver)
-      {
-          prev_xref = &pdf->xrefs[i];
-          break;
-      }
+    const int ver = *(const int *)arg + i;
 
-    if (!prev_xref)
-      return '?';
+    if (!load_xref(fp, pdf, i, ver))
+    {
+        memset(&pdf->xrefs[i], 0, sizeof(xref_t));
+        pdf->xrefs[i].version = ver;
+        pdf->xrefs[i].is_recovered = 1;
+        pdf->xrefs[i].loaded = PDF_LOAD_ENTRIES;
+    }
+}
 
-    /* Locate the object in the previous one that matches current one */
-    prev = NULL;
-    for (i=0; i<prev_xref->n_entries; ++i)
-      if (prev_xref->entries[i].obj_id == curr->obj_id)
-      {
-          prev = &prev_xref->entries[i];
-          break;
-      }
 
-    /* Added in place of a previously freed id */
-    if (!prev || ((prev->f_or_n == 'f') && (curr->f_or_n == 'n')))
-      return 'A';
+/* 'arg' counts the xrefs whose entries could not be parsed */
+static void load_entries_at(FILE *fp, pdf_t *pdf, int i, void *arg)
+{
+    if (!(pdf->xrefs[i].loaded & PDF_LOAD_ENTRIES))
+    {
+        if (load_xref_entries(fp, &pdf->xrefs[i]) != 0)
+          atomic_fetch_add((atomic_int *)arg, 1);
+        pdf->xrefs[i].loaded |= PDF_LOAD_ENTRIES;
+    }
+}
 
-    /* Modified */
-    else if (prev->offset != curr->offset)
-      return 'M';
 
-    return '?';
+int pdf_load_xrefs(FILE *fp, pdf_t *pdf)
+{
+    return pdf_load(fp, pdf, PDF_LOAD_ALL);
 }
 
 
-void pdf_zero_object(
-    FILE        *fp,
-    const pdf_t *pdf,
-    int          xref_idx,
-    int          entry_idx)
+int pdf_load(FILE *fp, pdf_t *pdf, int stages)
 {
-    int           i;
-    char         *obj;
-    size_t        obj_sz;
-    xref_entry_t *entry;
+    atomic_int n_broken;
 
-    entry = &pdf->xrefs[xref_idx].entries[entry_idx];
-    fseek(fp, entry->offset, SEEK_SET);
+    STATS_FOR(pdf);
+    PHASE_BEGIN(PDF_PHASE_LOAD_XREFS);
+    atomic_init(&n_broken, 0);
+
+    /* The number of versions alone comes from the end of the document, if
+     * the chain of xrefs there holds up and nothing was indexed yet
+     */
+    if ((stages == PDF_LOAD_VERSIONS) && !pdf->loaded && !pdf->eofs &&
+        (pdf->n_versions = count_xref_chain(fp, pdf)))
+    {
+        pdf->loaded |= PDF_LOAD_VERSIONS;
+        PHASE_END(PDF_PHASE_LOAD_XREFS);
+        return over_budget() ? -1 : pdf->n_versions;
+    }
 
-    /* Get object and size */
-    obj = get_object(fp, entry->obj_id, &pdf->xrefs[xref_idx], NULL, NULL);
-    i = obj_sz = 0;
-    while (strncmp((++i)+obj, "endobj", 6))
-      ++obj_sz;
+    /* Everything else hangs off the xrefs */
+    if (!(pdf->loaded & PDF_LOAD_XREFS))
+    {
+        load_xrefs(fp, pdf);
+        pdf->loaded |= PDF_LOAD_XREFS;
+    }
 
-    if (obj_sz)
-      obj_sz += strlen("endobj") + 1;
+    /* The other stages are tracked per xref, a restored index has some */
+    if ((stages & PDF_LOAD_ENTRIES) && !(pdf->loaded & PDF_LOAD_ENTRIES))
+    {
+        for_xrefs(fp, pdf, 0, load_entries_at, &n_broken);
+        pdf->loaded |= PDF_LOAD_ENTRIES;
+    }
 
-    /* Zero object */
-    for (i=0; i<obj_sz; i++)
-      fputc('0', fp);
+    if (!atomic_load(&n_broken) &&
+        (stages & PDF_LOAD_CREATOR) && !(pdf->loaded & PDF_LOAD_CREATOR))
+    {
+        load_creator(fp, pdf);
+        pdf->loaded |= PDF_LOAD_CREATOR;
+    }
 
-    printf("Zeroed object %d\n", entry->obj_id);
-    free(obj);
+    PHASE_END(PDF_PHASE_LOAD_XREFS);
+    return (over_budget() || atomic_load(&n_broken)) ? -1 : pdf->n_xrefs;
 }
 
 
-/* Output information per version */
-void pdf_summarize(
-    FILE        *fp,
-    const pdf_t *pdf,
-    const char  *name,
-    pdf_flag_t   flags)
+/* Find the xrefs and their positions, entries and creator data aside */
+static int load_xrefs(FILE *fp, pdf_t *pdf)
 {
-    int   i, j, page, n_versions, n_entries;
-    FILE *dst, *out;
-    char *dst_name, *c;
+    int i, n, first, ver, n_broken, no_eof;
 
-    dst = NULL;
+    /* Index the %%EOF markers, unless that happened while spooling.  If the
+     * xrefs of a prefix of this document were restored (pdf_load_index()),
+     * only the bytes appended since then are scanned.
+     */
+    first = pdf->n_xrefs;
+    if (!pdf->eofs || pdf->indexed_size)
+      scan_eofs(fp, pdf, pdf->indexed_size);
+    ADVISE(fp, 0, 0, RANDOM);
+
+    /* Each %%EOF closes an xref.  A document without any is taken as a
+     * single revision through the end of the file, to be rebuilt from a scan.
+     */
+    if (over_budget())
+      return 0;
+    no_eof = !pdf->n_eofs;
+    n = pdf->n_eofs;
+    if (no_eof)
+    {
+        stats_fseek(fp, 0, SEEK_END);
+        pdf->eofless_size = ftell(fp);
+        stats_fseek(fp, 0, SEEK_SET);
+        if (pdf->eofless_size <= 0)
+          return 0;
+        n = 1;
+    }
+    if (pdf->budget.max_revisions && (n > pdf->budget.max_revisions))
+    {
+        pdf->over_budget = PDF_BUDGET_REVISIONS;
+        return 0;
+    }
+
+    pdf->xrefs = stats_realloc(pdf->xrefs, sizeof(xref_t) * n);
+    if (!pdf->xrefs)
+    {
+        ERR("Failed to reallocate xref data.\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(pdf->xrefs + first, 0, sizeof(xref_t) * (n - first));
+    pdf->n_xrefs = n;
+
+    /* Load in the start/end positions.  Versions follow file order, less
+     * one if the linearized xref was already folded into version 1.
+     */
+    ver = 1;
+    if ((first >= 2) && pdf->xrefs[0].is_linear)
+      --ver;
+    if (no_eof)
+    {
+        pdf->xrefs[0].version = ver;
+        pdf->xrefs[0].is_recovered = 1;
+        pdf->xrefs[0].loaded = PDF_LOAD_ENTRIES;
+    }
+    else
+      for_xrefs(fp, pdf, first, load_xref_at, &ver);
+
+    /* Rebuild the revisions whose startxref led nowhere from a scan */
+    for (i=first, n_broken=0; i<pdf->n_xrefs; ++i)
+      n_broken += pdf->xrefs[i].is_recovered;
+    if (n_broken)
+      recover_xrefs(fp, pdf, first);
+
+    for (i=first; i<pdf->n_xrefs; ++i)
+      if (pdf->xrefs[i].is_stream)
+        pdf->has_xref_streams = 1;
+
+    /* Now we have all xref tables, if this is linearized, we need
+     * to make adjustments so that things spit out properly.  The versions
+     * change, so their creator data is to be redone.
+     */
+    if ((first < 2) && pdf->xrefs[0].is_linear)
+    {
+        resolve_linearized_pdf(pdf);
+        for (i=0; i<pdf->n_xrefs; ++i)
+          pdf->xrefs[i].loaded &= ~PDF_LOAD_CREATOR;
+    }
+
+    /* Stages done for the restored xrefs are still to be done for these */
+    pdf->loaded &= ~(PDF_LOAD_ENTRIES | PDF_LOAD_CREATOR);
+    return pdf->n_xrefs;
+}
+
+
+/* Read up to 'want' bytes of the document at 'pos' into '*buf', grown to
+ * '*cap' bytes if need be, nul terminated.  Returns the bytes read.
+ */
+static size_t read_str(FILE *fp, long pos, size_t want, char **buf,
+                       size_t *cap)
+{
+    size_t n;
+
+    if (want + 1 > *cap)
+    {
+        free(*buf);
+        *cap = want + 1;
+        *buf = safe_calloc(*cap);
+    }
+    stats_fseek(fp, pos, SEEK_SET);
+    n = stats_fread(*buf, 1, want, fp);
+    (*buf)[n] = '\0';
+    return n;
+}
+
+
+/* Read the dictionary that follows 'pos' into '*buf' as read_str() does,
+ * reading on until it is whole (up to TRAILER_MAX bytes).  Returns where it
+ * starts in '*buf', and sets 'end' past it, or NULL if there is none.
+ */
+static const char *read_dict(FILE *fp, long pos, char **buf, size_t *cap,
+                             const char **end)
+{
+    char       *grown;
+    size_t      n, want;
+    const char *dict;
+
+    n = read_str(fp, pos, TRAILER_SIZE, buf, cap);
+    for (want=TRAILER_SIZE; ; want*=2)
+    {
+        if (!(dict = strstr(*buf, "<<")))
+          return NULL;
+        if ((*end = get_value_end(dict, *buf + n)) < *buf + n)
+          return dict;
+        if ((n < want) || (want * 2 > TRAILER_MAX) ||
+            !(grown = stats_realloc(*buf, want * 2 + 1)))
+          return NULL;
+
+        *buf = grown;
+        *cap = want * 2 + 1;
+        n += stats_fread(*buf + n, 1, want * 2 - n, fp);
+        (*buf)[n] = '\0';
+    }
+}
+
+
+/* Returns the /Prev of the xref table or stream at 'pos' in the document of
+ * 'size' bytes, 0 if it has none, or -1 if there is no xref there.  Of a
+ * table only the subsection headers are read, the entries in between are
+ * skipped as the 20 bytes that each of them takes.  'xref_end' is set to
+ * where the trailer dictionary, or the data of the stream, ends (-1 if that
+ * is not known).
+ */
+static long get_xref_prev(FILE *fp, long pos, long size, long *xref_end)
+{
+    int         is_first, is_stream;
+    long        n, prev, win_pos, dict_pos;
+    size_t      cap, len;
+    char       *buf, *c, *e;
+    const char *dict, *end, *val, *val_end;
+
+    buf = NULL;
+    cap = 0;
+    len = read_str(fp, pos, 32, &buf, &cap);
+    dict = NULL;
+    is_stream = 0;
+
+    if ((strncmp(buf, "xref", 4) == 0) && isspace((unsigned char)buf[4]))
+    {
+        /* Each subsection header must start a line, right after the entries
+         * of the one before it.  Headers that are close together are taken
+         * from the same read.
+         */
+        win_pos = pos;
+        for (pos+=4, is_first=1; ; is_first=0)
+        {
+            if ((pos - 1 < win_pos) ||
+                ((pos - 1 + 64 > win_pos + (long)len) &&
+                 (win_pos + (long)len < size)))
+            {
+                win_pos = pos - 1;
+                len = read_str(fp, win_pos, 256, &buf, &cap);
+            }
+            c = buf + (pos - 1 - win_pos);
+            if (!is_first && (*c != '\n') && (*c != '\r'))
+              break;
+            for (++c; isspace((unsigned char)*c); ++c)
+              ;
+            if (strncmp(c, "trailer", 7) == 0)
+            {
+                dict_pos = win_pos + (c - buf);
+                dict = read_dict(fp, dict_pos, &buf, &cap, &end);
+                break;
+            }
+
+            /* "<first id> <count>" alone on its line */
+            while (isdigit((unsigned char)*c))
+              ++c;
+            if (*c != ' ')
+              break;
+            while (*c == ' ')
+              ++c;
+            if (!isdigit((unsigned char)*c))
+              break;
+            n = strtol(c, &e, 10);
+            for (c=e; *c == ' '; ++c)
+              ;
+            if (*c == '\r')
+              c += (c[1] == '\n') ? 2 : 1;
+            else if (*c == '\n')
+              ++c;
+            else
+              break;
+
+            pos = win_pos + (c - buf);
+            if (n > (size - pos) / 20)
+              break;
+            pos += n * 20;
+        }
+    }
+    else
+    {
+        /* An xref stream, "<id> <gen> obj" and its dictionary */
+        for (c=buf; isdigit((unsigned char)*c) || isspace((unsigned char)*c);
+             ++c)
+          ;
+        if ((c > buf) && (strncmp(c, "obj", 3) == 0))
+        {
+            is_stream = 1;
+            dict_pos = pos;
+            dict = read_dict(fp, dict_pos, &buf, &cap, &end);
+        }
+    }
+
+    prev = -1;
+    *xref_end = -1;
+    if (dict)
+    {
+        prev = 0;
+        *xref_end = dict_pos + (end - buf);
+        if (is_stream &&
+            (!(val = get_dict_value(dict, end - dict, "/Type", &val_end)) ||
+             (strncmp(val, "/XRef", 5) != 0)))
+          prev = -1;
+        else if ((val = get_dict_value(dict, end - dict, "/Prev", &val_end)))
+          prev = isdigit((unsigned char)*val) ? strtol(val, NULL, 10) : -1;
+    }
+
+    /* The data of a stream follows "stream" and its end of line */
+    if (is_stream && (prev >= 0))
+    {
+        *xref_end = -1;
+        for (c=(char *)end; isspace((unsigned char)*c); ++c)
+          ;
+        if ((strncmp(c, "stream", 6) == 0) && ((c[6] == '\n') ||
+                                               (c[6] == '\r')) &&
+            (val = get_dict_value(dict, end - dict, "/Length", &val_end)) &&
+            isdigit((unsigned char)*val) && !get_reference(val, val_end))
+        {
+            c += (c[6] == '\r') && (c[7] == '\n') ? 8 : 7;
+            *xref_end = dict_pos + (c - buf) + strtol(val, NULL, 10);
+        }
+    }
+
+    free(buf);
+    return prev;
+}
+
+
+/* Whether there is only whitespace, "endstream" and "endobj" in [c, end) */
+static int is_blank_tail(const char *c, const char *end)
+{
+    while (c < end)
+    {
+        if (isspace((unsigned char)*c))
+          ++c;
+        else if ((end - c >= 9) && (strncmp(c, "endstream", 9) == 0))
+          c += 9;
+        else if ((end - c >= 6) && (strncmp(c, "endobj", 6) == 0))
+          c += 6;
+        else
+          return 0;
+    }
+
+    return 1;
+}
+
+
+/* Count the versions of a document by following the /Prev of each xref back
+ * from the last startxref, without indexing the %%EOF markers.  Returns 0 if
+ * the chain is broken, runs forward as in a linearized document, or does not
+ * start at the xref right before that startxref (as in what -w writes, which
+ * points back at an earlier version), for the xrefs to be loaded instead.
+ */
+static int count_xref_chain(FILE *fp, pdf_t *pdf)
+{
+    int     n;
+    long    size, pos, last, tail, xref_end;
+    size_t  len;
+    char   *buf, *c, *e, *startxref, *eof;
+
+    stats_fseek(fp, 0, SEEK_END);
+    if ((size = ftell(fp)) <= 0)
+      return 0;
+
+    /* The last %%EOF, right after the startxref that goes with it */
+    len = (size < TAIL_SIZE) ? size : TAIL_SIZE;
+    tail = size - len;
+    buf = safe_calloc(TAIL_SIZE + 1);
+    stats_fseek(fp, tail, SEEK_SET);
+    len = stats_fread(buf, 1, len, fp);
+    startxref = eof = NULL;
+    for (c=buf; (c = memchr(c, 's', buf + len - c)); ++c)
+      if ((buf + len - c >= 9) && (strncmp(c, "startxref", 9) == 0))
+        startxref = c;
+    for (c=buf; (c = memchr(c, '%', buf + len - c)); ++c)
+      if ((buf + len - c >= 5) && (strncmp(c, "%%EOF", 5) == 0))
+        eof = c;
+    pos = -1;
+    if (startxref && (eof > startxref))
+    {
+        pos = strtol(startxref + 9, &e, 10);
+        for (c=e; isspace((unsigned char)*c); ++c)
+          ;
+        if ((e == startxref + 9) || (c != eof))
+          pos = -1;
+    }
+
+    /* Each /Prev must lead further back */
+    for (n=0, last=size; (pos > 0) && (pos < last); ++n)
+    {
+        if (pdf->budget.max_revisions && (n >= pdf->budget.max_revisions))
+        {
+            pdf->over_budget = PDF_BUDGET_REVISIONS;
+            break;
+        }
+        last = pos;
+        pos = get_xref_prev(fp, pos, size, &xref_end);
+
+        if ((n == 0) && ((xref_end < tail) ||
+                         (xref_end > tail + (startxref - buf)) ||
+                         !is_blank_tail(buf + (xref_end - tail), startxref)))
+          pos = -1;
+    }
+
+    free(buf);
+    stats_fseek(fp, 0, SEEK_SET);
+    return (pos == 0) || pdf->over_budget ? n : 0;
+}
+
+
+/* Returns the xref of the version preceding that of the xref at 'xref_idx',
+ * NULL if there is none.
+ */
+static const xref_t *get_prev_xref(const pdf_t *pdf, int xref_idx)
+{
+    int i;
+
+    for (i=xref_idx; i>-1; --i)
+      if (pdf->xrefs[i].version < pdf->xrefs[xref_idx].version)
+        return &pdf->xrefs[i];
+
+    return NULL;
+}
+
+
+/* Status of the entry_idx'th entry of 'curr' in version 'curr_ver', against
+ * the prev_idx'th entry of 'prev' (-1 if the object is not in there).
+ */
+static char entry_status(
+    const xref_t *curr,
+    int           entry_idx,
+    int           curr_ver,
+    const xref_t *prev,
+    int           prev_idx)
+{
+    if (curr_ver == 1)
+      return 'A';
+
+    /* Deleted (freed) */
+    if (!XREF_IN_USE(curr, entry_idx))
+      return 'D';
+
+    if (!prev)
+      return '?';
+
+    /* Added in place of a previously freed id */
+    if ((prev_idx == -1) || !XREF_IN_USE(prev, prev_idx))
+      return 'A';
+
+    /* Unchanged */
+    if (prev->offsets[prev_idx] == curr->offsets[entry_idx])
+      return '?';
+
+    /* Rewritten, but the content is the same */
+    if (XREF_HASH(prev, prev_idx) &&
+        (XREF_HASH(prev, prev_idx) == XREF_HASH(curr, entry_idx)))
+      return 'R';
+
+    /* Modified */
+    return 'M';
+}
+
+
+/* Load page information */
+char pdf_get_object_status(
+    const pdf_t *pdf,
+    int          xref_idx,
+    int          entry_idx)
+{
+    const xref_t *curr, *prev;
+
+    curr = &pdf->xrefs[xref_idx];
+    prev = get_prev_xref(pdf, xref_idx);
+    return entry_status(curr, entry_idx, curr->version, prev,
+                        prev ? pdf_xref_find(prev, curr->obj_ids[entry_idx])
+                             : -1);
+}
+
+
+void pdf_get_object_statuses(
+    const pdf_t *pdf,
+    int          xref_idx,
+    char        *status)
+{
+    int           i, n, aligned;
+    const xref_t *curr, *prev;
+
+    curr = &pdf->xrefs[xref_idx];
+    prev = get_prev_xref(pdf, xref_idx);
+    n = curr->n_entries;
+
+    /* A table that lists the same ids as the previous one, in the same order,
+     * lines up entry for entry: the offsets are compared index to index
+     * instead of looking each id up.
+     */
+    aligned = prev && (prev->n_entries >= n) &&
+              (memcmp(prev->obj_ids, curr->obj_ids, sizeof(int) * n) == 0);
+
+    /* Over budget, the rest is left unknown */
+    for (i=0; (i < n) && !over_budget(); ++i)
+      status[i] = entry_status(curr, i, curr->version, prev,
+                               aligned ? i :
+                               prev ? pdf_xref_find(prev, curr->obj_ids[i]) :
+                               -1);
+    memset(status + i, '?', n - i);
+}
+
+
+/* An in use entry to be hashed, by its offset */
+typedef struct _hash_ref_t
+{
+    long      offset;
+    uint64_t *hash;
+} hash_ref_t;
+
+
+static int cmp_hash_ref(const void *a, const void *b)
+{
+    const hash_ref_t *x = a, *y = b;
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+
+void pdf_hash_objects(FILE *fp, pdf_t *pdf)
+{
+    int         i, j, k, n;
+    long        start, from, end;
+    char       *blk;
+    uint64_t    hash;
+    xref_t     *xref;
+    hash_ref_t *ents;
+
+    STATS_FOR(pdf);
+    PHASE_BEGIN(PDF_PHASE_HASH);
+
+    for (i=0, n=0; i<pdf->n_xrefs; ++i)
+      n += pdf->xrefs[i].n_entries;
+    if (!n)
+    {
+        PHASE_END(PDF_PHASE_HASH);
+        return;
+    }
+
+    /* The same offset is the same bytes, whichever version refers to it */
+    ents = safe_calloc(sizeof(hash_ref_t) * n);
+    for (i=0, n=0; i<pdf->n_xrefs; ++i)
+    {
+        xref = &pdf->xrefs[i];
+        if (xref->n_entries && !xref->hashes)
+          xref->hashes = safe_calloc(sizeof(uint64_t) * xref->n_alloc_entries);
+        for (j=0; j<xref->n_entries; ++j)
+          if (XREF_IN_USE(xref, j) && (xref->offsets[j] > 0))
+          {
+              ents[n].offset = xref->offsets[j];
+              ents[n++].hash = &xref->hashes[j];
+          }
+    }
+    qsort(ents, n, sizeof(hash_ref_t), cmp_hash_ref);
+
+    /* Have the kernel read in the objects that are to be hashed */
+    for (i=0, from=0, end=0; i<=n; ++i)
+    {
+        if ((i < n) && *ents[i].hash)
+          continue;
+        if ((i < n) && end && (ents[i].offset <= end))
+        {
+            end = ents[i].offset + SCAN_BLOCK_SIZE;
+            continue;
+        }
+        if (end)
+          ADVISE(fp, from, end - from, WILLNEED);
+        if (i < n)
+        {
+            from = ents[i].offset;
+            end = from + SCAN_BLOCK_SIZE;
+        }
+    }
+
+    /* Visiting the offsets in order keeps the reads sequential */
+    start = ftell(fp);
+    blk = safe_calloc(SCAN_BLOCK_SIZE);
+    for (i=0; i<n; i=j)
+    {
+        hash = 0;
+        for (j=i; (j < n) && (ents[j].offset == ents[i].offset); ++j)
+          if (*ents[j].hash)
+            hash = *ents[j].hash;
+
+        /* Every entry but the one that had to be read is a hit */
+        STATS->cache_hits += j - i;
+        if (!hash)
+        {
+            hash = hash_object(fp, ents[i].offset,
+                               (j < n) ? ents[j].offset : -1, blk);
+            --STATS->cache_hits;
+        }
+
+        for (k=i; k<j; ++k)
+          *ents[k].hash = hash;
+    }
+
+    free(blk);
+    free(ents);
+    clearerr(fp);
+    stats_fseek(fp, start, SEEK_SET);
+    PHASE_END(PDF_PHASE_HASH);
+}
+
+
+void pdf_release(FILE *fp)
+{
+    ADVISE(fp, 0, 0, DONTNEED);
+}
+
+
+/* What pdf_write_version() appends to the document */
+#define VERSION_TRAILER "\r\nstartxref\r\n%ld\r\n%%%%EOF"
+
+
+long pdf_version_size(FILE *fp, const pdf_t *pdf, int xref_idx)
+{
+    long start, size;
+
+    start = ftell(fp);
+    stats_fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    stats_fseek(fp, start, SEEK_SET);
+    if (size < 0)
+      return -1;
+
+    return size + snprintf(NULL, 0, VERSION_TRAILER,
+                           pdf->xrefs[xref_idx].start);
+}
+
+
+int pdf_write_version(FILE *fp, pdf_t *pdf, int xref_idx, FILE *dst)
+{
+    int  ret;
+    long start, size;
+
+    STATS_FOR(pdf);
+    PHASE_BEGIN(PDF_PHASE_WRITE);
+
+    /* Copy original PDF */
+    start = ftell(fp);
+    stats_fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    ADVISE(fp, 0, 0, SEQUENTIAL);
+    ret = copy_head(fp, dst, size);
+    ADVISE(fp, 0, 0, RANDOM);
+
+    /* Emit an older startxref, referring to an older version. */
+    fprintf(dst, VERSION_TRAILER, pdf->xrefs[xref_idx].start);
+
+    clearerr(fp);
+    stats_fseek(fp, start, SEEK_SET);
+    PHASE_END(PDF_PHASE_WRITE);
+    return (ret || ferror(dst)) ? -1 : 0;
+}
+
+
+/* pread() of 'fp', which goes through stdio (and moves its position) for
+ * streams without a descriptor, e.g. members of a container.
+ */
+static ssize_t read_at(FILE *fp, void *buf, size_t n, long off)
+{
+    if (fileno(fp) >= 0)
+      return pread(fileno(fp), buf, n, off);
+    if (stats_fseek(fp, off, SEEK_SET) != 0)
+      return -1;
+    return stats_fread(buf, 1, n, fp);
+}
+
+
+/* Copy the first 'len' bytes of 'fp' to the descriptor of 'dst'.  On Linux
+ * the kernel moves the data itself, with copy_file_range() between files or
+ * sendfile() into a pipe or socket, read()/write() picks up whatever it
+ * refused.  Unless 'fp' has no descriptor, neither its position nor its
+ * buffer is disturbed.
+ */
+static int copy_head(FILE *fp, FILE *dst, long len)
+{
+    int      in, out;
+    char    *blk;
+    off_t    off;
+    ssize_t  n, done, w;
+
+    in = fileno(fp);
+    out = fileno(dst);
+    off = 0;
+    fflush(dst);
+
+#if defined(__linux__) && defined(__GLIBC__) && \
+    ((__GLIBC__ > 2) || (__GLIBC_MINOR__ >= 27))
+    while ((off < len) &&
+           (n = copy_file_range(in, &off, out, NULL, len - off, 0)) > 0)
+      ;
+#endif
+#ifdef __linux__
+    while ((off < len) && (n = sendfile(out, in, &off, len - off)) > 0)
+      ;
+#endif
+
+    if (off < len)
+    {
+        blk = safe_calloc(SCAN_BLOCK_SIZE);
+        while (off < len)
+        {
+            n = len - off < SCAN_BLOCK_SIZE ? len - off : SCAN_BLOCK_SIZE;
+            if ((n = read_at(fp, blk, n, off)) <= 0)
+              break;
+            for (done = 0; done < n; done += w)
+              if ((w = write(out, blk + done, n - done)) <= 0)
+                break;
+            if (done < n)
+              break;
+            off += n;
+        }
+        free(blk);
+    }
+
+    STATS->bytes_read += off;
+    return (off == len) ? 0 : -1;
+}
+
+
+int pdf_copy_version(FILE *fp, pdf_t *pdf, int xref_idx, FILE *dst)
+{
+    int  ret;
+    long len;
+    char eol[2];
+
+    STATS_FOR(pdf);
+    PHASE_BEGIN(PDF_PHASE_WRITE);
+
+    /* The revision ends with its %%EOF marker and the end of line after it,
+     * or with the file if there is no marker
+     */
+    len = get_revision_end(pdf, xref_idx);
+    if (xref_idx < pdf->n_eofs)
+      len += strlen("%%EOF");
+    memset(eol, 0, sizeof(eol));
+    if ((xref_idx < pdf->n_eofs) && (read_at(fp, eol, sizeof(eol), len) > 0))
+    {
+        if ((eol[0] == '\r') && (eol[1] == '\n'))
+          len += 2;
+        else if ((eol[0] == '\r') || (eol[0] == '\n'))
+          ++len;
+    }
+
+    ADVISE(fp, 0, len, SEQUENTIAL);
+    ret = copy_head(fp, dst, len);
+    ADVISE(fp, 0, len, RANDOM);
+
+    PHASE_END(PDF_PHASE_WRITE);
+    return ret;
+}
+
+
+/* Live object of the newest version, as found by pdf_write_scrubbed() */
+typedef struct _scrub_obj_t
+{
+    int  obj_id;
+    int  gen_num;
+    int  order;      /* Of the entry over all revisions, the last one wins */
+    long offset;     /* In the source document */
+    long limit;      /* Next object or xref in the source, -1 for the end */
+    long new_offset; /* In the scrubbed document, 0 if it was not copied */
+} scrub_obj_t;
+
+
+static int cmp_scrub_offset(const void *a, const void *b)
+{
+    const scrub_obj_t *x = a, *y = b;
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+
+static int cmp_scrub_id(const void *a, const void *b)
+{
+    const scrub_obj_t *x = a, *y = b;
+    if (x->obj_id != y->obj_id)
+      return (x->obj_id < y->obj_id) ? -1 : 1;
+    return x->order - y->order;
+}
+
+
+static int cmp_offset(const void *a, const void *b)
+{
+    const long *x = a, *y = b;
+    return (*x > *y) - (*x < *y);
+}
+
+
+/* Set the limit of each of the 'objs' (sorted by offset): the nearest offset
+ * past it that any revision lists, an object or an xref, so the objects that
+ * were dropped bound the live ones too.  Returns -1 if out of budget.
+ */
+static int set_scrub_limits(const pdf_t *pdf, scrub_obj_t *objs, int n_objs)
+{
+    int     i, j, n;
+    long   *bounds;
+    xref_t *xref;
+
+    for (i=0, n=0; i<pdf->n_xrefs; ++i)
+      n += pdf->xrefs[i].n_entries + 1;
+    if (!budget_alloc(sizeof(long) * ((size_t)n + 1)))
+      return -1;
+
+    bounds = safe_calloc(sizeof(long) * (n + 1));
+    for (i=0, n=0; i<pdf->n_xrefs; ++i)
+    {
+        xref = &pdf->xrefs[i];
+        if (xref->start > 0)
+          bounds[n++] = xref->start;
+        for (j=0; j<xref->n_entries; ++j)
+          if (XREF_IN_USE(xref, j) && (xref->offsets[j] > 0))
+            bounds[n++] = xref->offsets[j];
+    }
+    qsort(bounds, n, sizeof(long), cmp_offset);
+
+    for (i=j=0; i<n_objs; ++i)
+    {
+        while ((j < n) && (bounds[j] <= objs[i].offset))
+          ++j;
+        objs[i].limit = (j < n) ? bounds[j] : -1;
+    }
+
+    free(bounds);
+    return 0;
+}
+
+
+/* End the copy of 'obj' in 'dst' at 'keep', just past its last "endobj".
+ * An object without one is not something we can keep.
+ */
+static void finish_object(FILE *dst, scrub_obj_t *obj, long keep)
+{
+    if (keep > obj->new_offset)
+    {
+        fseek(dst, keep, SEEK_SET);
+        fputc('\n', dst);
+    }
+    else
+    {
+        fseek(dst, obj->new_offset, SEEK_SET);
+        obj->new_offset = 0;
+    }
+}
+
+
+/* Copy the objects in 'objs' (sorted by offset) from 'fp' to 'dst' in a
+ * single forward pass over 'fp'.  Each object runs from its offset up to and
+ * including its "endobj": the last one before its limit, as the data of a
+ * stream can hold the word too.  What follows that "endobj" is written as it
+ * is read and then rewound over in 'dst', which must be a seekable file.
+ */
+static void copy_objects(FILE *fp, FILE *dst, scrub_obj_t *objs, int n_objs)
+{
+    static const char   endobj[] = "endobj";
+    static const size_t blk_sz = 64 * 1024;
+    int                 k, copying, match;
+    char               *buf, *e;
+    size_t              i, n, span, stop;
+    long                pos, keep;
+
+    buf = safe_calloc(blk_sz);
+    stats_fseek(fp, 0, SEEK_SET);
+    pos = keep = 0;
+    k = copying = match = 0;
+    while ((k < n_objs) && (n = stats_fread(buf, 1, blk_sz, fp)) > 0)
+    {
+        i = span = 0;
+        while (i < n)
+        {
+            if (!copying)
+            {
+                /* Overlapping or bogus entries are dropped */
+                while ((k < n_objs) && (objs[k].offset < pos + (long)i))
+                  ++k;
+                if ((k == n_objs) || (objs[k].offset >= pos + (long)n))
+                  break;
+
+                i = span = objs[k].offset - pos;
+                objs[k].new_offset = keep = ftell(dst);
+                copying = 1;
+                match = 0;
+            }
+
+            /* Look for "endobj", which may straddle two blocks */
+            stop = ((objs[k].limit >= 0) && (objs[k].limit < pos + (long)n)) ?
+              (size_t)(objs[k].limit - pos) : n;
+            while (i < stop)
+            {
+                if (match == 0)
+                {
+                    if (!(e = memchr(buf + i, endobj[0], stop - i)))
+                    {
+                        i = stop;
+                        break;
+                    }
+                    i = e - buf;
+                }
+                if (buf[i] == endobj[match])
+                  ++match;
+                else
+                  match = (buf[i] == endobj[0]);
+                ++i;
+
+                if (match == sizeof(endobj) - 1)
+                {
+                    fwrite(buf + span, 1, i - span, dst);
+                    keep = ftell(dst);
+                    span = i;
+                    match = 0;
+                }
+            }
+
+            /* At the limit, keep the object up to its last "endobj" */
+            if (stop < n)
+            {
+                finish_object(dst, &objs[k], keep);
+                copying = 0;
+                ++k;
+            }
+        }
+
+        if (copying)
+          fwrite(buf + span, 1, n - span, dst);
+        pos += n;
+    }
+
+    if (copying)
+      finish_object(dst, &objs[k], keep);
+
+    /* Drop anything written past the last object that was kept */
+    fflush(dst);
+    if (ftruncate(fileno(dst), ftell(dst)) != 0)
+      clearerr(dst);
+
+    free(buf);
+}
+
+
+/* Returns the trailer dictionary "<< ... >>" that belongs to 'xref' */
+static char *get_trailer(FILE *fp, const xref_t *xref, size_t *size)
+{
+    long        start;
+    size_t      sz;
+    char       *buf, *dict;
+    const char *c, *t, *end;
+
+    *size = 0;
+    if (xref->is_stream || (xref->end <= xref->start))
+      return NULL;
+
+    /* The trailer sits at the tail of the section, after the entries */
+    start = ftell(fp);
+    sz = xref->end - xref->start;
+    if (sz > 4096)
+      sz = 4096;
+    buf = safe_calloc(sz + 1);
+    stats_fseek(fp, xref->end - sz, SEEK_SET);
+    sz = stats_fread(buf, 1, sz, fp);
+    stats_fseek(fp, start, SEEK_SET);
+    end = buf + sz;
+
+    /* Last "trailer" in the buffer */
+    t = NULL;
+    for (c=buf; (c = memchr(c, 't', end - c)); ++c)
+      if (((end - c) > 7) && (strncmp(c, "trailer", 7) == 0))
+        t = c;
+
+    dict = NULL;
+    if (t && (c = strstr(t, "<<")))
+    {
+        *size = get_value_end(c, end) - c;
+        dict = safe_calloc(*size + 1);
+        memcpy(dict, c, *size);
+    }
+
+    free(buf);
+    return dict;
+}
+
+
+int pdf_write_scrubbed(FILE *fp, pdf_t *pdf, FILE *dst)
+{
+    int          i, j, k, n_objs, n_entries, n_copied, has_root, last_version;
+    long         xref_start;
+    char        *trailer;
+    const char  *c, *key, *end;
+    size_t       trailer_sz, key_len;
+    scrub_obj_t *objs;
+    one_xref_t   one;
+
+    STATS_FOR(pdf);
+    if (pdf->has_xref_streams)
+    {
+        ERR("Scrubbing documents with cross reference streams is not "
+            "supported.\n");
+        return -1;
+    }
+
+    /* Newest version and the number of entries over all revisions */
+    last_version = n_entries = 0;
+    for (i=0; i<pdf->n_xrefs; ++i)
+    {
+        if (pdf->xrefs[i].version > last_version)
+          last_version = pdf->xrefs[i].version;
+        if (pdf->xrefs[i].version)
+          n_entries += pdf->xrefs[i].n_entries;
+    }
+
+    if (!last_version ||
+        !budget_alloc(sizeof(scrub_obj_t) * ((size_t)n_entries + 1)))
+      return -1;
+
+    /* Every entry in revision order, objs[0] is kept for object 0.  Ids
+     * that the xref could not number past (INT_MAX) are dropped.
+     */
+    objs = safe_calloc(sizeof(scrub_obj_t) * (n_entries + 1));
+    for (i=0, n_objs=1; i<pdf->n_xrefs; ++i)
+      for (j=0; pdf->xrefs[i].version && j<pdf->xrefs[i].n_entries; ++j)
+      {
+          const xref_t *xref = &pdf->xrefs[i];
+          if ((xref->obj_ids[j] <= 0) || (xref->obj_ids[j] == INT_MAX))
+            continue;
+          objs[n_objs].obj_id = xref->obj_ids[j];
+          objs[n_objs].gen_num = XREF_GEN_NUM(xref, j);
+          objs[n_objs].order = n_objs;
+          objs[n_objs].offset = XREF_IN_USE(xref, j) ? xref->offsets[j] : 0;
+          ++n_objs;
+      }
+
+    /* The last entry of each id is the object table of the newest version */
+    qsort(objs + 1, n_objs - 1, sizeof(scrub_obj_t), cmp_scrub_id);
+    for (i=k=1; i<n_objs; ++i)
+      if (((i + 1 == n_objs) || (objs[i + 1].obj_id != objs[i].obj_id)) &&
+          (objs[i].offset > 0))
+        objs[k++] = objs[i];
+    n_objs = k;
+
+    /* Header, with a binary comment so transports treat it as binary */
+    fprintf(dst, "%%PDF-%d.%d\n%%\xe2\xe3\xcf\xd3\n",
+            pdf->pdf_major_version, pdf->pdf_minor_version);
+
+    /* Copy the objects in file order, then put them back in id order */
+    qsort(objs + 1, n_objs - 1, sizeof(scrub_obj_t), cmp_scrub_offset);
+    if (set_scrub_limits(pdf, objs + 1, n_objs - 1) < 0)
+    {
+        free(objs);
+        return -1;
+    }
+    {
+        PHASE_BEGIN(PDF_PHASE_WRITE);
+        copy_objects(fp, dst, objs + 1, n_objs - 1);
+        PHASE_END(PDF_PHASE_WRITE);
+    }
+    qsort(objs + 1, n_objs - 1, sizeof(scrub_obj_t), cmp_scrub_id);
+
+    for (i=k=1; i<n_objs; ++i)
+      if (objs[i].new_offset)
+        objs[k++] = objs[i];
+    n_copied = k - 1;
+
+    /* Fresh xref, a subsection for each run of consecutive ids.  Ids that
+     * were not copied are left out, and object 0 heads an empty free list.
+     */
+    xref_start = ftell(dst);
+    fprintf(dst, "xref\n");
+    for (i=0; i<=n_copied; i=j)
+    {
+        for (j=i+1;
+             (j <= n_copied) && (objs[j].obj_id == objs[j - 1].obj_id + 1);
+             ++j)
+          ;
+        fprintf(dst, "%d %d\n", objs[i].obj_id, j - i);
+        for (k=i; k<j; ++k)
+          if (k == 0)
+            fprintf(dst, "%010d %05d f\r\n", 0, 65535);
+          else
+            fprintf(dst, "%010ld %05d n\r\n", objs[k].new_offset,
+                    objs[k].gen_num);
+    }
+
+    /* Carry over the newest trailer, minus the entries that described the
+     * old revision chain.
+     */
+    fprintf(dst, "trailer\n<<");
+    for (i=pdf->n_xrefs-1; i>=0; --i)
+      if (pdf->xrefs[i].version == last_version)
+        break;
+    has_root = 0;
+    if ((trailer = get_trailer(fp, &pdf->xrefs[i], &trailer_sz)))
+    {
+        end = trailer + trailer_sz - 2;
+        for (c=trailer+2; c<end; )
+        {
+            if (*c != '/')
+            {
+                ++c;
+                continue;
+            }
+
+            key = c++;
+            while ((c < end) && !isspace(*c) && !strchr("/()<>[]{}%", *c))
+              ++c;
+            key_len = c - key;
+            while ((c < end) && isspace(*c))
+              ++c;
+            if (get_reference(c, end))
+              c = (const char *)memchr(c, 'R', end - c) + 1;
+            else
+              c = get_value_end(c, end);
+
+            if (((key_len == 5) && (strncmp(key, "/Size", 5) == 0)) ||
+                ((key_len == 5) && (strncmp(key, "/Prev", 5) == 0)) ||
+                ((key_len == 8) && (strncmp(key, "/XRefStm", 8) == 0)))
+              continue;
+            if ((key_len == 5) && (strncmp(key, "/Root", 5) == 0))
+              has_root = 1;
+
+            fputc(' ', dst);
+            fwrite(key, 1, c - key, dst);
+        }
+        free(trailer);
+    }
+
+    /* Without a trailer to say where the catalog is, readers cannot open the
+     * document at all.  The first copied object that is one will do.
+     */
+    for (i=1; !has_root && i<=n_copied; ++i)
+      if (strcmp(get_type(fp, objs[i].obj_id,
+                          one_xref(&one, objs[i].obj_id, objs[i].offset)),
+                 "Catalog") == 0)
+      {
+          fprintf(dst, " /Root %d %d R", objs[i].obj_id, objs[i].gen_num);
+          has_root = 1;
+      }
+
+    fprintf(dst, " /Size %d >>\nstartxref\n%ld\n%%%%EOF\n",
+            objs[n_copied].obj_id + 1, xref_start);
+
+    free(objs);
+    return (ferror(dst) || ferror(fp)) ? -1 : n_copied;
+}
+
+
+/* Output information per version */
+static void summarize(
+    FILE        *fp,
+    pdf_t       *pdf,
+    const char  *name,
+    pdf_flag_t   flags);
+
+
+void pdf_summarize(
+    FILE        *fp,
+    pdf_t       *pdf,
+    const char  *name,
+    pdf_flag_t   flags)
+{
+    STATS_FOR(pdf);
+    PHASE_BEGIN(PDF_PHASE_SUMMARIZE);
+    summarize(fp, pdf, name, flags);
+    PHASE_END(PDF_PHASE_SUMMARIZE);
+}
+
+
+/* Copy 's' to 'dst' without its nul, returns the end of the copy */
+static char *put_str(char *dst, const char *s)
+{
+    const size_t len = strlen(s);
+    memcpy(dst, s, len);
+    return dst + len;
+}
+
+
+/* Decimal digits of 'v' at 'dst', returns the end of them */
+static char *put_int(char *dst, long v)
+{
+    char           digits[24], *d;
+    unsigned long  u;
+
+    if (v < 0)
+      *dst++ = '-';
+    u = (v < 0) ? -(unsigned long)v : (unsigned long)v;
+
+    d = digits + sizeof(digits);
+    do
+      *--d = '0' + (u % 10);
+    while (u /= 10);
+
+    memcpy(dst, d, digits + sizeof(digits) - d);
+    return dst + (digits + sizeof(digits) - d);
+}
+
+
+static void summarize(
+    FILE        *fp,
+    pdf_t       *pdf,
+    const char  *name,
+    pdf_flag_t   flags)
+{
+    int                 i, j, obj_id, page, n_versions, n_entries;
+    int                 seen_version;
+    FILE               *dst, *out;
+    char               *dst_name, *c, *line, *status;
+    char                seen_type[PDF_STORE_TYPE_LEN];
+    uint64_t            hash;
+    const char         *type, *seen_doc, *base;
+    const xref_t       *xref;
+    page_map_t         *pages;
+    pdf_objmap_t       *objmap;
+
+    dst = NULL;
     dst_name = NULL;
 
-    if (name)
+    /* The summary goes into the 'name' directory, named after it */
+    if (name)
+    {
+        base = (c = strrchr(name, '/')) ? c + 1 : name;
+        dst_name = safe_calloc(strlen(name) + strlen(base) + 16);
+        sprintf(dst_name, "%s/%s", name, base);
+
+        if ((c = strrchr(dst_name, '.')) && (strncmp(c, ".pdf", 4) == 0))
+          *c = '\0';
+
+        strcat(dst_name, ".summary");
+        if (!(dst = fopen(dst_name, "w")))
+        {
+            ERR("Could not open file '%s' for writing\n", dst_name);
+            return;
+        }
+    }
+
+    /* Send output to file or stdout */
+    out = (dst) ? dst : (pdf->out ? pdf->out : stdout);
+
+    /* Object lines are put together by hand, type names are bounded */
+    line = safe_calloc(strlen(pdf->name) + PDF_STORE_TYPE_LEN + 128);
+
+    /* Count versions, unless that was done without the xrefs */
+    n_versions = pdf->n_xrefs;
+    if (n_versions && pdf->xrefs[0].is_linear)
+      --n_versions;
+
+    /* Ignore bad xref entry */
+    for (i=1; i<pdf->n_xrefs; ++i)
+      if (pdf->xrefs[i].end == 0)
+        --n_versions;
+
+    /* If we have no valid versions but linear, count that */
+    if (!pdf->n_xrefs || (!n_versions && pdf->xrefs[0].is_linear))
+      n_versions = 1;
+    if (!(pdf->loaded & PDF_LOAD_XREFS))
+      n_versions = pdf->n_versions;
+
+    /* Compare each object (if we don't have xref streams) */
+    n_entries = 0;
+    pages = NULL;
+    status = NULL;
+    for (i=0; !(const int)pdf->has_xref_streams && i<pdf->n_xrefs; i++)
+    {
+        if ((flags & PDF_FLAG_QUIET) || over_budget())
+          continue;
+
+        if (!pages)
+          pages = new_page_map(pdf);
+
+        /* The status of the whole table at once */
+        xref = &pdf->xrefs[i];
+        if (xref->n_entries)
+        {
+            free(status);
+            status = safe_calloc(xref->n_entries);
+            pdf_get_object_statuses(pdf, i, status);
+        }
+
+        for (j=0; j<xref->n_entries; j++)
+        {
+            /* Nothing is read once over budget, but the lines would go on */
+            if (over_budget())
+              break;
+
+            ++n_entries;
+            obj_id = xref->obj_ids[j];
+            hash = XREF_HASH(xref, j);
+
+            /* Objects already in the store need not be classified again */
+            seen_doc = NULL;
+            if (pdf->store &&
+                pdf_store_find(pdf->store, hash, &seen_doc,
+                               &seen_version, seen_type))
+            {
+                type = seen_type;
+                ++STATS->cache_hits;
+            }
+            else
+            {
+                type = get_type(fp, obj_id, xref);
+                if (pdf->store)
+                  pdf_store_add(pdf->store, hash, pdf->name,
+                                xref->version, type);
+            }
+
+            /* "<name>: --<status>-- Version <v> -- Object <id> (<type>)" */
+            c = put_str(line, pdf->name);
+            c = put_str(c, ": --");
+            *c++ = status[j];
+            c = put_str(c, "-- Version ");
+            c = put_int(c, xref->version);
+            c = put_str(c, " -- Object ");
+            c = put_int(c, obj_id);
+            c = put_str(c, " (");
+            c = put_str(c, type);
+            *c++ = ')';
+
+            page = get_page(fp, pdf, pages, i, obj_id);
+            if (page)
+            {
+                c = put_str(c, " Page(");
+                c = put_int(c, page);
+                *c++ = ')';
+            }
+
+            if (seen_doc && (strcmp(seen_doc, pdf->name) != 0))
+            {
+                fwrite(line, 1, c - line, out);
+                fprintf(out, " Reused(%s Version %d)\n",
+                        seen_doc, seen_version);
+            }
+            else
+            {
+                *c++ = '\n';
+                fwrite(line, 1, c - line, out);
+            }
+
+            if ((flags & PDF_FLAG_DIFF) && (status[j] == 'M'))
+              pdf_diff_object(fp, pdf, i, j, flags, out);
+        }
+    }
+    delete_page_map(pages);
+    free(status);
+
+    /* Trailing summary */
+    if (!(flags & PDF_FLAG_QUIET))
+    {
+        /* Let the user know that we cannot we print a per-object summary.
+         * If we have a 1.5 PDF using streams for xref, we have not objects
+         * to display, so let the user know whats up.
+         */
+        if (pdf->has_xref_streams || !n_entries)
+           fprintf(out,
+               "%s: This PDF contains potential cross reference streams.\n"
+               "%s: An object summary is not available.\n",
+               pdf->name,
+               pdf->name);
+
+        fprintf(out,
+                "---------- %s ----------\n"
+                "Versions: %d\n",
+                pdf->name,
+                n_versions);
+
+        /* Count the objects in use in each version, earlier revisions
+         * (and the first page xref of a linearized PDF) included.
+         */
+        if (!pdf->has_xref_streams)
+        {
+            objmap = pdf_objmap_new(pdf);
+            for (i=0; i<pdf->n_xrefs; i++)
+            {
+                if (pdf->xrefs[i].is_linear)
+                  continue;
+
+                n_entries = pdf_objmap_count(objmap, pdf->xrefs[i].version);
+                if (pdf->xrefs[i].version && n_entries)
+                  fprintf(out,
+                          "Version %d -- %d objects%s\n",
+                          pdf->xrefs[i].version,
+                          n_entries,
+                          pdf->xrefs[i].is_recovered ? " (recovered)" : "");
+            }
+            pdf_objmap_delete(objmap);
+        }
+    }
+    else /* Quiet output */
+      fprintf(out, "%s: %d\n", pdf->name, n_versions);
+
+    free(line);
+    if (dst)
+    {
+        fclose(dst);
+        free(dst_name);
+    }
+}
+
+
+/* Returns '1' if we successfully display data (means its probably not xml) */
+int pdf_display_creator(const pdf_t *pdf, int xref_idx)
+{
+    int                  i;
+    FILE                *out;
+    const pdf_creator_t *c;
+
+    if (!pdf->xrefs[xref_idx].creator)
+      return 0;
+
+    /* Decoded values can hold a nul (U+0000), their length is what counts */
+    out = pdf->out ? pdf->out : stdout;
+    for (i=0; i<pdf->xrefs[xref_idx].n_creator_entries; ++i)
+    {
+        c = &pdf->xrefs[xref_idx].creator[i];
+        fprintf(out, "%s: ", pdf_str(pdf, c->key));
+        fwrite(pdf_str(pdf, c->value), 1, c->value.len, out);
+        fputc('\n', out);
+    }
+
+    return (i > 0);
+}
+
+
+/* Checks if the xref is valid and sets 'is_stream' flag if the xref is a
+ * stream (PDF 1.5 or higher)
+ */
+static int is_valid_xref(FILE *fp, xref_t *xref)
+{
+    int   is_valid;
+    long  start;
+    char *c, buf[16];
+
+    memset(buf, 0, sizeof(buf));
+    is_valid = 0;
+    start = ftell(fp);
+    stats_fseek(fp, xref->start, SEEK_SET);
+
+    /* An offset past the end of the document is not an xref */
+    if (stats_fgets(buf, 16, fp) == NULL) {
+      clearerr(fp);
+      stats_fseek(fp, start, SEEK_SET);
+      return 0;
+    }
+
+    if (strncmp(buf, "xref", strlen("xref")) == 0)
+      is_valid = 1;
+    else
+    {
+        /* PDFv1.5+ allows for xref data to be stored in streams vs plaintext */
+        stats_fseek(fp, xref->start, SEEK_SET);
+        c = get_object_from_here(fp, NULL, &xref->is_stream);
+
+        if (c && xref->is_stream)
+          is_valid = 1;
+        free(c);
+    }
+
+    stats_fseek(fp, start, SEEK_SET);
+    return is_valid;
+}
+
+
+/* Returns -1 if the table is too broken to parse, 0 otherwise */
+static int load_xref_entries(FILE *fp, xref_t *xref)
+{
+    int ret;
+
+    PHASE_BEGIN(PDF_PHASE_LOAD_ENTRIES);
+    pdf_xref_free_entries(xref);
+
+    ret = 0;
+    if (xref->is_stream)
+      load_xref_from_stream(fp, xref);
+    else
+      ret = load_xref_from_plaintext(fp, xref);
+
+    PHASE_END(PDF_PHASE_LOAD_ENTRIES);
+    return ret;
+}
+
+
+static int load_xref_from_plaintext(FILE *fp, xref_t *xref)
+{
+    int          i, n, obj_id;
+    char         c, buf[32] = {0};
+    long         start, pos, id;
+    size_t       buf_idx;
+    xref_entry_t entry;
+
+    start = ftell(fp);
+
+    /* Get number of entries, from the /Size of the trailer.  Without a
+     * trailer, the entries run up to whatever ends them.
+     */
+    pos = xref->end;
+    stats_fseek(fp, pos, SEEK_SET);
+    while ((pos > xref->start) && !over_budget())
+      if (SAFE_F(fp, (stats_fgetc(fp) == '/' && stats_fgetc(fp) == 'S')))
+        break;
+      else if (stats_fseek(fp, --pos, SEEK_SET) != 0)
+      {
+          ERR("Failed seek to xref /Size.\n");
+          stats_fseek(fp, start, SEEK_SET);
+          return -1;
+      }
+
+    /* Out of budget, the entries are left out rather than failing */
+    if ((pos <= xref->start) && !over_budget())
+      n = INT_MAX;
+    else if (stats_fread(buf, 1, 21, fp) != 21)
+    {
+        stats_fseek(fp, start, SEEK_SET);
+        if (over_budget())
+          return 0;
+        ERR("Failed to load entry Size string.\n");
+        return -1;
+    }
+    else
+      n = atoi(buf + strlen("ize "));
+
+    /* Load entry data, no more than /Size of them */
+    obj_id = 0;
+    stats_fseek(fp, xref->start + strlen("xref"), SEEK_SET);
+    memset(&entry, 0, sizeof(entry));
+    for (i=0; i<n; i++)
+    {
+        /* Advance past newlines. */
+        c = stats_fgetc(fp);
+        while (c == '\n' || c == '\r')
+          c = stats_fgetc(fp);
+
+        if (ferror(fp) || feof(fp))
+          break;
+
+        /* Collect data up until the following newline. */
+        buf_idx = 0;
+        while (c != '\n' && c != '\r' && !feof(fp) &&
+               !ferror(fp) && buf_idx < sizeof(buf))
+        {
+            buf[buf_idx++] = c;
+            c = stats_fgetc(fp);
+        }
+        if (buf_idx >= sizeof(buf))
+        {
+            ERR("Failed to locate newline character. "
+                "This might be a corrupt PDF.\n");
+            stats_fseek(fp, start, SEEK_SET);
+            return -1;
+        }
+        buf[buf_idx] = '\0';
+
+        /* Went to far and hit start of trailer */
+        if (strchr(buf, 't'))
+          break;
+
+        /* Entry or object id */
+        if (strlen(buf) > 17)
+        {
+            const char *token = NULL;
+            char       *save = NULL;
+
+            /* Ids run on from the subsection start, within int */
+            if (obj_id < 0)
+              break;
+            entry.obj_id = obj_id;
+            obj_id = (obj_id < INT_MAX) ? obj_id + 1 : -1;
+            if ((token = strtok_r(buf, " ", &save)))
+            {
+                entry.offset = atol(token);
+                token = strtok_r(NULL, " ", &save);
+            }
+            if (!token)
+            {
+                ERR("Failed to parse xref entry. "
+                    "This might be a corrupt PDF.\n");
+                stats_fseek(fp, start, SEEK_SET);
+                return -1;
+            }
+            entry.gen_num = atoi(token);
+            entry.f_or_n = buf[17];
+            pdf_xref_add_entry(xref, &entry);
+        }
+        else
+        {
+            id = strtol(buf, NULL, 10);
+            obj_id = ((id >= 0) && (id <= INT_MAX)) ? id : -1;
+            --i;
+        }
+    }
+
+    stats_fseek(fp, start, SEEK_SET);
+    return 0;
+}
+
+
+/* Load an xref table from a stream (PDF v1.5 +) */
+static void load_xref_from_stream(FILE *fp, xref_t *xref)
+{
+    long        start, n, count;
+    char       *dict;
+    size_t      size;
+    const char *c, *end;
+
+    xref->n_stream_entries = 0;
+    start = ftell(fp);
+    dict = get_object_value(fp, xref->start, &size, NULL);
+    stats_fseek(fp, start, SEEK_SET);
+    if (!dict)
+      return;
+
+    /* Count the entries the stream lists: the second number of each /Index
+     * pair, or /Size when there is no /Index
+     */
+    n = 0;
+    if ((c = get_dict_value(dict, size, "/Index", &end)) && (*c == '['))
+    {
+        for (++c; (c < end) && (*c != ']'); )
+        {
+            strtol(c, (char **)&c, 10);
+            if (((count = strtol(c, (char **)&c, 10)) < 0) ||
+                (count > INT_MAX - n))
+              break;
+            n += count;
+            while ((c < end) && isspace(*c))
+              ++c;
+            if ((c < end) && !isdigit(*c) && (*c != ']'))
+              break;
+        }
+    }
+    else if ((c = get_dict_value(dict, size, "/Size", &end)))
+      n = atol(c);
+    xref->n_stream_entries = ((n > 0) && (n <= INT_MAX)) ? n : 0;
+
+    /* TODO: decode and analyze stream */
+    free(dict);
+}
+
+
+static void get_xref_linear_skipped(FILE *fp, const pdf_t *pdf, xref_t *xref)
+{
+    int  err;
+    char ch, buf[256];
+
+    if (xref->start != 0)
+      return;
+
+    /* Special case (Linearized PDF with initial startxref at 0) */
+    xref->is_linear = 1;
+
+    /* Seek past the next %%EOF */
+    if ((xref->end = get_next_eof(pdf, ftell(fp))) < 0)
+      return;
+    stats_fseek(fp, xref->end + strlen("%%EOF"), SEEK_SET);
+
+    /* Locate the trailer */
+    err = 0;
+    while (!(err = ferror(fp)) && stats_fread(buf, 1, 8, fp))
+    {
+        if (strncmp(buf, "trailer", strlen("trailer")) == 0)
+          break;
+        else if ((ftell(fp) - 9) < 0)
+          return;
+
+        stats_fseek(fp, -9, SEEK_CUR);
+    }
+
+    if (err)
+      return;
+
+    /* If we found 'trailer' look backwards for 'xref' */
+    ch = 0;
+    while (SAFE_F(fp, ((ch = stats_fgetc(fp)) != 'x')))
+      if (stats_fseek(fp, -2, SEEK_CUR) == -1)
+        return; /* Left at 0, the xref will not validate */
+
+    if (ch == 'x')
+    {
+        xref->start = ftell(fp) - 1;
+        stats_fseek(fp, -1, SEEK_CUR);
+    }
+
+    /* Now continue to next eof ... */
+    stats_fseek(fp, xref->start, SEEK_SET);
+}
+
+
+/* This must only be called after all xref and entries have been acquired */
+static void resolve_linearized_pdf(pdf_t *pdf)
+{
+    int    i;
+    xref_t buf;
+
+    if (pdf->n_xrefs < 2)
+      return;
+
+    if (!pdf->xrefs[0].is_linear)
+      return;
+
+    /* Swap Linear with Version 1 */
+    buf = pdf->xrefs[0];
+    pdf->xrefs[0] = pdf->xrefs[1];
+    pdf->xrefs[1] = buf;
+
+    /* Resolve is_linear flag and version */
+    pdf->xrefs[0].is_linear = 1;
+    pdf->xrefs[0].version = 1;
+    pdf->xrefs[1].is_linear = 0;
+    pdf->xrefs[1].version = 1;
+
+    /* Adjust the other version values now */
+    for (i=2; i<pdf->n_xrefs; ++i)
+      --pdf->xrefs[i].version;
+}
+
+
+/* Append 'len' bytes of 'str' to the document's string pool.  Slices are 32
+ * bits, a string that would take the pool past them is left out (empty).
+ */
+static pdf_str_t strpool_add(pdf_t *pdf, const char *str, size_t len)
+{
+    pdf_str_t s;
+
+    if (len && (len >= UINT_MAX - pdf->strpool_len))
+    {
+        ERR("String pool is full, leaving out a %zu byte string.\n", len);
+        len = 0;
+    }
+
+    if (!len)
+    {
+        s.off = s.len = 0;
+        return s;
+    }
+
+    if (pdf->strpool_len + len + 1 > pdf->strpool_cap)
+    {
+        while (pdf->strpool_len + len + 1 > pdf->strpool_cap)
+          pdf->strpool_cap *= 2;
+        if (!(pdf->strpool = stats_realloc(pdf->strpool, pdf->strpool_cap)))
+        {
+            ERR("Failed to reallocate string pool.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    s.off = pdf->strpool_len;
+    s.len = len;
+    memcpy(pdf->strpool + s.off, str, len);
+    pdf->strpool[s.off + len] = '\0';
+    pdf->strpool_len += len + 1;
+    return s;
+}
+
+
+/* The standard (1.7 spec) entries are always reported, and in this order */
+static const char *creator_keys[] =
+{
+    "Title",
+    "Author",
+    "Subject",
+    "Keywords",
+    "Creator",
+    "Producer",
+    "CreationDate",
+    "ModDate",
+    "Trapped",
+};
+#define N_CREATOR_KEYS (sizeof(creator_keys) / sizeof(creator_keys[0]))
+
+
+static pdf_creator_t *new_creator(pdf_t *pdf, int *n_elements)
+{
+    int            i;
+    pdf_creator_t *daddy;
+    static const pdf_str_t empty;
+
+    daddy = safe_calloc(sizeof(pdf_creator_t) * N_CREATOR_KEYS);
+
+    /* Each document interns the standard key names only once */
+    for (i=0; i<pdf->n_xrefs; ++i)
+      if (pdf->xrefs[i].creator)
+      {
+          memcpy(daddy, pdf->xrefs[i].creator,
+                 sizeof(pdf_creator_t) * N_CREATOR_KEYS);
+          break;
+      }
+
+    for (i=0; i<N_CREATOR_KEYS; ++i)
+    {
+        if (!daddy[i].key.len)
+          daddy[i].key = strpool_add(pdf, creator_keys[i],
+                                     strlen(creator_keys[i]));
+        daddy[i].value = empty;
+    }
+
+    if (n_elements)
+      *n_elements = N_CREATOR_KEYS;
+
+    return daddy;
+}
+
+
+#define END_OF_TRAILER(_c) \
+{                          \
+    if (_c == '>')         \
+      return NULL;         \
+}
+void pdf_load_creator(FILE *fp, pdf_t *pdf)
+{
+    int i;
+
+    STATS_FOR(pdf);
+    for (i=0; i<pdf->n_xrefs; ++i)
+      pdf->xrefs[i].loaded &= ~PDF_LOAD_CREATOR;
+    load_creator(fp, pdf);
+    pdf->loaded |= PDF_LOAD_CREATOR;
+}
+
+
+/* Looks 'obj_id' up in the plaintext xref table of 'xref' without loading
+ * the table: subsections are skipped as a whole, their entries being 20 bytes
+ * each.  Returns 1 if found, 0 if the table has no such entry, or -1 if the
+ * table is not laid out that way (and has to be loaded after all).
+ */
+static int find_xref_entry(
+    FILE         *fp,
+    const xref_t *xref,
+    int           obj_id,
+    xref_entry_t *entry)
+{
+    int   c, i, ret, first, count;
+    long  start, pos;
+    char  line[64];
+
+    if (xref->is_stream)
+      return 0;
+
+    start = ftell(fp);
+    stats_fseek(fp, xref->start + strlen("xref"), SEEK_SET);
+    for (ret=-1; ; )
+    {
+        while (isspace(c = stats_fgetc(fp)))
+          ;
+        if (c == 't')
+        {
+            ret = 0; /* "trailer" */
+            break;
+        }
+        ungetc(c, fp);
+
+        /* Subsection header "<first id> <count>" */
+        if (!stats_fgets(line, sizeof(line), fp)           ||
+            (line[strlen(line) - 1] != '\n')               ||
+            (sscanf(line, "%d %d", &first, &count) != 2)   ||
+            (count < 0))
+          break;
+        pos = ftell(fp);
+
+        if ((obj_id >= first) && (obj_id - first < count))
+        {
+            /* "oooooooooo ggggg n" and a two byte end of line */
+            stats_fseek(fp, pos + (long)(obj_id - first) * 20, SEEK_SET);
+            if (stats_fread(line, 1, 20, fp) != 20)
+              break;
+            for (i=0; i<17 && (i == 10 || i == 16 || isdigit(line[i])); ++i)
+              ;
+            if ((i < 17) || (line[10] != ' ') || (line[16] != ' ') ||
+                ((line[17] != 'n') && (line[17] != 'f')))
+              break;
+
+            entry->obj_id = obj_id;
+            entry->offset = atol(line);
+            entry->gen_num = atoi(line + 11);
+            entry->f_or_n = line[17];
+            ret = 1;
+            break;
+        }
+
+        /* The subsection must end right where it is expected to */
+        if ((stats_fseek(fp, pos + (long)count * 20 - 1, SEEK_SET) != 0) ||
+            (((c = stats_fgetc(fp)) != '\n') && (c != '\r')))
+          break;
+    }
+
+    clearerr(fp);
+    stats_fseek(fp, start, SEEK_SET);
+    return ret;
+}
+
+
+/* Object 'obj_id' as listed in 'xref', whose entries are looked up directly
+ * if they have not been loaded.
+ */
+static char *get_xref_object(
+    FILE   *fp,
+    xref_t *xref,
+    int     obj_id,
+    size_t *size)
+{
+    one_xref_t    one;
+    xref_entry_t  entry;
+
+    if (!(xref->loaded & PDF_LOAD_ENTRIES))
+      switch (find_xref_entry(fp, xref, obj_id, &entry))
+      {
+          case 0:
+              if (size)
+                *size = 0;
+              return NULL;
+
+          case 1:
+              return get_object(fp, obj_id,
+                                one_xref(&one, obj_id, entry.offset), size,
+                                NULL);
+
+          default:
+              /* A table too broken to parse has no objects to offer */
+              if (load_xref_entries(fp, xref) != 0)
+                pdf_xref_free_entries(xref);
+              xref->loaded |= PDF_LOAD_ENTRIES;
+              break;
+      }
+
+    return get_object(fp, obj_id, xref, size, NULL);
+}
+
+
+/* The Info object that the trailer of the i'th xref refers to, NULL if there
+ * is none.
+ */
+static char *get_info(FILE *fp, pdf_t *pdf, int i, size_t *size)
+{
+    int   buf_idx;
+    char  c, *buf, obj_id_buf[32] = {0};
+
+    /* Find trailer */
+    stats_fseek(fp, pdf->xrefs[i].start, SEEK_SET);
+    while (SAFE_F(fp, (stats_fgetc(fp) != 't')))
+        ; /* Iterate to "trailer" */
+
+    /* Look for "<< ....... /Info ......" */
+    c = '\0';
+    while (SAFE_F(fp, ((c = stats_fgetc(fp)) != '>')))
+      if (SAFE_F(fp, ((c == '/') &&
+                      (stats_fgetc(fp) == 'I') && ((stats_fgetc(fp) == 'n')))))
+        break;
+
+    /* Could not find /Info in trailer */
+    END_OF_TRAILER(c);
+
+    while (SAFE_F(fp, (!isspace(c = stats_fgetc(fp)) && (c != '>'))))
+        ; /* Iterate to first white space /Info<space><data> */
+
+    /* No space between /Info and its data */
+    END_OF_TRAILER(c);
+
+    while (SAFE_F(fp, (isspace(c = stats_fgetc(fp)) && (c != '>'))))
+        ; /* Iterate right on top of first non-whitespace /Info data */
+
+    /* No data for /Info */
+    END_OF_TRAILER(c);
+
+    /* Get obj id as number */
+    buf_idx = 0;
+    obj_id_buf[buf_idx++] = c;
+    while ((buf_idx < (sizeof(obj_id_buf) - 1)) &&
+           SAFE_F(fp, (!isspace(c = stats_fgetc(fp)) && (c != '>'))))
+      obj_id_buf[buf_idx++] = c;
+
+    END_OF_TRAILER(c);
+
+    /* Get the object for the creator data.  If linear, try both xrefs */
+    buf = get_xref_object(fp, &pdf->xrefs[i], atoll(obj_id_buf), size);
+    if (!buf && pdf->xrefs[i].is_linear && (i+1 < pdf->n_xrefs))
+      buf = get_xref_object(fp, &pdf->xrefs[i+1], atoll(obj_id_buf), size);
+
+    return buf;
+}
+
+
+/* for_xrefs() callback, the linearized xref also looks into the next one and
+ * is left to load_creator() itself.
+ */
+static void get_info_at(FILE *fp, pdf_t *pdf, int i, void *arg)
+{
+    info_obj_t *info = (info_obj_t *)arg + i;
+
+    if (info->todo && !pdf->xrefs[i].is_linear)
+      info->buf = get_info(fp, pdf, i, &info->size);
+}
+
+
+/* Load creator data for the versions that do not have it yet.  The Info
+ * objects are looked up for all versions first (in parallel, see
+ * for_xrefs()), then parsed in order into the document's string pool.
+ */
+static void load_creator(FILE *fp, pdf_t *pdf)
+{
+    int         i;
+    long        start;
+    info_obj_t *infos;
+
+    if (!pdf->n_xrefs)
+      return;
+
+    PHASE_BEGIN(PDF_PHASE_LOAD_CREATOR);
+    start = ftell(fp);
+
+    infos = safe_calloc(sizeof(info_obj_t) * pdf->n_xrefs);
+    for (i=0; i<pdf->n_xrefs; ++i)
+    {
+        if (!pdf->xrefs[i].version ||
+            (pdf->xrefs[i].loaded & PDF_LOAD_CREATOR))
+          continue;
+        pdf->xrefs[i].loaded |= PDF_LOAD_CREATOR;
+        infos[i].todo = 1;
+
+        /* Versions redone after folding in the linearized xref */
+        free(pdf->xrefs[i].creator);
+        pdf->xrefs[i].creator = NULL;
+        pdf->xrefs[i].n_creator_entries = 0;
+    }
+
+    for_xrefs(fp, pdf, 0, get_info_at, infos);
+
+    for (i=0; i<pdf->n_xrefs; ++i)
+    {
+        if (!infos[i].todo)
+          continue;
+        if (pdf->xrefs[i].is_linear)
+          infos[i].buf = get_info(fp, pdf, i, &infos[i].size);
+        load_creator_from_buf(fp, pdf, &pdf->xrefs[i], infos[i].buf,
+                              infos[i].size);
+        free(infos[i].buf);
+    }
+
+    free(infos);
+    stats_fseek(fp, start, SEEK_SET);
+    PHASE_END(PDF_PHASE_LOAD_CREATOR);
+}
+
+
+static void load_creator_from_buf(
+    FILE       *fp,
+    pdf_t      *pdf,
+    xref_t     *xref,
+    const char *buf,
+    size_t      buf_size)
+{
+    int   is_xml;
+    char *c;
+
+    if (!buf)
+      return;
+
+    /* Check to see if this is xml or old-school */
+    if ((c = strstr(buf, "/Type")))
+      while (*c && !isspace(*c))
+        ++c;
+
+    /* Probably "Metadata" */
+    is_xml = 0;
+    if (c && (*c == 'M'))
+      is_xml = 1;
+
+    /* Is the buffer XML(PDF 1.4+) or old format? */
+    if (is_xml)
+      load_creator_from_xml(xref, buf);
+    else
+      load_creator_from_old_format(fp, pdf, xref, buf, buf_size);
+}
+
+
+static void load_creator_from_xml(xref_t *xref, const char *buf)
+{
+    /* TODO */
+}
+
+
+/* Returns a pointer just past the dictionary value starting at 'c'.
+ * Strings, hex strings, arrays and dictionaries are consumed as a whole,
+ * anything else (names, numbers, booleans) up to the next delimiter.  A
+ * stray delimiter is a value of its own, so that callers walking a
+ * dictionary always get past 'c'.
+ */
+static const char *get_value_end(const char *c, const char *end)
+{
+    int         depth, is_escaped;
+    const char *start;
+
+    if (c >= end)
+      return end;
+
+    if (*c == '(')
+    {
+        depth = is_escaped = 0;
+        for ( ; c < end; ++c)
+        {
+            if (is_escaped)
+              is_escaped = 0;
+            else if (*c == '\\')
+              is_escaped = 1;
+            else if (*c == '(')
+              ++depth;
+            else if ((*c == ')') && (--depth == 0))
+              return c + 1;
+        }
+        return end;
+    }
+    else if ((*c == '<') && ((c + 1 >= end) || (c[1] != '<')))
+    {
+        while ((c < end) && (*c != '>'))
+          ++c;
+        return (c < end) ? c + 1 : end;
+    }
+    else if ((*c == '<') || (*c == '['))
+    {
+        /* Nested dictionary or array, strings may contain brackets */
+        depth = 0;
+        while (c < end)
+        {
+            if ((*c == '(') ||
+                ((*c == '<') && ((c + 1 >= end) || (c[1] != '<'))))
+            {
+                c = get_value_end(c, end);
+                continue;
+            }
+            else if ((*c == '<') || (*c == '['))
+              ++depth;
+            else if ((*c == '>') || (*c == ']'))
+            {
+                --depth;
+                if ((*c == '>') && (c + 1 < end) && (c[1] == '>'))
+                  ++c;
+                if (depth == 0)
+                  return c + 1;
+            }
+
+            /* "<<" and ">>" are a single step */
+            if ((*c == '<') && (c + 1 < end) && (c[1] == '<'))
+              ++c;
+            ++c;
+        }
+        return end;
+    }
+
+    /* Names keep their leading '/' */
+    start = c;
+    if (*c == '/')
+      ++c;
+    while ((c < end) && !isspace(*c) && !strchr("/()<>[]{}%", *c))
+      ++c;
+    return (c > start) ? c : start + 1;
+}
+
+
+/* Returns 'obj_id' if 'c' is an indirect reference "<obj_id> <gen> R" */
+static int get_reference(const char *c, const char *end)
+{
+    int obj_id;
+
+    if ((c >= end) || !isdigit(*c))
+      return 0;
+
+    obj_id = atoi(c);
+    while ((c < end) && isdigit(*c))
+      ++c;
+    if ((c >= end) || !isspace(*c))
+      return 0;
+    while ((c < end) && isspace(*c))
+      ++c;
+    if ((c >= end) || !isdigit(*c))
+      return 0;
+    while ((c < end) && isdigit(*c))
+      ++c;
+    while ((c < end) && isspace(*c))
+      ++c;
+
+    return ((c < end) && (*c == 'R')) ? obj_id : 0;
+}
+
+
+/* Walk the Info dictionary in 'buf' once, storing every key and its value.
+ * The standard keys land in their fixed slots, anything else is appended.
+ */
+static void load_creator_from_old_format(
+    FILE       *fp,
+    pdf_t      *pdf,
+    xref_t     *xref,
+    const char *buf,
+    size_t      buf_size)
+{
+    int            i, n_eles, n_alloc, obj_id;
+    char          *utf8, *obj;
+    const char    *c, *end, *key, *val, *val_end, *obj_end;
+    size_t         key_len, obj_size, utf8_size;
+    pdf_creator_t *info;
+
+    if (buf_size < 1)
+      return;
+
+    /* Mark the end of buf, so that we do not crawl past it */
+    end = buf + buf_size;
+    if (!(c = strstr(buf, "<<")) || (c >= end))
+      return;
+    c += 2;
+
+    info = new_creator(pdf, &n_eles);
+    n_alloc = n_eles;
+
+    while (c < end)
+    {
+        while ((c < end) && isspace(*c))
+          ++c;
+        if ((c >= end) || (*c == '>'))
+          break;
+
+        /* Not a key, step over whatever it is */
+        if (*c != '/')
+        {
+            val_end = get_value_end(c, end);
+            c = (val_end > c) ? val_end : c + 1;
+            continue;
+        }
+
+        key = ++c;
+        while ((c < end) && !isspace(*c) && !strchr("/()<>[]{}%", *c))
+          ++c;
+        key_len = c - key;
+        while ((c < end) && isspace(*c))
+          ++c;
+
+        /* If the value is an indirect reference, the data is located in
+         * an object we need to fetch, and not inline
+         */
+        obj = NULL;
+        val = c;
+        if ((obj_id = get_reference(c, end)))
+        {
+            while ((c < end) && (*c != 'R'))
+              ++c;
+            val_end = ++c;
+
+            if ((obj = get_xref_object(fp, xref, obj_id, &obj_size)))
+            {
+                /* Skip the "<obj_id> <gen> obj" header */
+                obj_end = obj + obj_size;
+                if ((val = strstr(obj, "obj")) && (val < obj_end))
+                  val += strlen("obj");
+                else
+                  val = obj_end;
+                while ((val < obj_end) && isspace(*val))
+                  ++val;
+                val_end = get_value_end(val, obj_end);
+            }
+            else
+              val = val_end;
+        }
+        else
+          c = val_end = get_value_end(c, end);
+
+        if (!key_len)
+        {
+            free(obj);
+            continue;
+        }
+
+        /* Locate the slot for this key */
+        for (i=0; i<N_CREATOR_KEYS; ++i)
+          if ((strlen(creator_keys[i]) == key_len) &&
+              (strncmp(creator_keys[i], key, key_len) == 0))
+            break;
+
+        if (i == N_CREATOR_KEYS)
+        {
+            if (n_eles == n_alloc)
+            {
+                n_alloc *= 2;
+                info = stats_realloc(info, sizeof(pdf_creator_t) * n_alloc);
+                if (!info)
+                {
+                    ERR("Failed to reallocate creator data.\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            i = n_eles++;
+            info[i].key = strpool_add(pdf, key, key_len);
+        }
+
+        /* Decode to UTF-8, at most three output bytes per input byte */
+        utf8_size = (val_end - val) * 3 + 1;
+        utf8 = safe_calloc(utf8_size);
+        info[i].value = strpool_add(
+            pdf, utf8, pdf_decode_text_string(val, val_end - val,
+                                              utf8, utf8_size));
+        free(utf8);
+
+        /* Release memory from get_object() called earlier */
+        free(obj);
+    } /* For all creation information tags */
+
+    xref->creator = info;
+    xref->n_creator_entries = n_eles;
+}
+
+
+/* An xref of a single in use entry, for get_object() */
+static const xref_t *one_xref(one_xref_t *one, int obj_id, long offset)
+{
+    memset(one, 0, sizeof(one_xref_t));
+    one->obj_id = obj_id;
+    one->offset = offset;
+    one->in_use = 1;
+    one->xref.n_entries = one->xref.n_alloc_entries = 1;
+    one->xref.obj_ids = &one->obj_id;
+    one->xref.offsets = &one->offset;
+    one->xref.in_use = &one->in_use;
+    return &one->xref;
+}
+
+
+/* Returns object data at the start of the file pointer
+ * This interfaces to 'get_object'
+ */
+static char *get_object_from_here(FILE *fp, size_t *size, int *is_stream)
+{
+    long       start;
+    char       buf[256];
+    int        obj_id;
+    one_xref_t one;
+
+    start = ftell(fp);
+
+    /* Object ID, a small object can be cut short by the end of the file */
+    memset(buf, 0, 256);
+    if (!stats_fread(buf, 1, 255, fp) || !(obj_id = atoi(buf)))
+    {
+        clearerr(fp);
+        stats_fseek(fp, start, SEEK_SET);
+        return NULL;
+    }
+
+    /* Xref and single entry for the object we want data from */
+    stats_fseek(fp, start, SEEK_SET);
+    return get_object(fp, obj_id, one_xref(&one, obj_id, start), size,
+                      is_stream);
+}
+
+
+static char *read_object(
+    FILE         *fp,
+    int           obj_id,
+    const xref_t *xref,
+    size_t       *size,
+    int          *is_stream);
+
+
+static char *get_object(
+    FILE         *fp,
+    int           obj_id,
+    const xref_t *xref,
+    size_t       *size,
+    int          *is_stream)
+{
+    char *obj;
+
+    PHASE_BEGIN(PDF_PHASE_GET_OBJECT);
+    if ((obj = read_object(fp, obj_id, xref, size, is_stream)))
+      ++STATS->objects_fetched;
+    PHASE_END(PDF_PHASE_GET_OBJECT);
+
+    return obj;
+}
+
+
+static char *read_object(
+    FILE         *fp,
+    int           obj_id,
+    const xref_t *xref,
+    size_t       *size,
+    int          *is_stream)
+{
+    static const int    blk_sz = 256;
+    int                 i, total_sz, read_sz, n_blks, search, stream;
+    size_t              obj_sz;
+    char               *c, *data;
+    long                start;
+
+    if (size)
+      *size = 0;
+
+    if (is_stream)
+      *is_stream = 0;
+
+    start = ftell(fp);
+
+    /* Find object */
+    if ((i = pdf_xref_find(xref, obj_id)) == -1)
+      return NULL;
+
+    /* Jump to object start */
+    stats_fseek(fp, xref->offsets[i], SEEK_SET);
+
+    /* Initial allocation */
+    obj_sz = 0;    /* Bytes in object */
+    total_sz = 0;  /* Bytes read in   */
+    n_blks = 1;
+    data = safe_calloc(blk_sz * n_blks);
+
+    /* Suck in data */
+    stream = 0;
+    while ((read_sz = stats_fread(data+total_sz, 1, blk_sz-1, fp)) &&
+           !ferror(fp))
+    {
+        total_sz += read_sz;
+
+        *(data + total_sz) = '\0';
+
+        if ((total_sz + blk_sz >= (blk_sz * n_blks)) &&
+            !budget_alloc((size_t)blk_sz * (n_blks + 1)))
+          break;
+        if (total_sz + blk_sz >= (blk_sz * n_blks))
+          data = stats_realloc(data, blk_sz * (++n_blks));
+        if (!data) {
+          ERR("Failed to reallocate buffer.\n");
+          exit(EXIT_FAILURE);
+        }
+
+        search = total_sz - read_sz;
+        if (search < 0)
+          search = 0;
+
+        if ((c = strstr(data + search, "endobj")))
+        {
+            *(c + strlen("endobj") + 1) = '\0';
+            obj_sz = (char *)strstr(data + search, "endobj") - (char *)data;
+            obj_sz += strlen("endobj") + 1;
+            break;
+        }
+        else if (strstr(data, "stream"))
+          stream = 1;
+    }
+
+    clearerr(fp);
+    stats_fseek(fp, start, SEEK_SET);
+
+    if (size) {
+      *size = obj_sz;
+      if (!obj_sz && data) {
+        free(data);
+        data = NULL;
+      }
+    }
+
+    if (is_stream)
+      *is_stream = stream;
+
+    return data;
+}
+
+
+static const char *classify_object(FILE *fp, int obj_id, const xref_t *xref);
+
+
+static const char *get_type(FILE *fp, int obj_id, const xref_t *xref)
+{
+    const char *type;
+
+    PHASE_BEGIN(PDF_PHASE_GET_TYPE);
+    type = classify_object(fp, obj_id, xref);
+    PHASE_END(PDF_PHASE_GET_TYPE);
+
+    return type;
+}
+
+
+static const char *classify_object(FILE *fp, int obj_id, const xref_t *xref)
+{
+    int          is_stream;
+    char        *c, *obj, *endobj;
+    static __thread char buf[32];
+    long         start;
+
+    start = ftell(fp);
+
+    if (!(obj = get_object(fp, obj_id, xref, NULL, &is_stream)) ||
+        is_stream                                               ||
+        !(endobj = strstr(obj, "endobj")))
+    {
+        free(obj);
+        stats_fseek(fp, start, SEEK_SET);
+
+        if (is_stream)
+          return "Stream";
+        else
+          return "Unknown";
+    }
+
+    /* Get the Type value (avoiding font names like Type1) */
+    c = obj;
+    while ((c = strstr(c, "/Type")) && (c < endobj))
+      if (isdigit(*(c + strlen("/Type"))))
+      {
+          ++c;
+          continue;
+      }
+      else
+        break;
+
+    if (!c || (c && (c > endobj)))
+    {
+        free(obj);
+        stats_fseek(fp, start, SEEK_SET);
+        return "Unknown";
+    }
+
+    /* Skip to first blank/whitespace */
+    c += strlen("/Type");
+    while (isspace(*c) || *c == '/')
+      ++c;
+
+    /* 'c' should be pointing to the type name.  Find the end of the name. */
+    size_t n_chars = 0;
+    const char *name_itr = c;
+    while ((name_itr < endobj) &&
+           !(isspace(*name_itr) || *name_itr == '/' || *name_itr == '>')) {
+        ++name_itr;
+        ++n_chars;
+    }
+    if (n_chars >= sizeof(buf))
+    {
+        free(obj);
+        stats_fseek(fp, start, SEEK_SET);
+        return "Unknown";
+    }
+
+    /* Return the value by storing it in static mem. */
+    memcpy(buf, c, n_chars);
+    buf[n_chars] = '\0';
+    free(obj);
+    stats_fseek(fp, start, SEEK_SET);
+    return buf;
+}
+
+
+/*
+ * Page attribution
+ *
+ * The page tree of a version (/Root -> /Pages -> /Kids) is walked once, and
+ * every object reachable from a page, other than the page tree itself, is
+ * attributed to the first page that refers to it.  Shared resources thus land
+ * on the first page using them.
+ *
+ * Each version is a fresh walk, but the subtree below a tree node is replayed
+ * from a memo when none of the objects it looked at moved since, absent ones
+ * included, and the walk so far left each of them marked as the walk that made
+ * the memo found it.  The memo is keyed by the offset of the node, a node that
+ * is rewritten lands elsewhere.
+ *
+ * Objects are kept in slots, one per distinct id of the document in ascending
+ * order: ids are as large as the document says, up to INT_MAX.
+ */
+
+typedef struct _page_log_t
+{
+    int           slot;
+    int           page;   /* Relative to the memo's first page, 0 if none */
+    long          offset; /* Where the object was when it was looked at */
+    unsigned char found;  /* Its 'seen' when the walk looked at it */
+    unsigned char seen;   /* and right after */
+} page_log_t;
+
+
+typedef struct _page_memo_t
+{
+    long        offset;
+    int         n_pages;
+    int         n_log;
+    page_log_t *log;
+} page_memo_t;
+
+
+struct _page_map_t
+{
+    int            version;   /* Version the map describes, 0 if none yet */
+    int            next_xref; /* Next xref to fold into 'live'             */
+    int            root;      /* Slot of the catalog of 'version', or -1   */
+    int            n_ids;
+    int           *ids;       /* Id of each slot, ascending                */
+    long          *live;      /* Offset of each object, 0 if there is none */
+    int           *page_of;   /* First page that refers to each object     */
+    unsigned char *seen;
+    int            n_pages;
+
+    /* Everything touched by the walk so far, memos are slices of it */
+    page_log_t    *log;
+    int            n_log;
+    int            log_cap;
+
+    /* Open addressed by offset */
+    page_memo_t   *memos;
+    int            n_memos;
+    int            memo_cap;
+};
+
+
+/* Deep enough for any sane page tree or resource chain */
+#define PAGE_MAX_DEPTH 64
+
+
+static int cmp_obj_id(const void *a, const void *b)
+{
+    const int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+
+static page_map_t *new_page_map(const pdf_t *pdf)
+{
+    int         i, j, n;
+    page_map_t *map;
+
+    map = safe_calloc(sizeof(page_map_t));
+    for (i=0, n=0; i<pdf->n_xrefs; ++i)
+      for (j=0; j<pdf->xrefs[i].n_entries; ++j)
+        if (pdf->xrefs[i].obj_ids[j] > 0)
+          ++n;
+
+    /* Over budget, the map is empty and no page is found */
+    if (!budget_alloc((sizeof(int) * 2 + sizeof(long) + 1) * (size_t)n))
+      n = 0;
+
+    /* The distinct ids, object 0 is never a page or part of one */
+    map->ids = safe_calloc(sizeof(int) * (n + 1));
+    for (i=0, n=0; i<pdf->n_xrefs; ++i)
+      for (j=0; j<pdf->xrefs[i].n_entries; ++j)
+        if (pdf->xrefs[i].obj_ids[j] > 0)
+          map->ids[n++] = pdf->xrefs[i].obj_ids[j];
+    qsort(map->ids, n, sizeof(int), cmp_obj_id);
+    for (i=0, map->n_ids=0; i<n; ++i)
+      if (!map->n_ids || (map->ids[map->n_ids - 1] != map->ids[i]))
+        map->ids[map->n_ids++] = map->ids[i];
+
+    map->live = safe_calloc(sizeof(long) * (map->n_ids + 1));
+    map->page_of = safe_calloc(sizeof(int) * (map->n_ids + 1));
+    map->seen = safe_calloc(map->n_ids + 1);
+    map->root = -1;
+    map->memo_cap = 64;
+    map->memos = safe_calloc(sizeof(page_memo_t) * map->memo_cap);
+    return map;
+}
+
+
+static void delete_page_map(page_map_t *map)
+{
+    int i;
+
+    if (!map)
+      return;
+
+    for (i=0; i<map->memo_cap; ++i)
+      free(map->memos[i].log);
+    free(map->memos);
+    free(map->log);
+    free(map->seen);
+    free(map->page_of);
+    free(map->live);
+    free(map->ids);
+    free(map);
+}
+
+
+/* Slot of 'obj_id', -1 if the document has no such object */
+static int page_slot(const page_map_t *map, int obj_id)
+{
+    const int *id;
+
+    if ((obj_id <= 0) || !map->n_ids)
+      return -1;
+    id = bsearch(&obj_id, map->ids, map->n_ids, sizeof(int), cmp_obj_id);
+    return id ? (int)(id - map->ids) : -1;
+}
+
+
+static page_memo_t *find_memo(page_map_t *map, long offset)
+{
+    unsigned long h;
+
+    h = (unsigned long)offset * 0x9e3779b97f4a7c15ULL;
+    for (h&=map->memo_cap-1; map->memos[h].offset; h=(h+1)&(map->memo_cap-1))
+      if (map->memos[h].offset == offset)
+        return &map->memos[h];
+
+    return &map->memos[h];
+}
+
+
+static void add_memo(
+    page_map_t *map,
+    long        offset,
+    int         first_page,
+    int         log_start)
+{
+    int          i;
+    page_memo_t *memo, *old;
+
+    /* Keep the table at most half full */
+    if ((map->n_memos + 1) * 2 > map->memo_cap)
+    {
+        old = map->memos;
+        map->memo_cap *= 2;
+        map->memos = safe_calloc(sizeof(page_memo_t) * map->memo_cap);
+        for (i=0; i<map->memo_cap/2; ++i)
+          if (old[i].offset)
+            *find_memo(map, old[i].offset) = old[i];
+        free(old);
+    }
+
+    memo = find_memo(map, offset);
+    if (memo->offset)
+      free(memo->log);
+    else
+      ++map->n_memos;
+
+    memo->offset = offset;
+    memo->n_pages = map->n_pages - first_page;
+    memo->n_log = map->n_log - log_start;
+    memo->log = safe_calloc(sizeof(page_log_t) * (memo->n_log + 1));
+    memcpy(memo->log, map->log + log_start, sizeof(page_log_t) * memo->n_log);
+    for (i=0; i<memo->n_log; ++i)
+      if (memo->log[i].page)
+        memo->log[i].page -= first_page;
+}
+
+
+/* Attribute the object in 'slot' to 'page' (if it has none yet) and log it,
+ * 'found' is what its 'seen' was when the walk looked at it.
+ */
+static void log_page(page_map_t *map, int slot, int page, int found)
+{
+    if (page && (!map->page_of[slot] || (page < map->page_of[slot])))
+      map->page_of[slot] = page;
+
+    if (map->n_log == map->log_cap)
+    {
+        map->log_cap = map->log_cap ? map->log_cap * 2 : 256;
+        if (!(map->log = stats_realloc(map->log,
+                                       sizeof(page_log_t) * map->log_cap)))
+        {
+            ERR("Failed to reallocate page data.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    map->log[map->n_log].slot = slot;
+    map->log[map->n_log].page = page;
+    map->log[map->n_log].offset = map->live[slot];
+    map->log[map->n_log].found = found;
+    map->log[map->n_log].seen = map->seen[slot];
+    ++map->n_log;
+}
+
+
+/* Returns the value of the object at 'offset' (the dictionary, not the stream
+ * data, of a stream).  The result is NUL terminated.  If 'val_end' is not NULL
+ * it receives the file offset just past the value.
+ */
+static char *get_object_value(
+    FILE   *fp,
+    long    offset,
+    size_t *size,
+    long   *val_end)
+{
+    size_t      sz, n;
+    char       *buf, *val;
+    const char *c, *end;
+
+    *size = 0;
+    val = NULL;
+    PHASE_BEGIN(PDF_PHASE_GET_OBJECT);
+    for (sz=1024; ; sz*=4)
+    {
+        buf = safe_calloc(sz + 1);
+        stats_fseek(fp, offset, SEEK_SET);
+        n = stats_fread(buf, 1, sz, fp);
+        clearerr(fp);
+        end = buf + n;
+
+        /* "<obj_id> <gen> obj <value>" */
+        for (c=buf; (c < end - 3) && strncmp(c, "obj", 3); ++c)
+          ;
+        c += 3;
+        while ((c < end) && isspace(*c))
+          ++c;
+
+        /* Retry with more data if the value runs past what was read */
+        if ((c < end) && (((end = get_value_end(c, end)) < buf + n) ||
+                          (n < sz)))
+        {
+            *size = end - c;
+            val = safe_calloc(*size + 1);
+            memcpy(val, c, *size);
+            if (val_end)
+              *val_end = offset + (end - buf);
+            ++STATS->objects_fetched;
+        }
+        free(buf);
+
+        if (val || (n < sz) || (sz >= 1024 * 1024))
+          break;
+    }
+    PHASE_END(PDF_PHASE_GET_OBJECT);
+
+    return val;
+}
+
+
+/* Returns the value of the top level 'key' in the dictionary 'dict' */
+static const char *get_dict_value(
+    const char  *dict,
+    size_t       size,
+    const char  *key,
+    const char **val_end)
+{
+    size_t      key_len;
+    const char *c, *k, *end;
+
+    end = dict + size;
+    key_len = strlen(key);
+    if ((size < 2) || strncmp(dict, "<<", 2))
+      return NULL;
+
+    for (c=dict+2; c<end; )
+    {
+        if (*c != '/')
+        {
+            c = (isspace(*c) || (*c == '>')) ? c + 1 : get_value_end(c, end);
+            continue;
+        }
+
+        k = c;
+        c = get_value_end(c, end);
+        while ((c < end) && isspace(*c))
+          ++c;
+        if (((size_t)(c - k) >= key_len) && (strncmp(k, key, key_len) == 0) &&
+            ((k + key_len == c) || isspace(k[key_len])))
+        {
+            *val_end = get_reference(c, end) ?
+                (const char *)memchr(c, 'R', end - c) + 1 :
+                get_value_end(c, end);
+            return c;
+        }
+
+        if (get_reference(c, end))
+          c = (const char *)memchr(c, 'R', end - c) + 1;
+        else
+          c = get_value_end(c, end);
+    }
+
+    return NULL;
+}
+
+
+/* Returns 1 for /Page, 2 for /Pages and 0 otherwise */
+static int get_page_node_type(const char *dict, size_t size)
+{
+    const char *type, *end;
+
+    if (!(type = get_dict_value(dict, size, "/Type", &end)))
+      return 0;
+    if ((end - type == 5) && (strncmp(type, "/Page", 5) == 0))
+      return 1;
+    if ((end - type == 6) && (strncmp(type, "/Pages", 6) == 0))
+      return 2;
+    return 0;
+}
+
+
+static void walk_resources(
+    FILE       *fp,
+    page_map_t *map,
+    const char *val,
+    size_t      size,
+    int         page,
+    int         depth);
+
+
+/* Attribute 'obj_id', and what it refers to, to 'page' */
+static void walk_resource(
+    FILE       *fp,
+    page_map_t *map,
+    int         obj_id,
+    int         page,
+    int         depth)
+{
+    int     k;
+    char   *val;
+    size_t  size;
+
+    if ((k = page_slot(map, obj_id)) == -1)
+      return;
+
+    /* Shared, it already has the first page that refers to it.  What is not
+     * walked is logged all the same, the memos depend on it.
+     */
+    if (!map->live[k] || map->seen[k])
     {
-        dst_name = safe_calloc(strlen(name) * 2 + 16);
-        sprintf(dst_name, "%s/%s", name, name);
+        log_page(map, k, (map->seen[k] == 1) ? page : 0, map->seen[k]);
+        return;
+    }
 
-        if ((c = strrchr(dst_name, '.')) && (strncmp(c, ".pdf", 4) == 0))
-          *c = '\0';
+    /* Links to other pages are not resources of this one */
+    val = get_object_value(fp, map->live[k], &size, NULL);
+    if (!val || get_page_node_type(val, size))
+    {
+        log_page(map, k, 0, 0);
+        free(val);
+        return;
+    }
 
-        strcat(dst_name, ".summary");
-        if (!(dst = fopen(dst_name, "w")))
+    map->seen[k] = 1;
+    log_page(map, k, page, 0);
+    walk_resources(fp, map, val, size, page, depth + 1);
+    free(val);
+}
+
+
+/* Follow every indirect reference in 'val' */
+static void walk_resources(
+    FILE       *fp,
+    page_map_t *map,
+    const char *val,
+    size_t      size,
+    int         page,
+    int         depth)
+{
+    int         obj_id;
+    const char *c, *end;
+
+    if (depth > PAGE_MAX_DEPTH)
+      return;
+
+    end = val + size;
+    for (c=val; c<end; )
+    {
+        if ((*c == '<') && (c + 1 < end) && (c[1] == '<'))
+          c += 2;
+        else if ((*c == '(') || (*c == '<'))
+          c = get_value_end(c, end);
+        else if (isdigit(*c) && ((c == val) || !isalnum(c[-1])) &&
+                 (obj_id = get_reference(c, end)))
         {
-            ERR("Could not open file '%s' for writing\n", dst_name);
-            return;
+            c = (const char *)memchr(c, 'R', end - c) + 1;
+            walk_resource(fp, map, obj_id, page, depth);
         }
+        else if ((c + 7 <= end) && (strncmp(c, "/Parent", 7) == 0))
+        {
+            /* The way back up the page tree */
+            c = get_value_end(c, end);
+            while ((c < end) && isspace(*c))
+              ++c;
+            if (get_reference(c, end))
+              c = (const char *)memchr(c, 'R', end - c) + 1;
+        }
+        else
+          ++c;
     }
+}
 
-    /* Send output to file or stdout */
-    out = (dst) ? dst : stdout;
 
-    /* Count versions */
-    n_versions = pdf->n_xrefs;
-    if (n_versions && pdf->xrefs[0].is_linear)
-      --n_versions;
+/* Replay 'memo' from 'first_page' on, if the objects it covers are where they
+ * were and marked as the walk that made it found them.  Returns 0, with the map
+ * left as it was, if they are not.
+ */
+static int replay_memo(page_map_t *map, const page_memo_t *memo, int first_page)
+{
+    int               i, ok;
+    const page_log_t *l;
 
-    /* Ignore bad xref entry */
-    for (i=1; i<pdf->n_xrefs; ++i)
-      if (pdf->xrefs[i].end == 0)
-        --n_versions;
+    /* Check the entries in order, marking the objects as the walk did */
+    for (i=0; i<memo->n_log; ++i)
+    {
+        l = &memo->log[i];
+        if ((map->live[l->slot] != l->offset) ||
+            (map->seen[l->slot] != l->found))
+          break;
+        map->seen[l->slot] = l->seen;
+    }
+    ok = (i == memo->n_log);
+    while (i--)
+      map->seen[memo->log[i].slot] = memo->log[i].found;
+    if (!ok)
+      return 0;
 
-    /* If we have no valid versions but linear, count that */
-    if (!pdf->n_xrefs || (!n_versions && pdf->xrefs[0].is_linear))
-      n_versions = 1;
+    for (i=0; i<memo->n_log; ++i)
+    {
+        l = &memo->log[i];
+        map->seen[l->slot] = l->seen;
+        log_page(map, l->slot, l->page ? first_page + l->page : 0, l->found);
+    }
+    map->n_pages += memo->n_pages;
+    return 1;
+}
 
-    /* Compare each object (if we don't have xref streams) */
-    n_entries = 0;
-    for (i=0; !(const int)pdf->has_xref_streams && i<pdf->n_xrefs; i++)
+
+/* Walk the page tree node 'obj_id', numbering its pages in order */
+static void walk_page_tree(FILE *fp, page_map_t *map, int obj_id, int depth)
+{
+    int          k, type, kid, first_page, log_start;
+    long         offset;
+    char        *val, *kids;
+    size_t       size, kids_size;
+    const char  *c, *end;
+    page_memo_t *memo;
+
+    if (((k = page_slot(map, obj_id)) == -1) || (depth > PAGE_MAX_DEPTH) ||
+        over_budget())
+      return;
+
+    /* Gone, or walked already, logged all the same for the memos */
+    if (!(offset = map->live[k]) || map->seen[k])
+    {
+        log_page(map, k, 0, map->seen[k]);
+        return;
+    }
+
+    first_page = map->n_pages;
+    log_start = map->n_log;
+
+    /* Unchanged since it was last walked, replay it */
+    memo = find_memo(map, offset);
+    if (memo->offset && replay_memo(map, memo, first_page))
+    {
+        ++STATS->cache_hits;
+        return;
+    }
+
+    if (!(val = get_object_value(fp, offset, &size, NULL)))
+    {
+        log_page(map, k, 0, 0);
+        return;
+    }
+
+    map->seen[k] = 2;
+    log_page(map, k, 0, 0);
+    type = get_page_node_type(val, size);
+    kids = NULL;
+    if ((type != 1) && (c = get_dict_value(val, size, "/Kids", &end)))
+    {
+        /* Kids array, possibly an indirect one */
+        if ((kid = page_slot(map, get_reference(c, end))) != -1 &&
+            map->live[kid])
+        {
+            kids = get_object_value(fp, map->live[kid], &kids_size, NULL);
+            log_page(map, kid, 0, map->seen[kid]);
+        }
+        else
+        {
+            kids_size = end - c;
+            kids = safe_calloc(kids_size + 1);
+            memcpy(kids, c, kids_size);
+        }
+    }
+
+    if (kids)
+    {
+        end = kids + kids_size;
+        for (c=kids; c<end; ++c)
+          if (isdigit(*c) && ((c == kids) || !isdigit(c[-1])) &&
+              (kid = get_reference(c, end)))
+          {
+              walk_page_tree(fp, map, kid, depth + 1);
+              c = memchr(c, 'R', end - c);
+          }
+        free(kids);
+    }
+    else if (type != 2)
+    {
+        /* A leaf, even if its /Type is missing */
+        ++map->n_pages;
+        log_page(map, k, map->n_pages, 2);
+        walk_resources(fp, map, val, size, map->n_pages, depth);
+    }
+
+    free(val);
+    add_memo(map, offset, first_page, log_start);
+}
+
+
+/* Bring 'map' to the version of xref 'xref_idx' and walk its page tree */
+static void load_page_map(
+    FILE        *fp,
+    const pdf_t *pdf,
+    page_map_t  *map,
+    int          xref_idx)
+{
+    int                 i, j, k, root, version;
+    char               *trailer, *catalog;
+    size_t              size;
+    const char         *c, *end;
+    const xref_t       *xref;
+
+    version = pdf->xrefs[xref_idx].version;
+
+    /* Fold in the xrefs that make up this version, keeping its catalog */
+    for (i=map->next_xref; i<pdf->n_xrefs; ++i)
     {
-        if (flags & PDF_FLAG_QUIET)
+        if (pdf->xrefs[i].version > version)
+          break;
+        if (!pdf->xrefs[i].version)
           continue;
 
-        for (j=0; j<pdf->xrefs[i].n_entries; j++)
+        xref = &pdf->xrefs[i];
+        for (j=0; j<xref->n_entries; ++j)
+          if ((k = page_slot(map, xref->obj_ids[j])) != -1)
+            map->live[k] = XREF_IN_USE(xref, j) ? xref->offsets[j] : 0;
+
+        if ((trailer = get_trailer(fp, &pdf->xrefs[i], &size)))
         {
-            ++n_entries;
-            fprintf(out,
-                    "%s: --%c-- Version %d -- Object %d (%s)",
-                    pdf->name,
-                    pdf_get_object_status(pdf, i, j),
-                    pdf->xrefs[i].version,
-                    pdf->xrefs[i].entries[j].obj_id,
-                    get_type(fp, pdf->xrefs[i].entries[j].obj_id,
-                             &pdf->xrefs[i]));
-
-            /* TODO
-            page = get_page(pdf->xrefs[i].entries[j].obj_id, &pdf->xrefs[i]);
-            */
-
-            if (0 /*page*/)
-              fprintf(out, " Page(%d)\n", page);
-            else
-              fprintf(out, "\n");
+            if ((c = get_dict_value(trailer, size, "/Root", &end)) &&
+                ((k = page_slot(map, get_reference(c, end))) != -1))
+              map->root = k;
+            free(trailer);
         }
     }
+    map->next_xref = i;
+    map->version = version;
 
-    /* Trailing summary */
-    if (!(flags & PDF_FLAG_QUIET))
+    /* Fresh walk, objects untouched since the last version replay from memos */
+    memset(map->page_of, 0, sizeof(int) * (map->n_ids + 1));
+    memset(map->seen, 0, map->n_ids + 1);
+    map->n_pages = map->n_log = 0;
+
+    if ((map->root == -1) || !map->live[map->root] ||
+        !(catalog = get_object_value(fp, map->live[map->root], &size, NULL)))
+      return;
+
+    if ((c = get_dict_value(catalog, size, "/Pages", &end)) &&
+        (root = get_reference(c, end)))
+      walk_page_tree(fp, map, root, 0);
+    free(catalog);
+}
+
+
+/* Returns the first page that refers to 'obj_id' in the version of xref
+ * 'xref_idx', or 0 if it is not part of a page.
+ */
+static int get_page(
+    FILE        *fp,
+    const pdf_t *pdf,
+    page_map_t  *map,
+    int          xref_idx,
+    int          obj_id)
+{
+    int  k;
+    long start;
+
+    if (((k = page_slot(map, obj_id)) == -1) || !pdf->xrefs[xref_idx].version)
+      return 0;
+
+    if (map->version != pdf->xrefs[xref_idx].version)
     {
-        /* Let the user know that we cannot we print a per-object summary.
-         * If we have a 1.5 PDF using streams for xref, we have not objects
-         * to display, so let the user know whats up.
-         */
-        if (pdf->has_xref_streams || !n_entries)
-           fprintf(out,
-               "%s: This PDF contains potential cross reference streams.\n"
-               "%s: An object summary is not available.\n",
-               pdf->name,
-               pdf->name);
+        PHASE_BEGIN(PDF_PHASE_GET_PAGE);
+        start = ftell(fp);
+        load_page_map(fp, pdf, map, xref_idx);
+        stats_fseek(fp, start, SEEK_SET);
+        PHASE_END(PDF_PHASE_GET_PAGE);
+    }
 
-        fprintf(out,
-                "---------- %s ----------\n"
-                "Versions: %d\n",
-                pdf->name,
-                n_versions);
+    return map->page_of[k];
+}
+
+
+/* Returns NULL if there is not even room for "%PDF-M.m" */
+static char *get_header(FILE *fp)
+{
+    /* First 1024 bytes of doc must be header (1.7 spec pg 1102) */
+    char *header = safe_calloc(1024);
+    long start = ftell(fp);
+    stats_fseek(fp, 0, SEEK_SET);
+
+    /* Small documents might not even have 1024 bytes */
+    if ((stats_fread(header, 1, 1023, fp) < strlen("%PDF-M.m")) || ferror(fp))
+    {
+        ERR("Failed to load PDF header.\n");
+        free(header);
+        header = NULL;
+    }
+
+    stats_fseek(fp, start, SEEK_SET);
+    return header;
+}
+
+
+/*
+ * Text string decoding (PDF 1.7 spec section 7.9.2)
+ *
+ * A text string is first decoded from its literal "(...)" or hex "<...>"
+ * syntax into raw bytes, and those bytes are then interpreted as UTF-16BE
+ * (FE FF mark), UTF-16LE (FF FE mark), UTF-8 (EF BB BF mark) or
+ * PDFDocEncoding, and re-encoded as UTF-8.
+ *
+ * Long runs are handled eight bytes at a time (SWAR), so we get most of the
+ * benefit of SIMD without tying the tool to an instruction set.
+ */
+
+#define SWAR_ONES  0x0101010101010101ULL
+#define SWAR_HIGHS 0x8080808080808080ULL
+
+/* High bit of each byte set where that byte >= _n (bytes must be < 0x80) */
+#define SWAR_GE(_x, _n) (((_x) + SWAR_ONES * (0x80 - (_n))) & SWAR_HIGHS)
+
+/* Non-zero if any byte in _x equals _b */
+#define SWAR_HAS(_x, _b) \
+    ((((_x) ^ (SWAR_ONES * (_b))) - SWAR_ONES) & \
+     ~((_x) ^ (SWAR_ONES * (_b))) & SWAR_HIGHS)
+
+
+static uint64_t load_le64(const unsigned char *c)
+{
+    return  (uint64_t)c[0]        | ((uint64_t)c[1] << 8)  |
+           ((uint64_t)c[2] << 16) | ((uint64_t)c[3] << 24) |
+           ((uint64_t)c[4] << 32) | ((uint64_t)c[5] << 40) |
+           ((uint64_t)c[6] << 48) | ((uint64_t)c[7] << 56);
+}
 
-        /* Count entries for summary */
-        if (!pdf->has_xref_streams)
-          for (i=0; i<pdf->n_xrefs; i++)
-          {
-              if (pdf->xrefs[i].is_linear)
-                continue;
 
-              n_entries = pdf->xrefs[i].n_entries;
+/* Hex digit values, 0 for non-digits as well as '0' (see IS_HEX()) */
+static const signed char hex_values[256] =
+{
+    ['0'] = 0,  ['1'] = 1,  ['2'] = 2,  ['3'] = 3,  ['4'] = 4,
+    ['5'] = 5,  ['6'] = 6,  ['7'] = 7,  ['8'] = 8,  ['9'] = 9,
+    ['a'] = 10, ['b'] = 11, ['c'] = 12, ['d'] = 13, ['e'] = 14, ['f'] = 15,
+    ['A'] = 10, ['B'] = 11, ['C'] = 12, ['D'] = 13, ['E'] = 14, ['F'] = 15,
+};
+#define IS_HEX(_c) (hex_values[(unsigned char)(_c)] || ((_c) == '0'))
+
+
+/* Literal string escapes: "\n" et al.  Zero means "not an escape" */
+static const char escape_values[256] =
+{
+    ['n'] = '\n', ['r'] = '\r', ['t'] = '\t', ['b'] = '\b', ['f'] = '\f',
+    ['('] = '(',  [')'] = ')',  ['\\'] = '\\',
+};
+
+
+/* PDFDocEncoding to Unicode (Annex D.2).  Undefined codes map to U+FFFD. */
+static const uint16_t pdfdoc_to_unicode[256] =
+{
+    0x0000, 0x0001, 0x0002, 0x0003, 0x0004, 0x0005, 0x0006, 0x0007,
+    0x0008, 0x0009, 0x000A, 0x000B, 0x000C, 0x000D, 0x000E, 0x000F,
+    0x0010, 0x0011, 0x0012, 0x0013, 0x0014, 0x0015, 0x0016, 0x0017,
+    0x02D8, 0x02C7, 0x02C6, 0x02D9, 0x02DD, 0x02DB, 0x02DA, 0x02DC,
+    0x0020, 0x0021, 0x0022, 0x0023, 0x0024, 0x0025, 0x0026, 0x0027,
+    0x0028, 0x0029, 0x002A, 0x002B, 0x002C, 0x002D, 0x002E, 0x002F,
+    0x0030, 0x0031, 0x0032, 0x0033, 0x0034, 0x0035, 0x0036, 0x0037,
+    0x0038, 0x0039, 0x003A, 0x003B, 0x003C, 0x003D, 0x003E, 0x003F,
+    0x0040, 0x0041, 0x0042, 0x0043, 0x0044, 0x0045, 0x0046, 0x0047,
+    0x0048, 0x0049, 0x004A, 0x004B, 0x004C, 0x004D, 0x004E, 0x004F,
+    0x0050, 0x0051, 0x0052, 0x0053, 0x0054, 0x0055, 0x0056, 0x0057,
+    0x0058, 0x0059, 0x005A, 0x005B, 0x005C, 0x005D, 0x005E, 0x005F,
+    0x0060, 0x0061, 0x0062, 0x0063, 0x0064, 0x0065, 0x0066, 0x0067,
+    0x0068, 0x0069, 0x006A, 0x006B, 0x006C, 0x006D, 0x006E, 0x006F,
+    0x0070, 0x0071, 0x0072, 0x0073, 0x0074, 0x0075, 0x0076, 0x0077,
+    0x0078, 0x0079, 0x007A, 0x007B, 0x007C, 0x007D, 0x007E, 0xFFFD,
+    0x2022, 0x2020, 0x2021, 0x2026, 0x2014, 0x2013, 0x0192, 0x2044,
+    0x2039, 0x203A, 0x2212, 0x2030, 0x201E, 0x201C, 0x201D, 0x2018,
+    0x2019, 0x201A, 0x2122, 0xFB01, 0xFB02, 0x0141, 0x0152, 0x0160,
+    0x0178, 0x017D, 0x0131, 0x0142, 0x0153, 0x0161, 0x017E, 0xFFFD,
+    0x20AC, 0x00A1, 0x00A2, 0x00A3, 0x00A4, 0x00A5, 0x00A6, 0x00A7,
+    0x00A8, 0x00A9, 0x00AA, 0x00AB, 0x00AC, 0xFFFD, 0x00AE, 0x00AF,
+    0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+    0x00B8, 0x00B9, 0x00BA, 0x00BB, 0x00BC, 0x00BD, 0x00BE, 0x00BF,
+    0x00C0, 0x00C1, 0x00C2, 0x00C3, 0x00C4, 0x00C5, 0x00C6, 0x00C7,
+    0x00C8, 0x00C9, 0x00CA, 0x00CB, 0x00CC, 0x00CD, 0x00CE, 0x00CF,
+    0x00D0, 0x00D1, 0x00D2, 0x00D3, 0x00D4, 0x00D5, 0x00D6, 0x00D7,
+    0x00D8, 0x00D9, 0x00DA, 0x00DB, 0x00DC, 0x00DD, 0x00DE, 0x00DF,
+    0x00E0, 0x00E1, 0x00E2, 0x00E3, 0x00E4, 0x00E5, 0x00E6, 0x00E7,
+    0x00E8, 0x00E9, 0x00EA, 0x00EB, 0x00EC, 0x00ED, 0x00EE, 0x00EF,
+    0x00F0, 0x00F1, 0x00F2, 0x00F3, 0x00F4, 0x00F5, 0x00F6, 0x00F7,
+    0x00F8, 0x00F9, 0x00FA, 0x00FB, 0x00FC, 0x00FD, 0x00FE, 0x00FF,
+};
+
+
+/* Decode the body of a literal string (parens stripped) into raw bytes */
+static size_t decode_literal(const char *str, size_t len, unsigned char *raw)
+{
+    int                  n_digits, val;
+    size_t               i, n_raw;
+    uint64_t             x;
+    const unsigned char *c = (const unsigned char *)str;
+
+    for (i=n_raw=0; i<len; )
+    {
+        /* Copy runs without escapes or carriage returns in bulk */
+        while (i + 8 <= len)
+        {
+            x = load_le64(c + i);
+            if (SWAR_HAS(x, '\\') || SWAR_HAS(x, '\r'))
+              break;
+            memcpy(raw + n_raw, c + i, 8);
+            n_raw += 8;
+            i += 8;
+        }
+        if (i >= len)
+          break;
+
+        if (c[i] == '\r')
+        {
+            /* An unescaped end-of-line is always read as a line feed */
+            raw[n_raw++] = '\n';
+            if ((++i < len) && (c[i] == '\n'))
+              ++i;
+            continue;
+        }
+        else if (c[i] != '\\')
+        {
+            raw[n_raw++] = c[i++];
+            continue;
+        }
 
-              /* If we are a linearized PDF, all versions are made from those
-               * objects too.  So count em'
-               */
-              if (pdf->xrefs[0].is_linear)
-                n_entries += pdf->xrefs[0].n_entries;
+        /* Escape sequence */
+        if (++i >= len)
+          break;
 
-              if (pdf->xrefs[i].version && n_entries)
-                fprintf(out,
-                        "Version %d -- %d objects\n",
-                        pdf->xrefs[i].version,
-                        n_entries);
-           }
+        if (escape_values[c[i]])
+          raw[n_raw++] = escape_values[c[i++]];
+        else if ((c[i] >= '0') && (c[i] <= '7'))
+        {
+            /* \ddd: one to three octal digits, high-order overflow ignored */
+            for (val=n_digits=0;
+                 (n_digits < 3) && (i < len) && (c[i] >= '0') && (c[i] <= '7');
+                 ++n_digits, ++i)
+              val = (val << 3) | (c[i] - '0');
+            raw[n_raw++] = val & 0xFF;
+        }
+        else if (c[i] == '\r')
+        {
+            /* Line continuation */
+            if ((++i < len) && (c[i] == '\n'))
+              ++i;
+        }
+        else if (c[i] == '\n')
+          ++i;
+        else
+          raw[n_raw++] = c[i++]; /* Unknown escape: drop the backslash */
     }
-    else /* Quiet output */
-      fprintf(out, "%s: %d\n", pdf->name, n_versions);
 
-    if (dst)
+    return n_raw;
+}
+
+
+/* Decode the body of a hex string (brackets stripped) into raw bytes */
+static size_t decode_hex(const char *str, size_t len, unsigned char *raw)
+{
+    int                  hi;
+    size_t               i, n_raw;
+    uint64_t             x, t, digit, alpha, nib;
+    const unsigned char *c = (const unsigned char *)str;
+
+    hi = -1;
+    for (i=n_raw=0; i<len; )
     {
-        fclose(dst);
-        free(dst_name);
+        /* Eight hex digits at a time into four bytes */
+        while ((hi < 0) && (i + 8 <= len))
+        {
+            x = load_le64(c + i);
+            if (x & SWAR_HIGHS)
+              break;
+
+            /* Digits are checked as they are, folding 0x10-0x19 to lower case
+             * would make them '0'-'9'.  Only 'A'-'F' fold into 'a'-'f'.
+             */
+            t = x | (SWAR_ONES * 0x20);
+            digit = SWAR_GE(x, '0') & ~SWAR_GE(x, '9' + 1);
+            alpha = SWAR_GE(t, 'a') & ~SWAR_GE(t, 'f' + 1);
+            if ((digit | alpha) != SWAR_HIGHS)
+              break;
+
+            /* Nibble values, then pair them up in 16 bit lanes */
+            nib = (x & (SWAR_ONES * 0x0F)) + (alpha >> 7) * 9;
+            nib = ((nib & 0x000F000F000F000FULL) << 4) |
+                  ((nib & 0x0F000F000F000F00ULL) >> 8);
+            raw[n_raw++] = nib & 0xFF;
+            raw[n_raw++] = (nib >> 16) & 0xFF;
+            raw[n_raw++] = (nib >> 32) & 0xFF;
+            raw[n_raw++] = (nib >> 48) & 0xFF;
+            i += 8;
+        }
+        if (i >= len)
+          break;
+
+        /* White space is ignored, so is anything else that is not hex */
+        if (IS_HEX(c[i]))
+        {
+            if (hi < 0)
+              hi = hex_values[c[i]];
+            else
+            {
+                raw[n_raw++] = (hi << 4) | hex_values[c[i]];
+                hi = -1;
+            }
+        }
+        ++i;
     }
+
+    /* A missing final digit is assumed to be 0 */
+    if (hi >= 0)
+      raw[n_raw++] = hi << 4;
+
+    return n_raw;
 }
 
 
-/* Returns '1' if we successfully display data (means its probably not xml) */
-int pdf_display_creator(const pdf_t *pdf, int xref_idx)
+/* Store 'cp' as UTF-8 if it fits. Returns the number of bytes it needs. */
+static size_t put_utf8(uint32_t cp, char *out, size_t avail)
 {
-    int i;
+    size_t n;
 
-    if (!pdf->xrefs[xref_idx].creator)
-      return 0;
+    n = (cp < 0x80) ? 1 : (cp < 0x800) ? 2 : (cp < 0x10000) ? 3 : 4;
+    if (n > avail)
+      return n;
 
-    for (i=0; i<pdf->xrefs[xref_idx].n_creator_entries; ++i)
-      printf("%s: %s\n",
-             pdf->xrefs[xref_idx].creator[i].key,
-             pdf->xrefs[xref_idx].creator[i].value);
+    switch (n)
+    {
+        case 1:
+            out[0] = cp;
+            break;
+        case 2:
+            out[0] = 0xC0 | (cp >> 6);
+            out[1] = 0x80 | (cp & 0x3F);
+            break;
+        case 3:
+            out[0] = 0xE0 | (cp >> 12);
+            out[1] = 0x80 | ((cp >> 6) & 0x3F);
+            out[2] = 0x80 | (cp & 0x3F);
+            break;
+        default:
+            out[0] = 0xF0 | (cp >> 18);
+            out[1] = 0x80 | ((cp >> 12) & 0x3F);
+            out[2] = 0x80 | ((cp >> 6) & 0x3F);
+            out[3] = 0x80 | (cp & 0x3F);
+            break;
+    }
 
-    return (i > 0);
+    return n;
 }
 
 
-/* Checks if the xref is valid and sets 'is_stream' flag if the xref is a
- * stream (PDF 1.5 or higher)
- */
-static int is_valid_xref(FILE *fp, pdf_t *pdf, xref_t *xref)
+size_t pdf_decode_text_string(
+    const char *str,
+    size_t      str_len,
+    char       *out,
+    size_t      out_size)
 {
-    int   is_valid;
-    long  start;
-    char *c, buf[16];
+    int            is_be;
+    size_t         i, n, n_raw, n_out, avail;
+    uint32_t       cp, lo;
+    uint64_t       x;
+    unsigned char *raw, stack_raw[256];
 
-    memset(buf, 0, sizeof(buf));
-    is_valid = 0;
-    start = ftell(fp);
-    fseek(fp, xref->start, SEEK_SET);
+    if (!out || !out_size)
+      return 0;
+
+    /* Leave room for the nul */
+    avail = out_size - 1;
+    out[0] = '\0';
+    if (!str || !str_len)
+      return 0;
 
-    if (fgets(buf, 16, fp) == NULL) {
-      ERR("Failed to load xref string.");
-      exit(EXIT_FAILURE);
+    /* Not a string (e.g. a name or a number): pass it along as-is */
+    if ((str[0] != '(') && (str[0] != '<'))
+    {
+        n_out = (str_len < avail) ? str_len : avail;
+        memcpy(out, str, n_out);
+        out[n_out] = '\0';
+        return n_out;
     }
 
-    if (strncmp(buf, "xref", strlen("xref")) == 0)
-      is_valid = 1;
+    raw = (str_len <= sizeof(stack_raw)) ? stack_raw : safe_calloc(str_len);
+
+    /* Strip the delimiters, a truncated string is still decoded */
+    n = str_len - 1;
+    if ((n > 0) && (str[str_len - 1] == ((str[0] == '(') ? ')' : '>')))
+      --n;
+    if (str[0] == '(')
+      n_raw = decode_literal(str + 1, n, raw);
     else
+      n_raw = decode_hex(str + 1, n, raw);
+
+    n_out = 0;
+    if ((n_raw >= 2) &&
+        (((raw[0] == 0xFE) && (raw[1] == 0xFF)) ||
+         ((raw[0] == 0xFF) && (raw[1] == 0xFE))))
     {
-        /* PDFv1.5+ allows for xref data to be stored in streams vs plaintext */
-        fseek(fp, xref->start, SEEK_SET);
-        c = get_object_from_here(fp, NULL, &xref->is_stream);
+        /* UTF-16, joining surrogate pairs */
+        is_be = (raw[0] == 0xFE);
+        for (i=2; i+1<n_raw; i+=2)
+        {
+            cp = is_be ? ((raw[i] << 8) | raw[i+1]) : ((raw[i+1] << 8) | raw[i]);
+            if ((cp >= 0xD800) && (cp < 0xDC00) && (i + 3 < n_raw))
+            {
+                lo = is_be ? ((raw[i+2] << 8) | raw[i+3])
+                           : ((raw[i+3] << 8) | raw[i+2]);
+                if ((lo >= 0xDC00) && (lo < 0xE000))
+                {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                    i += 2;
+                }
+                else
+                  cp = 0xFFFD;
+            }
+            else if ((cp >= 0xD800) && (cp < 0xE000))
+              cp = 0xFFFD;
 
-        if (c && xref->is_stream)
+            if ((n = put_utf8(cp, out + n_out, avail - n_out)) >
+                avail - n_out)
+              break;
+            n_out += n;
+        }
+    }
+    else if ((n_raw >= 3) &&
+             (raw[0] == 0xEF) && (raw[1] == 0xBB) && (raw[2] == 0xBF))
+    {
+        /* UTF-8 (PDF 2.0) */
+        n_out = ((n_raw - 3) < avail) ? n_raw - 3 : avail;
+        memcpy(out, raw + 3, n_out);
+    }
+    else
+    {
+        /* PDFDocEncoding, printable ASCII runs are copied in bulk */
+        for (i=0; i<n_raw; )
         {
-            pdf->has_xref_streams = 1;
-            is_valid = 1;
+            while ((i + 8 <= n_raw) && (n_out + 8 <= avail))
+            {
+                x = load_le64(raw + i);
+                if ((x & SWAR_HIGHS) ||
+                    (SWAR_GE(x, 0x20) != SWAR_HIGHS) || SWAR_GE(x, 0x7F))
+                  break;
+                memcpy(out + n_out, raw + i, 8);
+                n_out += 8;
+                i += 8;
+            }
+            if (i >= n_raw)
+              break;
+
+            if ((n = put_utf8(pdfdoc_to_unicode[raw[i]], out + n_out,
+                              avail - n_out)) > avail - n_out)
+              break;
+            n_out += n;
+            ++i;
         }
-        free(c);
     }
 
-    fseek(fp, start, SEEK_SET);
-    return is_valid;
+    out[n_out] = '\0';
+    if (raw != stack_raw)
+      free(raw);
+
+    return n_out;
 }
 
 
-static void load_xref_entries(FILE *fp, xref_t *xref)
+/* Append the offset of every "%%EOF" in 'blk', which holds 'blk_size' bytes of
+ * the document starting at offset 'pos', to the 'n_eofs' in 'eofs' ('eof_cap'
+ * allocated).  Blocks must be fed in order, 'match' carries a partial marker
+ * from one block to the next and must start out as 0.  A marker is only ever
+ * found by its own 5 bytes, whatever precedes them.
+ */
+static void index_eofs(
+    long      **eofs,
+    int        *n_eofs,
+    int        *eof_cap,
+    const char *blk,
+    size_t      blk_size,
+    long        pos,
+    int        *match)
 {
-    if (xref->is_stream)
-      load_xref_from_stream(fp, xref);
-    else
-      load_xref_from_plaintext(fp, xref);
+    static const char  eof[] = "%%EOF";
+    const char        *c, *end;
+
+    c = blk;
+    end = blk + blk_size;
+    while (c < end)
+    {
+        /* Skip ahead to the next candidate */
+        if (*match == 0 && !(c = memchr(c, '%', end - c)))
+          return;
+
+        if (*c == eof[*match])
+          ++*match;
+        else if (*c == '%')
+          *match = (*match == 2) ? 2 : 1; /* "%%%EOF" */
+        else
+          *match = 0;
+        ++c;
+
+        if (*match == sizeof(eof) - 1)
+        {
+            if (*n_eofs == *eof_cap)
+            {
+                *eof_cap = *eof_cap ? *eof_cap * 2 : 16;
+                if (!(*eofs = stats_realloc(*eofs, sizeof(long) * *eof_cap)))
+                {
+                    ERR("Failed to reallocate the %%%%EOF index.\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            (*eofs)[(*n_eofs)++] = pos + (c - blk) - (sizeof(eof) - 1);
+            *match = 0;
+        }
+    }
 }
 
 
-static void load_xref_from_plaintext(FILE *fp, xref_t *xref)
+/* Build the %%EOF index with one forward pass over 'fp'.  If 'from' is not
+ * zero, the markers before it are already indexed and only the rest of the
+ * file is scanned.
+ */
+static void scan_eofs(FILE *fp, pdf_t *pdf, long from)
 {
-    int  i, obj_id, added_entries;
-    char c, buf[32] = {0};
-    long start, pos;
-    size_t buf_idx;
+    int     match;
+    long    start, pos;
+    char   *blk;
+    size_t  n;
 
+    PHASE_BEGIN(PDF_PHASE_SCAN_EOFS);
     start = ftell(fp);
 
-    /* Get number of entries */
-    pos = xref->end;
-    fseek(fp, pos, SEEK_SET);
-    while (ftell(fp) != 0)
-      if (SAFE_F(fp, (fgetc(fp) == '/' && fgetc(fp) == 'S')))
-        break;
-      else
-        SAFE_E(fseek(fp, --pos, SEEK_SET), 0, "Failed seek to xref /Size.\n");
+    if (!from || !pdf->eofs)
+    {
+        free(pdf->eofs);
+        pdf->eofs = safe_calloc(sizeof(long) * 16);
+        pdf->eof_cap = 16;
+        pdf->n_eofs = 0;
+        from = 0;
+    }
 
-    SAFE_E(fread(buf, 1, 21, fp), 21, "Failed to load entry Size string.\n");
-    xref->n_entries = atoi(buf + strlen("ize "));
-    xref->entries = safe_calloc(xref->n_entries * sizeof(struct _xref_entry));
+    /* Back up enough to catch a marker that straddles 'from' */
+    pos = (from > 4) ? from - 4 : 0;
+    ADVISE(fp, pos, 0, SEQUENTIAL);
+    if (scan_eofs_parallel(fp, pdf, pos))
+    {
+        PHASE_END(PDF_PHASE_SCAN_EOFS);
+        return;
+    }
 
-    /* Load entry data */
-    obj_id = 0;
-    fseek(fp, xref->start + strlen("xref"), SEEK_SET);
-    added_entries = 0;
-    for (i=0; i<xref->n_entries; i++)
+    stats_fseek(fp, pos, SEEK_SET);
+    blk = safe_calloc(SCAN_BLOCK_SIZE);
+    match = 0;
+    while ((n = stats_fread(blk, 1, SCAN_BLOCK_SIZE, fp)) > 0)
     {
-        /* Advance past newlines. */
-        c = fgetc(fp);
-        while (c == '\n' || c == '\r')
-          c = fgetc(fp);
+        index_eofs(&pdf->eofs, &pdf->n_eofs, &pdf->eof_cap, blk, n, pos,
+                   &match);
+        pos += n;
+    }
 
-        if (ferror(fp) || feof(fp))
-          break;
+    clearerr(fp);
+    stats_fseek(fp, start, SEEK_SET);
+    free(blk);
+    PHASE_END(PDF_PHASE_SCAN_EOFS);
+}
 
-        /* Collect data up until the following newline. */
-        buf_idx = 0;
-        while (c != '\n' && c != '\r' && !feof(fp) &&
-               !ferror(fp) && buf_idx < sizeof(buf))
-        {
-            buf[buf_idx++] = c;
-            c = fgetc(fp);
-        }
-        if (buf_idx >= sizeof(buf)) {
-            FAIL("Failed to locate newline character. "
-                 "This might be a corrupt PDF.\n");
-        }
-        buf[buf_idx] = '\0';
 
-        /* Went to far and hit start of trailer */
-        if (strchr(buf, 't'))
-          break;
+/* Worker of scan_eofs_parallel(), scans chunks until none are left.  Each
+ * chunk is read 4 bytes into the next one, so that a marker straddling the
+ * boundary is found by the chunk it starts in, and only by that one.
+ */
+static void *scan_chunks(void *arg)
+{
+    int          i, match;
+    long         pos, end;
+    char        *blk;
+    ssize_t      n;
+    eof_chunk_t *chunk;
+    eof_scan_t  *scan = arg;
+
+    blk = safe_calloc(SCAN_BLOCK_SIZE);
+    while ((i = atomic_fetch_add(&scan->next_chunk, 1)) < scan->n_chunks)
+    {
+        chunk = &scan->chunks[i];
+        end = chunk->end + strlen("%%EOF") - 1;
+        if (end > scan->size)
+          end = scan->size;
 
-        /* Entry or object id */
-        if (strlen(buf) > 17)
+        match = 0;
+        for (pos=chunk->start; pos<end; pos+=n)
         {
-            const char *token = NULL;
-            xref->entries[i].obj_id = obj_id++;
-            token = strtok(buf, " ");
-            if (!token) {
-              FAIL("Failed to parse xref entry. "
-                   "This might be a corrupt PDF.\n");
-            }
-            xref->entries[i].offset = atol(token);
-            token = strtok(NULL, " ");
-            if (!token) {
-              FAIL("Failed to parse xref entry. "
-                   "This might be a corrupt PDF.\n");
+            if (scan->deadline_ns && (atomic_load(&scan->is_late) ||
+                                      (now_ns() > scan->deadline_ns)))
+            {
+                atomic_store(&scan->is_late, 1);
+                break;
             }
-            xref->entries[i].gen_num = atoi(token);
-            xref->entries[i].f_or_n = buf[17];
-            ++added_entries;
-        }
-        else
-        {
-            obj_id = atoi(buf);
-            --i;
+            n = (end - pos < SCAN_BLOCK_SIZE) ? end - pos : SCAN_BLOCK_SIZE;
+            if ((n = pread(scan->fd, blk, n, pos)) <= 0)
+              break;
+            chunk->n_read += n;
+            index_eofs(&chunk->eofs, &chunk->n_eofs, &chunk->eof_cap,
+                       blk, n, pos, &match);
         }
     }
 
-    xref->n_entries = added_entries;
-    fseek(fp, start, SEEK_SET);
+    free(blk);
+    return NULL;
 }
 
 
-/* Load an xref table from a stream (PDF v1.5 +) */
-static void load_xref_from_stream(FILE *fp, xref_t *xref)
+/* Scan 'fp' from offset 'from' on with up to pdf_t 'scan_threads' threads,
+ * appending the markers found to the index in file order.  Returns 0, having
+ * done nothing, if the document is too small to be worth splitting (or is not
+ * a file).
+ */
+static int scan_eofs_parallel(FILE *fp, pdf_t *pdf, long from)
 {
-    long    start;
-    int     is_stream;
-    char   *stream;
-    size_t  size;
+    int          i, j, n, n_threads;
+    pthread_t   *threads;
+    struct stat  st;
+    eof_scan_t   scan;
 
-    start = ftell(fp);
-    fseek(fp, xref->start, SEEK_SET);
+    /* A byte budget that the scan would exceed is left to the single pass,
+     * which stops right where it runs out.
+     */
+    if ((pdf->scan_threads < 2) || (fileno(fp) < 0) ||
+        (fstat(fileno(fp), &st) != 0) ||
+        (st.st_size - from < 2 * SCAN_CHUNK_SIZE) ||
+        (pdf->budget.max_bytes &&
+         (STATS->bytes_read + st.st_size - from > pdf->budget.max_bytes)))
+      return 0;
+
+    memset(&scan, 0, sizeof(scan));
+    scan.fd = fileno(fp);
+    scan.size = st.st_size;
+    scan.deadline_ns = cur_budget.deadline_ns;
+    atomic_init(&scan.is_late, 0);
+    scan.n_chunks = (scan.size - from + SCAN_CHUNK_SIZE - 1) / SCAN_CHUNK_SIZE;
+    scan.chunks = safe_calloc(sizeof(eof_chunk_t) * scan.n_chunks);
+    for (i=0; i<scan.n_chunks; ++i)
+    {
+        scan.chunks[i].start = from + (long)i * SCAN_CHUNK_SIZE;
+        scan.chunks[i].end = scan.chunks[i].start + SCAN_CHUNK_SIZE;
+    }
+    scan.chunks[scan.n_chunks - 1].end = scan.size;
+    atomic_init(&scan.next_chunk, 0);
+
+    /* This thread takes chunks too, and all of them if none could start */
+    n_threads = (pdf->scan_threads < scan.n_chunks) ?
+        pdf->scan_threads : scan.n_chunks;
+    threads = safe_calloc(sizeof(pthread_t) * n_threads);
+    for (i=1; i<n_threads; ++i)
+      if (pthread_create(&threads[i], NULL, scan_chunks, &scan) != 0)
+        break;
+    scan_chunks(&scan);
+    for (j=1; j<i; ++j)
+      pthread_join(threads[j], NULL);
+    free(threads);
+
+    /* Chunks are in file order, and so are the markers within each */
+    for (i=0, n=pdf->n_eofs; i<scan.n_chunks; ++i)
+      n += scan.chunks[i].n_eofs;
+    if (n > pdf->eof_cap)
+    {
+        pdf->eof_cap = n;
+        if (!(pdf->eofs = stats_realloc(pdf->eofs,
+                                        sizeof(long) * pdf->eof_cap)))
+        {
+            ERR("Failed to reallocate the %%%%EOF index.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (i=0; i<scan.n_chunks; ++i)
+    {
+        if (scan.chunks[i].n_eofs)
+          memcpy(pdf->eofs + pdf->n_eofs, scan.chunks[i].eofs,
+                 sizeof(long) * scan.chunks[i].n_eofs);
+        pdf->n_eofs += scan.chunks[i].n_eofs;
+        STATS->bytes_read += scan.chunks[i].n_read;
+        free(scan.chunks[i].eofs);
+    }
 
-    stream = NULL;
-    stream = get_object_from_here(fp, &size, &is_stream);
-    fseek(fp, start, SEEK_SET);
+    if (atomic_load(&scan.is_late) && !pdf->over_budget)
+      pdf->over_budget = PDF_BUDGET_TIME;
 
-    /* TODO: decode and analyze stream */
-    free(stream);
-    return;
+    free(scan.chunks);
+    return 1;
 }
 
 
-static void get_xref_linear_skipped(FILE *fp, xref_t *xref)
+FILE *pdf_spool(FILE *in, pdf_t *pdf)
 {
-    int  err;
-    char ch, buf[256];
-
-    if (xref->start != 0)
-      return;
-
-    /* Special case (Linearized PDF with initial startxref at 0) */
-    xref->is_linear = 1;
-
-    /* Seek to %%EOF */
-    if ((xref->end = get_next_eof(fp)) < 0)
-      return;
+    int     match;
+    long    pos;
+    char   *blk;
+    size_t  n;
+    FILE   *spool;
+
+    STATS_FOR(pdf);
+    if (!(spool = tmpfile()))
+    {
+        ERR("Could not create a temporary file to spool the input.\n");
+        return NULL;
+    }
 
-    /* Locate the trailer */
-    err = 0;
-    while (!(err = ferror(fp)) && fread(buf, 1, 8, fp))
+    /* Copy and index in the same pass, only one block is ever in memory */
+    blk = safe_calloc(SCAN_BLOCK_SIZE);
+    free(pdf->eofs);
+    pdf->eofs = safe_calloc(sizeof(long) * 16);
+    pdf->eof_cap = 16;
+    pdf->n_eofs = 0;
+    pos = 0;
+    match = 0;
+    PHASE_BEGIN(PDF_PHASE_SCAN_EOFS);
+    while (!over_budget() &&
+           ((n = stats_fread(blk, 1, SCAN_BLOCK_SIZE, in)) > 0))
     {
-        if (strncmp(buf, "trailer", strlen("trailer")) == 0)
+        index_eofs(&pdf->eofs, &pdf->n_eofs, &pdf->eof_cap, blk, n, pos,
+                   &match);
+        if (fwrite(blk, 1, n, spool) != n)
           break;
-        else if ((ftell(fp) - 9) < 0)
-          return;
+        pos += n;
+    }
 
-        fseek(fp, -9, SEEK_CUR);
+    PHASE_END(PDF_PHASE_SCAN_EOFS);
+    free(blk);
+    if (ferror(in) || ferror(spool))
+    {
+        ERR("Failed to spool the input.\n");
+        fclose(spool);
+        return NULL;
     }
 
-    if (err)
-      return;
+    rewind(spool);
+    return spool;
+}
 
-    /* If we found 'trailer' look backwards for 'xref' */
-    ch = 0;
-    while (SAFE_F(fp, ((ch = fgetc(fp)) != 'x')))
-      if (fseek(fp, -2, SEEK_CUR) == -1)
-        FAIL("Failed to locate an xref.  This might be a corrupt PDF.\n");
 
-    if (ch == 'x')
+/* Return the offset to the beginning of the first %%EOF string at or after
+ * 'pos'.  A negative value is returned if there is none.
+ */
+static long get_next_eof(const pdf_t *pdf, long pos)
+{
+    int lo, hi, mid;
+
+    lo = 0;
+    hi = pdf->n_eofs;
+    while (lo < hi)
     {
-        xref->start = ftell(fp) - 1;
-        fseek(fp, -1, SEEK_CUR);
+        mid = lo + (hi - lo) / 2;
+        if (pdf->eofs[mid] < pos)
+          lo = mid + 1;
+        else
+          hi = mid;
     }
 
-    /* Now continue to next eof ... */
-    fseek(fp, xref->start, SEEK_SET);
+    return (lo < pdf->n_eofs) ? pdf->eofs[lo] : -1;
 }
 
 
-/* This must only be called after all xref and entries have been acquired */
-static void resolve_linearized_pdf(pdf_t *pdf)
+/* Return where the revision of the i'th xref ends: its %%EOF, or the end of a
+ * document that has none.
+ */
+static long get_revision_end(const pdf_t *pdf, int i)
 {
-    int    i;
-    xref_t buf;
-
-    if (pdf->n_xrefs < 2)
-      return;
+    return (i < pdf->n_eofs) ? pdf->eofs[i] : pdf->eofless_size;
+}
 
-    if (!pdf->xrefs[0].is_linear)
-      return;
 
-    /* Swap Linear with Version 1 */
-    buf = pdf->xrefs[0];
-    pdf->xrefs[0] = pdf->xrefs[1];
-    pdf->xrefs[1] = buf;
+/*
+ * Object hashing
+ *
+ * XXH64, fed incrementally so that an object of any size is hashed straight
+ * from the read blocks.  The four lanes are independent, which lets the
+ * compiler keep them in flight together.
+ */
 
-    /* Resolve is_linear flag and version */
-    pdf->xrefs[0].is_linear = 1;
-    pdf->xrefs[0].version = 1;
-    pdf->xrefs[1].is_linear = 0;
-    pdf->xrefs[1].version = 1;
+#define HASH_P1 0x9E3779B185EBCA87ULL
+#define HASH_P2 0xC2B2AE3D27D4EB4FULL
+#define HASH_P3 0x165667B19E3779F9ULL
+#define HASH_P4 0x85EBCA77C2B2AE63ULL
+#define HASH_P5 0x27D4EB2F165667C5ULL
 
-    /* Adjust the other version values now */
-    for (i=2; i<pdf->n_xrefs; ++i)
-      --pdf->xrefs[i].version;
-}
+#define ROTL64(_x, _r) (((_x) << (_r)) | ((_x) >> (64 - (_r))))
 
 
-static pdf_creator_t *new_creator(int *n_elements)
+typedef struct _hash_state_t
 {
-    pdf_creator_t *daddy;
+    uint64_t      v[4];
+    uint64_t      total;
+    unsigned char buf[32];
+    size_t        buf_len;
+} hash_state_t;
 
-    static const pdf_creator_t creator_template[] =
-    {
-        {"Title",        ""},
-        {"Author",       ""},
-        {"Subject",      ""},
-        {"Keywords",     ""},
-        {"Creator",      ""},
-        {"Producer",     ""},
-        {"CreationDate", ""},
-        {"ModDate",      ""},
-        {"Trapped",      ""},
-    };
 
-    daddy = safe_calloc(sizeof(creator_template));
-    memcpy(daddy, creator_template, sizeof(creator_template));
+static uint64_t hash_round(uint64_t acc, uint64_t lane)
+{
+    acc += lane * HASH_P2;
+    acc = ROTL64(acc, 31);
+    return acc * HASH_P1;
+}
 
-    if (n_elements)
-      *n_elements = sizeof(creator_template) / sizeof(creator_template[0]);
 
-    return daddy;
+static uint64_t hash_merge(uint64_t h, uint64_t v)
+{
+    h ^= hash_round(0, v);
+    return h * HASH_P1 + HASH_P4;
 }
 
 
-#define END_OF_TRAILER(_c, _st, _fp) \
-{                                    \
-    if (_c == '>')                   \
-    {                                \
-        fseek(_fp, _st, SEEK_SET);   \
-        continue;                    \
-    }                                \
+static void hash_init(hash_state_t *st)
+{
+    memset(st, 0, sizeof(hash_state_t));
+    st->v[0] = HASH_P1 + HASH_P2;
+    st->v[1] = HASH_P2;
+    st->v[3] = -HASH_P1;
 }
-static void load_creator(FILE *fp, pdf_t *pdf)
+
+
+static void hash_update(hash_state_t *st, const unsigned char *c, size_t len)
 {
-    int    i, buf_idx;
-    char   c, *buf, obj_id_buf[32] = {0};
-    long   start;
-    size_t sz;
+    size_t n;
 
-    start = ftell(fp);
+    st->total += len;
 
-    /* For each PDF version */
-    for (i=0; i<pdf->n_xrefs; ++i)
+    /* Top up a partial stripe first */
+    if (st->buf_len)
     {
-        if (!pdf->xrefs[i].version)
-          continue;
+        n = 32 - st->buf_len;
+        if (n > len)
+          n = len;
+        memcpy(st->buf + st->buf_len, c, n);
+        st->buf_len += n;
+        c += n;
+        len -= n;
+        if (st->buf_len < 32)
+          return;
+        st->v[0] = hash_round(st->v[0], load_le64(st->buf));
+        st->v[1] = hash_round(st->v[1], load_le64(st->buf + 8));
+        st->v[2] = hash_round(st->v[2], load_le64(st->buf + 16));
+        st->v[3] = hash_round(st->v[3], load_le64(st->buf + 24));
+        st->buf_len = 0;
+    }
 
-        /* Find trailer */
-        fseek(fp, pdf->xrefs[i].start, SEEK_SET);
-        while (SAFE_F(fp, (fgetc(fp) != 't')))
-            ; /* Iterate to "trailer" */
+    for ( ; len >= 32; c+=32, len-=32)
+    {
+        st->v[0] = hash_round(st->v[0], load_le64(c));
+        st->v[1] = hash_round(st->v[1], load_le64(c + 8));
+        st->v[2] = hash_round(st->v[2], load_le64(c + 16));
+        st->v[3] = hash_round(st->v[3], load_le64(c + 24));
+    }
+
+    memcpy(st->buf, c, len);
+    st->buf_len = len;
+}
 
-        /* Look for "<< ....... /Info ......" */
-        c = '\0';
-        while (SAFE_F(fp, ((c = fgetc(fp)) != '>')))
-          if (SAFE_F(fp, ((c == '/') &&
-                          (fgetc(fp) == 'I') && ((fgetc(fp) == 'n')))))
-            break;
 
-        /* Could not find /Info in trailer */
-        END_OF_TRAILER(c, start, fp);
+static uint64_t hash_final(const hash_state_t *st)
+{
+    uint64_t             h, k;
+    const unsigned char *c, *end;
 
-        while (SAFE_F(fp, (!isspace(c = fgetc(fp)) && (c != '>'))))
-            ; /* Iterate to first white space /Info<space><data> */
+    if (st->total >= 32)
+    {
+        h = ROTL64(st->v[0], 1) + ROTL64(st->v[1], 7) +
+            ROTL64(st->v[2], 12) + ROTL64(st->v[3], 18);
+        h = hash_merge(h, st->v[0]);
+        h = hash_merge(h, st->v[1]);
+        h = hash_merge(h, st->v[2]);
+        h = hash_merge(h, st->v[3]);
+    }
+    else
+      h = HASH_P5;
+    h += st->total;
 
-        /* No space between /Info and its data */
-        END_OF_TRAILER(c, start, fp);
+    c = st->buf;
+    end = st->buf + st->buf_len;
+    for ( ; c + 8 <= end; c+=8)
+    {
+        h ^= hash_round(0, load_le64(c));
+        h = ROTL64(h, 27) * HASH_P1 + HASH_P4;
+    }
+    if (c + 4 <= end)
+    {
+        k = (uint64_t)c[0] | ((uint64_t)c[1] << 8) |
+            ((uint64_t)c[2] << 16) | ((uint64_t)c[3] << 24);
+        h ^= k * HASH_P1;
+        h = ROTL64(h, 23) * HASH_P2 + HASH_P3;
+        c += 4;
+    }
+    for ( ; c < end; ++c)
+    {
+        h ^= *c * HASH_P5;
+        h = ROTL64(h, 11) * HASH_P1;
+    }
 
-        while (SAFE_F(fp, (isspace(c = fgetc(fp)) && (c != '>'))))
-            ; /* Iterate right on top of first non-whitespace /Info data */
+    h ^= h >> 33;
+    h *= HASH_P2;
+    h ^= h >> 29;
+    h *= HASH_P3;
+    h ^= h >> 32;
+    return h;
+}
 
-        /* No data for /Info */
-        END_OF_TRAILER(c, start, fp);
 
-        /* Get obj id as number */
-        buf_idx = 0;
-        obj_id_buf[buf_idx++] = c;
-        while ((buf_idx < (sizeof(obj_id_buf) - 1)) &&
-               SAFE_F(fp, (!isspace(c = fgetc(fp)) && (c != '>'))))
-          obj_id_buf[buf_idx++] = c;
+/* Hash the body of the object at 'offset', after its "<id> <gen> obj" header
+ * so that the same content under another id hashes the same, up to and
+ * including its "endobj": the last one before 'limit' (the next object listed,
+ * -1 for the end of the file), as the data of a stream can hold the word too.
+ * 'blk' is SCAN_BLOCK_SIZE bytes of scratch space.  Never returns 0, that
+ * means unknown.
+ */
+static uint64_t hash_object(FILE *fp, long offset, long limit, char *blk)
+{
+    static const char endobj[] = "endobj";
+    int               match, found;
+    long              pos;
+    size_t            i, n, done, chunk;
+    uint64_t          hash;
+    hash_state_t      st, at_end;
+
+    hash_init(&st);
+    stats_fseek(fp, offset, SEEK_SET);
+
+    /* Most objects are small, only read big chunks for big ones.  The state
+     * is kept as of each "endobj", the last one is the end of the object.
+     */
+    match = found = 0;
+    pos = offset;
+    for (chunk=512; ; )
+    {
+        if ((limit >= 0) && ((long)chunk > limit - pos))
+          chunk = limit - pos;
+        if (!chunk || !(n = stats_fread(blk, 1, chunk, fp)))
+          break;
 
-        END_OF_TRAILER(c, start, fp);
+        /* Leave out the header */
+        done = 0;
+        if (pos == offset)
+        {
+            for (i=0; (i < n) && (isdigit((unsigned char)blk[i]) ||
+                                  isspace((unsigned char)blk[i])); ++i)
+              ;
+            if ((i + 3 <= n) && (strncmp(blk + i, "obj", 3) == 0))
+              for (done=i+3; (done < n) && isspace((unsigned char)blk[done]);
+                   ++done)
+                ;
+        }
+        pos += n;
 
-        /* Get the object for the creator data.  If linear, try both xrefs */
-        buf = get_object(fp, atoll(obj_id_buf), &pdf->xrefs[i], &sz, NULL);
-        if (!buf && pdf->xrefs[i].is_linear && (i+1 < pdf->n_xrefs))
-          buf = get_object(fp, atoll(obj_id_buf), &pdf->xrefs[i+1], &sz, NULL);
+        for (i=done; i<n; ++i)
+        {
+            if (match == 0)
+            {
+                const char *e = memchr(blk + i, endobj[0], n - i);
+                if (!e)
+                  break;
+                i = e - blk;
+            }
+            if (blk[i] == endobj[match])
+              ++match;
+            else
+              match = (blk[i] == endobj[0]);
+
+            if (match == sizeof(endobj) - 1)
+            {
+                hash_update(&st, (const unsigned char *)blk + done,
+                            i + 1 - done);
+                done = i + 1;
+                at_end = st;
+                found = 1;
+                match = 0;
+            }
+        }
+        hash_update(&st, (const unsigned char *)blk + done, n - done);
 
-        load_creator_from_buf(fp, &pdf->xrefs[i], buf, sz);
-        free(buf);
+        if (chunk < SCAN_BLOCK_SIZE)
+          chunk *= 2;
     }
 
-    fseek(fp, start, SEEK_SET);
+    hash = hash_final(found ? &at_end : &st);
+    return hash ? hash : 1;
 }
 
 
-static void load_creator_from_buf(
-    FILE       *fp,
-    xref_t     *xref,
-    const char *buf,
-    size_t      buf_size)
+/*
+ * Object diffs
+ *
+ * Both versions of an object are turned into lines, one per top level
+ * dictionary entry (whitespace collapsed), followed by the lines of the stream
+ * data if streams are compared.  The changed region between the common head
+ * and tail is diffed with an LCS table, or shown as a plain replacement when
+ * that table would be too big, and printed as a single unified diff hunk.
+ */
+
+#define DIFF_MAX_STREAM (1024 * 1024) /* Stream bytes compared per side */
+#define DIFF_MAX_CELLS  (1024 * 1024) /* Largest LCS table               */
+#define DIFF_CONTEXT    3
+
+
+typedef struct _diff_side_t
 {
-    int   is_xml;
-    char *c;
+    char   *text;     /* NUL terminated lines */
+    size_t  len;
+    size_t  cap;
+    size_t *lines;    /* Offset of each line in 'text' */
+    int     n_lines;
+    int     line_cap;
+} diff_side_t;
 
-    if (!buf)
-      return;
 
-    /* Check to see if this is xml or old-school */
-    if ((c = strstr(buf, "/Type")))
-      while (*c && !isspace(*c))
-        ++c;
+#define DIFF_LINE(_side, _i) ((_side)->text + (_side)->lines[(_i)])
 
-    /* Probably "Metadata" */
-    is_xml = 0;
-    if (c && (*c == 'M'))
-      is_xml = 1;
 
-    /* Is the buffer XML(PDF 1.4+) or old format? */
-    if (is_xml)
-      load_creator_from_xml(xref, buf);
-    else
-      load_creator_from_old_format(fp, xref, buf, buf_size);
+static void diff_add_line(
+    diff_side_t *side,
+    const char  *c,
+    size_t       len,
+    int          collapse)
+{
+    int         space;
+    size_t      i;
+    char       *d;
+    const char *end;
+
+    if (side->len + len + 1 > side->cap)
+    {
+        side->cap = (side->len + len + 1) * 2;
+        if (!(side->text = stats_realloc(side->text, side->cap)))
+        {
+            ERR("Failed to reallocate diff data.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (side->n_lines == side->line_cap)
+    {
+        side->line_cap = side->line_cap ? side->line_cap * 2 : 64;
+        if (!(side->lines = stats_realloc(side->lines,
+                                          sizeof(size_t) * side->line_cap)))
+        {
+            ERR("Failed to reallocate diff data.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    side->lines[side->n_lines++] = side->len;
+    d = side->text + side->len;
+    end = c + len;
+    for (i=0, space=0; c<end; ++c)
+    {
+        /* Runs of whitespace become one space, none at either end */
+        if (collapse && isspace(*c))
+        {
+            space = (i > 0);
+            continue;
+        }
+        if (space)
+          d[i++] = ' ';
+        space = 0;
+        d[i++] = (*c == '\0') ? ' ' : *c;
+    }
+    d[i++] = '\0';
+    side->len += i;
 }
 
 
-static void load_creator_from_xml(xref_t *xref, const char *buf)
+/* One line per top level entry of a dictionary, one line for anything else */
+static void diff_add_value(diff_side_t *side, const char *val, size_t size)
 {
-    /* TODO */
+    const char *c, *k, *end;
+
+    end = val + size;
+    if ((size < 2) || strncmp(val, "<<", 2))
+    {
+        diff_add_line(side, val, size, 1);
+        return;
+    }
+
+    for (c=val+2; c<end; )
+    {
+        if (*c != '/')
+        {
+            c = (isspace(*c) || (*c == '>')) ? c + 1 : get_value_end(c, end);
+            continue;
+        }
+
+        k = c;
+        c = get_value_end(c, end);
+        while ((c < end) && isspace(*c))
+          ++c;
+        if (get_reference(c, end))
+          c = (const char *)memchr(c, 'R', end - c) + 1;
+        else if ((c < end) && (*c != '>'))
+          c = get_value_end(c, end);
+        diff_add_line(side, k, c - k, 1);
+    }
 }
 
 
-static void load_creator_from_old_format(
-    FILE       *fp,
-    xref_t     *xref,
-    const char *buf,
-    size_t      buf_size)
+/* Resolve a direct or indirect integer, as of the xref at 'xref_idx' */
+static long get_int_value(
+    FILE        *fp,
+    const pdf_t *pdf,
+    int          xref_idx,
+    const char  *c,
+    const char  *end)
 {
-    int            i, n_eles, length, is_escaped, obj_id;
-    char          *c, *ascii, *start, *s, *saved_buf_search, *obj;
-    size_t         obj_size;
-    pdf_creator_t *info;
+    int    i, j, obj_id;
+    long   value;
+    char  *val;
+    size_t size;
+
+    if (!(obj_id = get_reference(c, end)))
+      return atol(c);
+
+    for (i=xref_idx; i>=0; --i)
+      for (j=0; pdf->xrefs[i].version && j<pdf->xrefs[i].n_entries; ++j)
+        if ((pdf->xrefs[i].obj_ids[j] == obj_id) &&
+            XREF_IN_USE(&pdf->xrefs[i], j))
+        {
+            if (!(val = get_object_value(fp, pdf->xrefs[i].offsets[j],
+                                         &size, NULL)))
+              return -1;
+            value = atol(val);
+            free(val);
+            return value;
+        }
 
-    info = new_creator(&n_eles);
+    return -1;
+}
 
-    /* Mark the end of buf, so that we do not crawl past it */
-    if (buf_size < 1) return;
-    const char *buf_end = buf + buf_size - 1;
 
-    /* Treat 'end' as either the end of 'buf' or the end of 'obj'.  Obj is if
-     * the creator element (e.g., ModDate, Producer, etc) is an object and not
-     * part of 'buf'.
-     */
-    const char *end = buf_end;
+/* Add the lines of the stream data that starts after "stream" at 'pos' */
+static void diff_add_stream(
+    FILE        *fp,
+    const pdf_t *pdf,
+    int          xref_idx,
+    diff_side_t *side,
+    const char  *dict,
+    size_t       dict_size,
+    long         pos)
+{
+    int           is_binary;
+    long          length;
+    char          kw[16], line[80];
+    unsigned char *raw, *data;
+    size_t        i, n, raw_len, data_len, start;
+    const char    *c, *end, *filter, *filter_end;
+    hash_state_t  st;
+
+    /* "stream" and its end of line */
+    stats_fseek(fp, pos, SEEK_SET);
+    memset(kw, 0, sizeof(kw));
+    n = stats_fread(kw, 1, sizeof(kw) - 1, fp);
+    for (i=0; (i < n) && isspace(kw[i]); ++i)
+      ;
+    if ((i + 6 > n) || strncmp(kw + i, "stream", 6))
+      return;
+    i += 6;
+    if ((i < n) && (kw[i] == '\r'))
+      ++i;
+    if ((i < n) && (kw[i] == '\n'))
+      ++i;
+    pos += i;
+
+    /* Without a usable /Length compare what fits in the budget */
+    length = -1;
+    if ((c = get_dict_value(dict, dict_size, "/Length", &end)))
+      length = get_int_value(fp, pdf, xref_idx, c, end);
+    if ((length < 0) || (length > DIFF_MAX_STREAM))
+      length = DIFF_MAX_STREAM;
+
+    raw = safe_calloc(length + 1);
+    stats_fseek(fp, pos, SEEK_SET);
+    raw_len = stats_fread(raw, 1, length, fp);
+    clearerr(fp);
 
-    for (i=0; i<n_eles; ++i)
+    filter = get_dict_value(dict, dict_size, "/Filter", &filter_end);
+    data = raw;
+    data_len = raw_len;
+#ifdef HAVE_ZLIB
+    /* Only a lone /FlateDecode (possibly in an array) is undone */
+    c = filter;
+    if (c && (*c == '['))
+      ++c;
+    while (c && (c < filter_end) && isspace(*c))
+      ++c;
+    if (c && (strncmp(c, "/FlateDecode", 12) == 0) &&
+        !memchr(c + 12, '/', filter_end - c - 12))
     {
-        if (!(c = strstr(buf, info[i].key)))
-          continue;
+        z_stream zs;
 
-        /* Find the value (skipping whitespace) */
-        c += strlen(info[i].key);
-        while (isspace(*c))
-          ++c;
-        if (c >= buf_end) {
-          FAIL("Failed to locate space, likely a corrupt PDF.");
+        /* Inflate into a bounded buffer, the tail past it is not compared */
+        memset(&zs, 0, sizeof(zs));
+        data = safe_calloc(DIFF_MAX_STREAM + 1);
+        data_len = 0;
+        if (inflateInit(&zs) == Z_OK)
+        {
+            zs.next_in = raw;
+            zs.avail_in = raw_len;
+            zs.next_out = data;
+            zs.avail_out = DIFF_MAX_STREAM;
+            inflate(&zs, Z_SYNC_FLUSH);
+            data_len = DIFF_MAX_STREAM - zs.avail_out;
+            inflateEnd(&zs);
         }
+        free(raw);
+        raw = data;
+        filter = NULL;
+    }
+#endif
 
-        /* If looking at the start of a pdf token, we have gone too far */
-        if (*c == '/')
-          continue;
+    diff_add_line(side, "stream", 6, 0);
 
-        /* If the value is a number and not a '(' then the data is located in
-         * an object we need to fetch, and not inline
-         */
-        obj = saved_buf_search = NULL;
-        obj_size = 0;
-        end = buf_end; /* Init to be the buffer, this might not be an obj. */
-        if (isdigit(*c))
-        {
-            obj_id = atoi(c);
-            saved_buf_search = c;
-            s = saved_buf_search;
+    /* Still encoded, or not text: compare a digest */
+    for (i=0, is_binary=0; !filter && (i < data_len); ++i)
+      if (!data[i] || ((data[i] < 0x20) && !isspace(data[i])))
+      {
+          is_binary = 1;
+          break;
+      }
+    if (filter || is_binary)
+    {
+        hash_init(&st);
+        hash_update(&st, data, data_len);
+        n = snprintf(line, sizeof(line), "<%s%zu bytes, hash %016llx>",
+                     filter ? "encoded, " : "", data_len,
+                     (unsigned long long)hash_final(&st));
+        diff_add_line(side, line, n, 0);
+        free(raw);
+        return;
+    }
 
-            obj = get_object(fp, obj_id, xref, &obj_size, NULL);
-            end = obj + obj_size;
-            c = obj;
+    for (i=start=0; i<=data_len; ++i)
+      if ((i == data_len) || (data[i] == '\n') || (data[i] == '\r'))
+      {
+          if ((i > start) || ((i < data_len) && (data[i] == '\n') &&
+                              ((i == 0) || (data[i-1] != '\r'))))
+            diff_add_line(side, (const char *)data + start, i - start, 0);
+          start = i + 1;
+      }
 
-            /* Iterate to '(' */
-            while (c && (*c != '(') && (c < end))
-              ++c;
-            if (c >= end)  {
-              FAIL("Failed to locate a '(' character. "
-                  "This might be a corrupt PDF.\n");
-            }
+    free(raw);
+}
 
-            /* Advance the search to the next token */
-            while (s && (*s == '/') && (s < buf_end))
-              ++s;
-            if (s >= buf_end)  {
-              FAIL("Failed to locate a '/' character. "
-                  "This might be a corrupt PDF.\n");
-            }
-            saved_buf_search = s;
-        }
 
-        /* Find the end of the value */
-        start = c;
-        length = is_escaped = 0;
-        while (c && ((*c != '\r') && (*c != '\n') && (*c != '<')))
-        {
-            /* Bail out if we see an un-escaped ')' closing character */
-            if (!is_escaped && (*c == ')'))
-              break;
-            else if (*c == '\\')
-              is_escaped = 1;
-            else
-              is_escaped = 0;
-            ++c;
-            ++length;
-            if (c > end) {
-              FAIL("Failed to locate the end of a value. "
-                   "This might be a corrupt PDF.\n");
-            }
-        }
+static int diff_load_side(
+    FILE        *fp,
+    const pdf_t *pdf,
+    int          xref_idx,
+    long         offset,
+    pdf_flag_t   flags,
+    diff_side_t *side)
+{
+    long    val_end;
+    char   *val;
+    size_t  size;
 
-        if (length == 0)
-          continue;
+    if (!(val = get_object_value(fp, offset, &size, &val_end)))
+      return 0;
 
-        /* Add 1 to length so it gets the closing ')' when we copy */
-        if (length)
-          length += 1;
-        length = (length > KV_MAX_VALUE_LENGTH) ? KV_MAX_VALUE_LENGTH : length;
-        strncpy(info[i].value, start, length);
-        info[i].value[KV_MAX_VALUE_LENGTH - 1] = '\0';
+    diff_add_value(side, val, size);
+    if (flags & PDF_FLAG_DIFF_STREAMS)
+      diff_add_stream(fp, pdf, xref_idx, side, val, size, val_end);
 
-        /* Restore where we were searching from */
-        if (saved_buf_search)
-        {
-            /* Release memory from get_object() called earlier */
-            free(obj);
-            c = saved_buf_search;
-        }
-    } /* For all creation information tags */
+    free(val);
+    return 1;
+}
 
-    /* Go through the values and convert if encoded */
-    for (i = 0; i < n_eles; ++i) {
-      const size_t val_str_len = strnlen(info[i].value, KV_MAX_VALUE_LENGTH);
-      if ((ascii = decode_text_string(info[i].value, val_str_len))) {
-        strncpy(info[i].value, ascii, val_str_len);
-        free(ascii);
-      }
-    }
 
-    xref->creator = info;
-    xref->n_creator_entries = n_eles;
+static void diff_print(FILE *out, char tag, const diff_side_t *side, int i)
+{
+    fputc(tag, out);
+    fputs(DIFF_LINE(side, i), out);
+    fputc('\n', out);
 }
 
 
-/* Returns object data at the start of the file pointer
- * This interfaces to 'get_object'
- */
-static char *get_object_from_here(FILE *fp, size_t *size, int *is_stream)
+/* Print the changed region a[head..n_a-tail) vs b[head..n_b-tail) */
+static void diff_print_middle(
+    FILE              *out,
+    const diff_side_t *a,
+    const diff_side_t *b,
+    int                head,
+    int                tail)
 {
-    long         start;
-    char         buf[256];
-    int          obj_id;
-    xref_t       xref;
-    xref_entry_t entry;
+    int       i, j, n, m;
+    unsigned *lcs;
 
-    start = ftell(fp);
+    n = a->n_lines - head - tail;
+    m = b->n_lines - head - tail;
 
-    /* Object ID */
-    memset(buf, 0, 256);
-    SAFE_E(fread(buf, 1, 255, fp), 255, "Failed to load object ID.\n");
-    if (!(obj_id = atoi(buf)))
+    if ((long)(n + 1) * (m + 1) > DIFF_MAX_CELLS)
     {
-        fseek(fp, start, SEEK_SET);
-        return NULL;
+        for (i=0; i<n; ++i)
+          diff_print(out, '-', a, head + i);
+        for (j=0; j<m; ++j)
+          diff_print(out, '+', b, head + j);
+        return;
     }
 
-    /* Create xref entry to pass to the get_object routine */
-    memset(&entry, 0, sizeof(xref_entry_t));
-    entry.obj_id = obj_id;
-    entry.offset = start;
+    /* lcs[i][j]: longest common subsequence of a[i..n) and b[j..m) */
+    lcs = safe_calloc(sizeof(unsigned) * (n + 1) * (m + 1));
+#define LCS(_i, _j) lcs[(_i) * (m + 1) + (_j)]
+    for (i=n-1; i>=0; --i)
+      for (j=m-1; j>=0; --j)
+        if (strcmp(DIFF_LINE(a, head + i), DIFF_LINE(b, head + j)) == 0)
+          LCS(i, j) = LCS(i + 1, j + 1) + 1;
+        else
+          LCS(i, j) = (LCS(i + 1, j) > LCS(i, j + 1)) ?
+                      LCS(i + 1, j) : LCS(i, j + 1);
 
-    /* Xref and single entry for the object we want data from */
-    memset(&xref, 0, sizeof(xref_t));
-    xref.n_entries = 1;
-    xref.entries = &entry;
+    for (i=j=0; (i < n) || (j < m); )
+      if ((i < n) && (j < m) &&
+          (strcmp(DIFF_LINE(a, head + i), DIFF_LINE(b, head + j)) == 0))
+      {
+          diff_print(out, ' ', a, head + i);
+          ++i;
+          ++j;
+      }
+      else if ((i < n) && ((j == m) || (LCS(i + 1, j) >= LCS(i, j + 1))))
+        diff_print(out, '-', a, head + i++);
+      else
+        diff_print(out, '+', b, head + j++);
+#undef LCS
 
-    fseek(fp, start, SEEK_SET);
-    return get_object(fp, obj_id, &xref, size, is_stream);
+    free(lcs);
 }
 
 
-static char *get_object(
-    FILE         *fp,
-    int           obj_id,
-    const xref_t *xref,
-    size_t       *size,
-    int          *is_stream)
+int pdf_diff_object(
+    FILE        *fp,
+    pdf_t       *pdf,
+    int          xref_idx,
+    int          entry_idx,
+    pdf_flag_t   flags,
+    FILE        *out)
 {
-    static const int    blk_sz = 256;
-    int                 i, total_sz, read_sz, n_blks, search, stream;
-    size_t              obj_sz;
-    char               *c, *data;
-    long                start;
-    const xref_entry_t *entry;
+    int           i, obj_id, prev_idx, head, tail, pre, post, max_tail, ret;
+    long          start;
+    diff_side_t   a, b;
+    const xref_t *prev, *curr;
+
+    STATS_FOR(pdf);
+    curr = &pdf->xrefs[xref_idx];
+    obj_id = curr->obj_ids[entry_idx];
+    if (!(prev = get_prev_xref(pdf, xref_idx)) ||
+        ((prev_idx = pdf_xref_find(prev, obj_id)) == -1) ||
+        !XREF_IN_USE(prev, prev_idx) || !XREF_IN_USE(curr, entry_idx))
+      return -1;
+
+    /* Only the two bodies being compared are read */
+    start = ftell(fp);
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    ret = -1;
+    if (!diff_load_side(fp, pdf, prev - pdf->xrefs, prev->offsets[prev_idx],
+                        flags, &a) ||
+        !diff_load_side(fp, pdf, xref_idx, curr->offsets[entry_idx],
+                        flags, &b))
+      goto out;
+
+    for (head=0; (head < a.n_lines) && (head < b.n_lines); ++head)
+      if (strcmp(DIFF_LINE(&a, head), DIFF_LINE(&b, head)))
+        break;
+    max_tail = ((a.n_lines < b.n_lines) ? a.n_lines : b.n_lines) - head;
+    for (tail=0; tail<max_tail; ++tail)
+      if (strcmp(DIFF_LINE(&a, a.n_lines - 1 - tail),
+                 DIFF_LINE(&b, b.n_lines - 1 - tail)))
+        break;
 
-    if (size)
-      *size = 0;
+    /* Only the whitespace changed */
+    ret = 0;
+    if ((head == a.n_lines) && (head == b.n_lines))
+      goto out;
+
+    pre = (head < DIFF_CONTEXT) ? head : DIFF_CONTEXT;
+    post = (tail < DIFF_CONTEXT) ? tail : DIFF_CONTEXT;
+    fprintf(out, "--- Object %d (Version %d)\n+++ Object %d (Version %d)\n"
+                 "@@ -%d,%d +%d,%d @@\n",
+            obj_id, prev->version,
+            obj_id, curr->version,
+            head - pre + 1, pre + (a.n_lines - head - tail) + post,
+            head - pre + 1, pre + (b.n_lines - head - tail) + post);
+    for (i=head-pre; i<head; ++i)
+      diff_print(out, ' ', &a, i);
+    diff_print_middle(out, &a, &b, head, tail);
+    for (i=a.n_lines-tail; i<a.n_lines-tail+post; ++i)
+      diff_print(out, ' ', &a, i);
+
+out:
+    free(a.text);
+    free(a.lines);
+    free(b.text);
+    free(b.lines);
+    stats_fseek(fp, start, SEEK_SET);
+    return ret;
+}
 
-    if (is_stream)
-      *is_stream = 0;
 
-    start = ftell(fp);
+/*
+ * Recovery
+ *
+ * A revision whose startxref is missing, or does not lead to an xref, is
+ * rebuilt from the tokens found between the %%EOF that closes it and the
+ * previous one.  Its "xref" table is used if it is still there, otherwise
+ * every "N G obj" header that is closed by an "endobj" becomes an entry.  All
+ * of the broken revisions are served by one forward scan of the document.
+ */
 
-    /* Find object */
-    entry = NULL;
-    for (i=0; i<xref->n_entries; i++)
-      if (xref->entries[i].obj_id == obj_id)
-      {
-          entry = &xref->entries[i];
-          break;
-      }
+/* Bytes carried from one block to the next for tokens that straddle them */
+#define RECOVER_CARRY 64
 
-    if (!entry)
-      return NULL;
 
-    /* Jump to object start */
-    fseek(fp, entry->offset, SEEK_SET);
+typedef struct _recover_tok_t
+{
+    long pos;
+    int  obj_id;
+    int  gen_num;
+    char kind; /* 'o'bj header, 'e'ndobj, 'x'ref or 't'railer */
+} recover_tok_t;
 
-    /* Initial allocation */
-    obj_sz = 0;    /* Bytes in object */
-    total_sz = 0;  /* Bytes read in   */
-    n_blks = 1;
-    data = safe_calloc(blk_sz * n_blks);
 
-    /* Suck in data */
-    stream = 0;
-    while ((read_sz = fread(data+total_sz, 1, blk_sz-1, fp)) && !ferror(fp))
+#define IS_DELIM(_c) (isspace(_c) || strchr("()<>[]{}/%", (_c)))
+
+
+/* Classify the token that ends at blk[i].  Bytes before 'lo' are unknown,
+ * unless 'lo_is_delim', which means that blk[lo] follows a delimiter (e.g. the
+ * start of the scan).  blk[i+1] is a delimiter or not there when 'i+1 == hi'.
+ */
+static int recover_token(
+    const char    *blk,
+    long           lo,
+    long           i,
+    long           hi,
+    int            lo_is_delim,
+    recover_tok_t *tok)
+{
+    long k, gen_start;
+
+#define PRECEDED_OK(_k) \
+    (((_k) < lo) ? lo_is_delim : IS_DELIM((unsigned char)blk[_k]))
+
+    if ((i + 1 < hi) && !IS_DELIM((unsigned char)blk[i + 1]))
+      return 0;
+
+    switch (blk[i])
     {
-        total_sz += read_sz;
+    case 'f':
+        if ((i - 3 < lo) || strncmp(blk + i - 3, "xref", 4) ||
+            !PRECEDED_OK(i - 4))
+          return 0;
+        tok->kind = 'x';
+        tok->pos = i - 3;
+        return 1;
+
+    case 'r':
+        if ((i - 6 < lo) || strncmp(blk + i - 6, "trailer", 7) ||
+            !PRECEDED_OK(i - 7))
+          return 0;
+        tok->kind = 't';
+        tok->pos = i - 6;
+        return 1;
+
+    case 'j':
+        if ((i - 2 < lo) || strncmp(blk + i - 2, "obj", 3))
+          return 0;
+        if ((i - 5 >= lo) && (strncmp(blk + i - 5, "endobj", 6) == 0))
+        {
+            if (!PRECEDED_OK(i - 6))
+              return 0;
+            tok->kind = 'e';
+            tok->pos = i - 5;
+            return 1;
+        }
 
-        *(data + total_sz) = '\0';
+        /* "<obj_id> <gen_num> obj", walk back over the two numbers */
+        k = i - 3;
+        if ((k < lo) || !isspace((unsigned char)blk[k]))
+          return 0;
+        while ((k >= lo) && isspace((unsigned char)blk[k]))
+          --k;
+        if ((k < lo) || !isdigit((unsigned char)blk[k]))
+          return 0;
+        while ((k >= lo) && isdigit((unsigned char)blk[k]))
+          --k;
+        gen_start = k + 1;
+        if ((k < lo) || !isspace((unsigned char)blk[k]))
+          return 0;
+        while ((k >= lo) && isspace((unsigned char)blk[k]))
+          --k;
+        if ((k < lo) || !isdigit((unsigned char)blk[k]))
+          return 0;
+        while ((k >= lo) && isdigit((unsigned char)blk[k]))
+          --k;
+        if (!PRECEDED_OK(k))
+          return 0;
+        tok->kind = 'o';
+        tok->pos = k + 1;
+        tok->obj_id = atoi(blk + k + 1);
+        tok->gen_num = atoi(blk + gen_start);
+        return 1;
+    }
 
-        if (total_sz + blk_sz >= (blk_sz * n_blks))
-          data = realloc(data, blk_sz * (++n_blks));
-        if (!data) {
-          ERR("Failed to reallocate buffer.\n");
-          exit(EXIT_FAILURE);
+#undef PRECEDED_OK
+    return 0;
+}
+
+
+/* Collect the recovery tokens in [from, to) with one forward pass over 'fp' */
+static recover_tok_t *scan_tokens(FILE *fp, long from, long to, int *n_toks)
+{
+    int            cap;
+    long           i, len, scanned, scan_end, base, drop, want;
+    size_t         n;
+    uint64_t       x;
+    char          *blk;
+    recover_tok_t *toks, tok;
+
+    *n_toks = cap = 0;
+    toks = NULL;
+    blk = safe_calloc(SCAN_BLOCK_SIZE + RECOVER_CARRY);
+    stats_fseek(fp, from, SEEK_SET);
+
+    base = from;
+    len = scanned = 0;
+    for ( ;; )
+    {
+        want = to - (base + len);
+        if (want > SCAN_BLOCK_SIZE)
+          want = SCAN_BLOCK_SIZE;
+        n = (want > 0) ? stats_fread(blk + len, 1, want, fp) : 0;
+        len += n;
+
+        /* Keep one byte of lookahead, unless this is all there is */
+        scan_end = (n < want || base + len >= to) ? len : len - 1;
+
+        /* Skip words without a candidate for the last byte of a token */
+        for (i=scanned; i<scan_end; ++i)
+        {
+            if (i + 8 <= scan_end)
+            {
+                x = load_le64((const unsigned char *)blk + i);
+                if (!(SWAR_HAS(x, 'j') | SWAR_HAS(x, 'f') | SWAR_HAS(x, 'r')))
+                {
+                    i += 7;
+                    continue;
+                }
+            }
+
+            if ((blk[i] != 'j' && blk[i] != 'f' && blk[i] != 'r') ||
+                !recover_token(blk, 0, i, len, base == from, &tok))
+              continue;
+
+            if (*n_toks == cap)
+            {
+                cap = cap ? cap * 2 : 64;
+                if (!(toks = stats_realloc(toks, sizeof(recover_tok_t) * cap)))
+                {
+                    ERR("Failed to reallocate recovery data.\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            tok.pos += base;
+            toks[(*n_toks)++] = tok;
         }
+        scanned = scan_end;
 
-        search = total_sz - read_sz;
-        if (search < 0)
-          search = 0;
+        if (scan_end == len)
+          break;
 
-        if ((c = strstr(data + search, "endobj")))
+        /* Slide the tail down so tokens can look back across blocks */
+        if ((drop = len - RECOVER_CARRY) > 0)
         {
-            *(c + strlen("endobj") + 1) = '\0';
-            obj_sz = (char *)strstr(data + search, "endobj") - (char *)data;
-            obj_sz += strlen("endobj") + 1;
-            break;
+            memmove(blk, blk + drop, len - drop);
+            base += drop;
+            len -= drop;
+            scanned -= drop;
         }
-        else if (strstr(data, "stream"))
-          stream = 1;
     }
 
-    clearerr(fp);
-    fseek(fp, start, SEEK_SET);
+    free(blk);
+    return toks;
+}
 
-    if (size) {
-      *size = obj_sz;
-      if (!obj_sz && data) {
-        free(data);
-        data = NULL;
-      }
-    }
 
-    if (is_stream)
-      *is_stream = stream;
+static int cmp_recovered_entry(const void *a, const void *b)
+{
+    const xref_entry_t *x = a, *y = b;
 
-    return data;
+    if (x->obj_id != y->obj_id)
+      return (x->obj_id < y->obj_id) ? -1 : 1;
+    return (x->offset > y->offset) - (x->offset < y->offset);
 }
 
 
-static const char *get_type(FILE *fp, int obj_id, const xref_t *xref)
+/* Rebuild xref 'i' from the tokens in toks[lo..hi) */
+static int recover_xref(
+    FILE                *fp,
+    pdf_t               *pdf,
+    int                  i,
+    const recover_tok_t *toks,
+    int                  lo,
+    int                  hi)
 {
-    int          is_stream;
-    char        *c, *obj, *endobj;
-    static char  buf[32];
-    long         start;
+    int           t, n, m;
+    long          start;
+    xref_entry_t *ents;
+    xref_t       *xref = &pdf->xrefs[i];
 
-    start = ftell(fp);
+    xref->end = get_revision_end(pdf, i);
 
-    if (!(obj = get_object(fp, obj_id, xref, NULL, &is_stream)) ||
-        is_stream                                               ||
-        !(endobj = strstr(obj, "endobj")))
-    {
-        free(obj);
-        fseek(fp, start, SEEK_SET);
+    /* The xref table might still be intact, just not where startxref says */
+    for (t=hi-1; t>=lo; --t)
+      if (toks[t].kind == 'x')
+      {
+          xref->start = toks[t].pos;
+          if (is_valid_xref(fp, xref) &&
+              (load_xref_entries(fp, xref) == 0) && xref->n_entries)
+            return 1;
+          pdf_xref_free_entries(xref);
+          break;
+      }
 
-        if (is_stream)
-          return "Stream";
-        else
-          return "Unknown";
-    }
+    /* Otherwise every complete object defined in this revision is an entry,
+     * the creator data is looked up from the trailer if there is one.
+     */
+    start = (lo < hi) ? toks[lo].pos : 0;
+    for (t=lo, n=0; t<hi; ++t)
+      if (toks[t].kind == 'o')
+        ++n;
+      else if (toks[t].kind == 't')
+        start = toks[t].pos;
+    xref->start = start;
+    if (!n)
+      return 0;
 
-    /* Get the Type value (avoiding font names like Type1) */
-    c = obj;
-    while ((c = strstr(c, "/Type")) && (c < endobj))
-      if (isdigit(*(c + strlen("/Type"))))
+    ents = safe_calloc(sizeof(xref_entry_t) * n);
+    for (t=lo, n=0; t<hi; ++t)
+      if ((toks[t].kind == 'o') && (t + 1 < hi) && (toks[t+1].kind == 'e'))
       {
-          ++c;
-          continue;
+          ents[n].obj_id = toks[t].obj_id;
+          ents[n].offset = toks[t].pos;
+          ents[n].gen_num = toks[t].gen_num;
+          ents[n].f_or_n = 'n';
+          ++n;
       }
-      else
-        break;
 
-    if (!c || (c && (c > endobj)))
+    /* Objects redefined within the revision keep their last definition */
+    qsort(ents, n, sizeof(xref_entry_t), cmp_recovered_entry);
+    for (t=0, m=0; t<n; ++t)
     {
-        free(obj);
-        fseek(fp, start, SEEK_SET);
-        return "Unknown";
+        if (m && (ents[m-1].obj_id == ents[t].obj_id))
+          --m;
+        ents[m++] = ents[t];
     }
 
-    /* Skip to first blank/whitespace */
-    c += strlen("/Type");
-    while (isspace(*c) || *c == '/')
-      ++c;
+    for (t=0; t<m; ++t)
+      pdf_xref_add_entry(xref, &ents[t]);
+    free(ents);
 
-    /* 'c' should be pointing to the type name.  Find the end of the name. */
-    size_t n_chars = 0;
-    const char *name_itr = c;
-    while ((name_itr < endobj) &&
-           !(isspace(*name_itr) || *name_itr == '/' || *name_itr == '>')) {
-        ++name_itr;
-        ++n_chars;
-    }
-    if (n_chars >= sizeof(buf))
+    return xref->n_entries != 0;
+}
+
+
+static void recover_xrefs(FILE *fp, pdf_t *pdf, int first)
+{
+    int            i, t, lo, n_toks;
+    long           start, from, rev_start;
+    recover_tok_t *toks;
+
+    start = ftell(fp);
+
+    /* Scan from the first broken revision through the last one */
+    for (i=first; !pdf->xrefs[i].is_recovered; ++i)
+      ;
+    from = i ? pdf->eofs[i-1] + strlen("%%EOF") : 0;
+    for (t=pdf->n_xrefs-1; !pdf->xrefs[t].is_recovered; --t)
+      ;
+    toks = scan_tokens(fp, from, get_revision_end(pdf, t), &n_toks);
+
+    for (t=0; i<pdf->n_xrefs; ++i)
     {
-        free(obj);
-        fseek(fp, start, SEEK_SET);
-        return "Unknown";
+        if (!pdf->xrefs[i].is_recovered)
+          continue;
+
+        rev_start = i ? pdf->eofs[i-1] + strlen("%%EOF") : 0;
+        while ((t < n_toks) && (toks[t].pos < rev_start))
+          ++t;
+        for (lo=t; (t < n_toks) && (toks[t].pos < get_revision_end(pdf, i));
+             ++t)
+          ;
+
+        if (!recover_xref(fp, pdf, i, toks, lo, t))
+        {
+            pdf_xref_free_entries(&pdf->xrefs[i]);
+            memset(&pdf->xrefs[i], 0, sizeof(xref_t));
+            pdf->xrefs[i].loaded = PDF_LOAD_ENTRIES;
+        }
     }
 
-    /* Return the value by storing it in static mem. */
-    memcpy(buf, c, n_chars);
-    buf[n_chars] = '\0';
-    free(obj);
-    fseek(fp, start, SEEK_SET);
-    return buf;
+    free(toks);
+    stats_fseek(fp, start, SEEK_SET);
 }
 
 
-static char *get_header(FILE *fp)
+const pdf_stats_t *pdf_get_stats(const pdf_t *pdf)
 {
-    /* First 1024 bytes of doc must be header (1.7 spec pg 1102) */
-    char *header = safe_calloc(1024);
-    long start = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-    SAFE_E(fread(header, 1, 1023, fp), 1023, "Failed to load PDF header.\n");
-    fseek(fp, start, SEEK_SET);
-    return header;
+    return &pdf->stats;
 }
 
 
-static char *decode_text_string(const char *str, size_t str_len)
+void pdf_stats_add(pdf_stats_t *total, const pdf_stats_t *add)
 {
-    int   idx, is_hex, is_utf16be, ascii_idx;
-    char *ascii, hex_buf[5] = {0};
-
-    is_hex = is_utf16be = idx = ascii_idx = 0;
+    int i;
 
-    /* Regular encoding */
-    if (str[0] == '(')
-    {
-        ascii = safe_calloc(str_len + 1);
-        strncpy(ascii, str, str_len + 1);
-        return ascii;
-    }
-    else if (str[0] == '<')
-    {
-        is_hex = 1;
-        ++idx;
-    }
+    for (i=0; i<PDF_N_PHASES; ++i)
+      total->phase_ns[i] += add->phase_ns[i];
+    total->bytes_read += add->bytes_read;
+    total->seeks += add->seeks;
+    total->objects_fetched += add->objects_fetched;
+    total->reallocs += add->reallocs;
+    total->cache_hits += add->cache_hits;
+}
 
-    /* Text strings can be either PDFDocEncoding or UTF-16BE */
-    if (is_hex && (str_len > 5) &&
-        (str[idx] == 'F') && (str[idx+1] == 'E') &&
-        (str[idx+2] == 'F') && (str[idx+3] == 'F'))
-    {
-        is_utf16be = 1;
-        idx += 4;
-    }
-    else
-      return NULL;
 
-    /* Now decode as hex */
-    ascii = safe_calloc(str_len);
-    for ( ; idx<str_len; ++idx)
+const char *pdf_phase_name(pdf_phase_t phase)
+{
+    static const char *names[PDF_N_PHASES] =
     {
-        hex_buf[0] = str[idx++];
-        hex_buf[1] = str[idx++];
-        hex_buf[2] = str[idx++];
-        hex_buf[3] = str[idx];
-        ascii[ascii_idx++] = strtol(hex_buf, NULL, 16);
-    }
+        [PDF_PHASE_SCAN_EOFS]    = "scan_eofs",
+        [PDF_PHASE_LOAD_XREFS]   = "load_xrefs",
+        [PDF_PHASE_LOAD_ENTRIES] = "load_entries",
+        [PDF_PHASE_LOAD_CREATOR] = "load_creator",
+        [PDF_PHASE_GET_OBJECT]   = "get_object",
+        [PDF_PHASE_GET_TYPE]     = "get_type",
+        [PDF_PHASE_GET_PAGE]     = "get_page",
+        [PDF_PHASE_HASH]         = "hash_objects",
+        [PDF_PHASE_SUMMARIZE]    = "summarize",
+        [PDF_PHASE_WRITE]        = "write",
+    };
 
-    return ascii;
+    return ((phase >= 0) && (phase < PDF_N_PHASES)) ? names[phase] : "unknown";
 }
 
 
-/* Return the offset to the beginning of the %%EOF string.
- * A negative value is returned when done scanning.
- */
-static int get_next_eof(FILE *fp)
+void pdf_stats_print(FILE *out, const char *name, const pdf_stats_t *st)
 {
-    int match, c;
-    const char buf[] = "%%EOF";
-
-    match = 0;
-    while ((c = fgetc(fp)) != EOF)
-    {
-        if (c == buf[match])
-          ++match;
-        else
-          match = 0;
-
-        if (match == 5) /* strlen("%%EOF") */
-          return ftell(fp) - 5;
-    }
+    int i;
 
-    return -1;
+    fprintf(out, "---------- %s stats ----------\n", name);
+    for (i=0; i<PDF_N_PHASES; ++i)
+      fprintf(out, "%-16s %.6f s\n",
+              pdf_phase_name(i), st->phase_ns[i] / 1e9);
+    fprintf(out,
+            "%-16s %llu\n%-16s %llu\n%-16s %llu\n%-16s %llu\n%-16s %llu\n",
+            "bytes_read", st->bytes_read,
+            "seeks", st->seeks,
+            "objects_fetched", st->objects_fetched,
+            "reallocs", st->reallocs,
+            "cache_hits", st->cache_hits);
 }
@@ -16,6 +16,37 @@
 #define PDF_H_INCLUDE
 
 #include <stdio.h>
+#include <stdint.h>
+
+
+/* Instrumentation.  Phase times are inclusive (e.g., load_entries is also
+ * counted in load_xrefs) and measured with the monotonic clock.
+ */
+typedef enum _pdf_phase_t
+{
+    PDF_PHASE_SCAN_EOFS,    /* Indexing the %%EOF markers         */
+    PDF_PHASE_LOAD_XREFS,   /* pdf_load_xrefs() as a whole        */
+    PDF_PHASE_LOAD_ENTRIES, /* Parsing xref entries               */
+    PDF_PHASE_LOAD_CREATOR, /* Locating and parsing Info data     */
+    PDF_PHASE_GET_OBJECT,   /* Reading object bodies              */
+    PDF_PHASE_GET_TYPE,     /* Classifying objects                */
+    PDF_PHASE_GET_PAGE,     /* Walking page trees                 */
+    PDF_PHASE_HASH,         /* Hashing object bodies              */
+    PDF_PHASE_SUMMARIZE,    /* pdf_summarize() as a whole         */
+    PDF_PHASE_WRITE,        /* Writing versions/scrubbed copies   */
+    PDF_N_PHASES
+} pdf_phase_t;
+
+
+typedef struct _pdf_stats_t
+{
+    unsigned long long phase_ns[PDF_N_PHASES];
+    unsigned long long bytes_read;
+    unsigned long long seeks;
+    unsigned long long objects_fetched;
+    unsigned long long reallocs;
+    unsigned long long cache_hits;
+} pdf_stats_t;
 
 
 /* Bit-maskable flags */
@@ -23,15 +54,48 @@ typedef unsigned short pdf_flag_t;
 #define PDF_FLAG_NONE         0
 #define PDF_FLAG_QUIET        1
 #define PDF_FLAG_DISP_CREATOR 2
+#define PDF_FLAG_DIFF         4
+#define PDF_FLAG_DIFF_STREAMS 8
+
+
+/* Limits on the work done for one document (pdf_t 'budget'), 0 for none.
+ * The time counts from pdf_new(), the bytes are those read from the document,
+ * and the allocation is any single one sized by its content (an object body,
+ * or a table indexed by object number).  Once a limit is exceeded, every read
+ * of the document fails as at its end, so that whatever is under way returns
+ * early, and pdf_t 'over_budget' tells which limit it was.
+ */
+typedef struct _pdf_budget_t
+{
+    unsigned long long max_ms;
+    unsigned long long max_bytes;
+    unsigned long long max_alloc;
+    int                max_revisions;
+} pdf_budget_t;
+
+#define PDF_BUDGET_TIME      1
+#define PDF_BUDGET_BYTES     2
+#define PDF_BUDGET_ALLOC     3
+#define PDF_BUDGET_REVISIONS 4
+
+
+/* A slice of a document's string pool (see pdf_t 'strpool').
+ * Slices are always nul terminated within the pool, so pdf_str() can be
+ * handed directly to printf(), although decoded text can hold a nul of its
+ * own before 'len'.  Offset 0 is the empty string.
+ */
+typedef struct _pdf_str_t
+{
+    unsigned int off;
+    unsigned int len;
+} pdf_str_t;
 
 
-/* Generic key/value structure */
-#define KV_MAX_KEY_LENGTH   32
-#define KV_MAX_VALUE_LENGTH 128
+/* Generic key/value structure, both halves live in the string pool */
 typedef struct _kv_t
 {
-    char key[KV_MAX_KEY_LENGTH];
-    char value[KV_MAX_VALUE_LENGTH];
+    pdf_str_t key;
+    pdf_str_t value;
 } kv_t;
 
 
@@ -41,12 +105,16 @@ typedef struct _kv_t
 typedef kv_t pdf_creator_t;
 
 
+/* A single xref entry, xrefs keep theirs as parallel arrays (see xref_t) */
 typedef struct _xref_entry
 {
     int obj_id;
     long offset;
     int gen_num;
     char f_or_n;
+
+    /* Hash of the object body (pdf_hash_objects()), 0 if not known */
+    uint64_t hash;
 } xref_entry_t;
 
 
@@ -59,21 +127,43 @@ typedef struct _xref_t
     pdf_creator_t *creator;
     int n_creator_entries;
 
+    /* Entries, as parallel arrays that grow with the entries parsed (see
+     * pdf_xref_add_entry()).  'gen_nums' is NULL while every generation is 0,
+     * 'in_use' is a bitset of the 'n' entries, and 'hashes' is NULL until
+     * pdf_hash_objects() or pdf_load_index() fill it.
+     */
     int n_entries;
-    xref_entry_t *entries;
-
-
-    /* PDF 1.5 or greater: xref can be encoded as a stream */
+    int n_alloc_entries;
+    int *obj_ids;
+    long *offsets;
+    uint16_t *gen_nums;
+    uint8_t *in_use;
+    uint64_t *hashes;
+
+    /* PDF 1.5 or greater: xref can be encoded as a stream.  Its entries are
+     * not decoded, 'n_stream_entries' is how many the stream lists.
+     */
     int is_stream;
+    int n_stream_entries;
 
     /* If the PDF is linear multiple xrefs make up one single version */
     int is_linear;
 
     /* Version of the document this xref belongs */
     int version;
+
+    /* Rebuilt from a scan of the revision, its startxref led nowhere */
+    int is_recovered;
+
+    /* PDF_LOAD_ENTRIES and PDF_LOAD_CREATOR, once done for this xref */
+    int loaded;
 } xref_t;
 
 
+/* Cross-document object store (store.c), see pdf_store_open() */
+typedef struct _pdf_store_t pdf_store_t;
+
+
 typedef struct _pdf_t
 {
     char  *name;
@@ -85,36 +175,377 @@ typedef struct _pdf_t
 
     /* PDF 1.5 or greater: xref can be encoded as a stream */
     int has_xref_streams;
+
+    /* Offsets of every %%EOF marker, in file order */
+    long *eofs;
+    int   n_eofs;
+    int   eof_cap;
+
+    /* A document without any marker is taken as a single revision that runs
+     * to the end of the file, this many bytes (0 if it has markers)
+     */
+    long eofless_size;
+
+    /* Bytes of the document already covered by a restored index */
+    long indexed_size;
+
+    /* Threads the %%EOF scan of a large document may be split over, one if
+     * 0 or 1
+     */
+    int scan_threads;
+
+    /* Limits set before loading, the PDF_BUDGET_* one exceeded (or 0), and
+     * when the document was created
+     */
+    pdf_budget_t       budget;
+    int                over_budget;
+    unsigned long long started_ns;
+
+    /* PDF_LOAD_* stages done for every xref */
+    int loaded;
+
+    /* Counted by PDF_LOAD_VERSIONS when the xrefs were not loaded */
+    int n_versions;
+
+    /* Counters for everything done on behalf of this document */
+    pdf_stats_t stats;
+
+    /* Storage for the creator keys and values of all versions */
+    char   *strpool;
+    size_t  strpool_len;
+    size_t  strpool_cap;
+
+    /* Optional store shared by a batch of documents, not owned */
+    pdf_store_t *store;
+
+    /* Where pdf_summarize() and pdf_display_creator() print, stdout if NULL */
+    FILE *out;
 } pdf_t;
 
 
 extern pdf_t *pdf_new(const char *name);
 extern void pdf_delete(pdf_t *pdf);
 
+/* Returns the nul terminated string that 's' refers to */
+extern const char *pdf_str(const pdf_t *pdf, pdf_str_t s);
+
 extern int pdf_is_pdf(FILE *fp);
 extern void pdf_get_version(FILE *fp, pdf_t *pdf);
 
+/* Copy a non-seekable input (e.g. a pipe) into an anonymous temporary file,
+ * indexing the %%EOF markers of 'pdf' on the way.  Returns the seekable copy,
+ * positioned at its start, or NULL on error.
+ */
+extern FILE *pdf_spool(FILE *in, pdf_t *pdf);
+
+/* Documents load in stages, each only when something needs it:
+ *
+ *   PDF_LOAD_VERSIONS the number of versions alone, from the startxref and
+ *                     /Prev chain at the end of the document into pdf_t
+ *                     'n_versions', or as PDF_LOAD_XREFS if that chain is
+ *                     broken or runs forward (linearized)
+ *   PDF_LOAD_XREFS    %%EOF index and xref positions, enough to count versions
+ *   PDF_LOAD_ENTRIES  the entries of every xref (object summaries, hashing,
+ *                     diffs, scrubbing)
+ *   PDF_LOAD_CREATOR  the creator information of every version, the Info
+ *                     object is looked up without loading the entries
+ *
+ * pdf_load() does the 'stages' that are not done yet, and can be called again
+ * for more.  Returns the number of xrefs (or of versions, for a count from the
+ * chain), or -1 if the document is over its budget or has an xref table too
+ * broken to parse (which is reported, and leaves pdf_t 'over_budget' at 0).
+ * Either way nothing exits the process.
+ * pdf_load_xrefs() loads everything.
+ */
+#define PDF_LOAD_XREFS    1
+#define PDF_LOAD_ENTRIES  2
+#define PDF_LOAD_CREATOR  4
+#define PDF_LOAD_VERSIONS 8
+#define PDF_LOAD_ALL      (PDF_LOAD_XREFS | PDF_LOAD_ENTRIES | PDF_LOAD_CREATOR)
+extern int pdf_load(FILE *fp, pdf_t *pdf, int stages);
 extern int pdf_load_xrefs(FILE *fp, pdf_t *pdf);
 
+/* (Re)load the creator information of every version.  pdf_load_xrefs()
+ * already does this, it is exposed separately for benchmarking.
+ */
+extern void pdf_load_creator(FILE *fp, pdf_t *pdf);
+
+/* The fields of the i'th entry of an xref, that are not plain arrays */
+#define XREF_GEN_NUM(_x, _i) ((_x)->gen_nums ? (_x)->gen_nums[_i] : 0)
+#define XREF_IN_USE(_x, _i)  (((_x)->in_use[(_i) >> 3] >> ((_i) & 7)) & 1)
+#define XREF_F_OR_N(_x, _i)  (XREF_IN_USE(_x, _i) ? 'n' : 'f')
+#define XREF_HASH(_x, _i)    ((_x)->hashes ? (_x)->hashes[_i] : 0)
+
+/* Append 'entry' to the entries of 'xref', anything but an 'n' entry is free */
+extern void pdf_xref_add_entry(xref_t *xref, const xref_entry_t *entry);
+
+/* Copy of the i'th entry of 'xref' */
+extern void pdf_xref_get_entry(const xref_t *xref, int i, xref_entry_t *entry);
+
+/* Index of the entry for 'obj_id' in 'xref', or -1 if there is none */
+extern int pdf_xref_find(const xref_t *xref, int obj_id);
+
+extern void pdf_xref_free_entries(xref_t *xref);
+
+/* Sidecar index (index.c).  pdf_load_index() restores the xrefs saved by
+ * pdf_save_index() if the document still starts with the bytes they were
+ * parsed from, so that pdf_load_xrefs() only parses what was appended since.
+ * Returns 1 if the index was restored, 0 if it was stale or unreadable.
+ */
+extern int pdf_load_index(FILE *fp, pdf_t *pdf, FILE *idx);
+extern int pdf_save_index(FILE *fp, const pdf_t *pdf, FILE *idx);
+
+/* Object store (store.c).  pdf_store_open() maps the store at 'path' (a
+ * missing one starts out empty), pdf_store_close() writes back what was added
+ * and frees it, returning 0 on success.  With pdf_t 'store' set,
+ * pdf_summarize() takes the type of objects already in the store from there
+ * instead of classifying them again, notes which document and version they
+ * were first seen in, and adds the objects it has not seen.
+ */
+#define PDF_STORE_TYPE_LEN 32
+extern pdf_store_t *pdf_store_open(const char *path);
+extern int pdf_store_close(pdf_store_t *store);
+
+/* Returns 1 and fills in where the object with 'hash' was first seen, or 0.
+ * 'doc' stays valid until the store is closed.  Safe to call from several
+ * threads, as is pdf_store_add().
+ */
+extern int pdf_store_find(
+    const pdf_store_t  *store,
+    uint64_t            hash,
+    const char        **doc,
+    int                *version,
+    char                type[PDF_STORE_TYPE_LEN]);
+
+/* Records 'hash' as first seen in 'doc' at 'version', unless already known */
+extern void pdf_store_add(
+    pdf_store_t *store,
+    uint64_t     hash,
+    const char  *doc,
+    int          version,
+    const char  *type);
+
+/* Prefetching (prefetch.c).  A pool of 'n_threads' threads reads documents,
+ * or the objects of a loaded one, ahead of the parser so that its reads are
+ * served from the page cache.  pdf_prefetch_new() returns NULL if no thread
+ * could be started, pdf_prefetch_delete() drops whatever is still queued.
+ * pdf_prefetch_drop() withdraws the requests for the file of 'fp', and waits
+ * for the ones being read, before its cached pages are released.
+ */
+typedef struct _pdf_prefetch_t pdf_prefetch_t;
+extern pdf_prefetch_t *pdf_prefetch_new(int n_threads);
+extern void pdf_prefetch_delete(pdf_prefetch_t *pf);
+extern void pdf_prefetch_file(pdf_prefetch_t *pf, const char *path);
+extern void pdf_prefetch_objects(pdf_prefetch_t *pf, FILE *fp, const pdf_t *pdf);
+extern void pdf_prefetch_drop(pdf_prefetch_t *pf, FILE *fp);
+
+/* Output sink (sink.c).  Whatever is printed about a document in a parallel
+ * run is collected in a buffer of its own, and handed to the sink as a whole.
+ * A single writer thread writes the blocks to 'out', in the order of their
+ * sequence numbers (which start at 0) if 'ordered' is set.  pdf_sink_put()
+ * takes over 'data', which must come from malloc() (or be NULL if 'len' is
+ * 0).  Every sequence number must be put, failed documents included, or the
+ * ones after it wait until pdf_sink_delete(), which writes out whatever is
+ * left.
+ */
+typedef struct _pdf_sink_t pdf_sink_t;
+extern pdf_sink_t *pdf_sink_new(FILE *out, int ordered);
+extern void pdf_sink_put(pdf_sink_t *sink, int seq, char *data, size_t len);
+extern void pdf_sink_delete(pdf_sink_t *sink);
+
+/* Tar output (tar.c).  Versions and summaries are written as the members of
+ * a single tar stream on 'out', which need not be seekable.  pdf_tar_add()
+ * adds 'len' bytes of 'data' under 'name', pdf_tar_add_version() what
+ * pdf_write_version() would write for the xref at 'xref_idx', copied from
+ * 'fp' straight to the descriptor of 'out'.  Members can be added from
+ * several threads.  Both return 0 if that member was written, and
+ * pdf_tar_delete() ends the archive and returns -1 if anything, any member
+ * or the end of the archive, could not be written.
+ */
+typedef struct _pdf_tar_t pdf_tar_t;
+extern pdf_tar_t *pdf_tar_new(FILE *out);
+extern int pdf_tar_add(
+    pdf_tar_t  *tar,
+    const char *name,
+    const char *data,
+    size_t      len);
+extern int pdf_tar_add_version(
+    pdf_tar_t   *tar,
+    const char  *name,
+    FILE        *fp,
+    pdf_t       *pdf,
+    int          xref_idx);
+extern int pdf_tar_delete(pdf_tar_t *tar);
+
+/* Containers (container.c).  pdf_container_list() lists the members of the
+ * zip or tar archive at 'path' whose names end in ".pdf" into '*members',
+ * which pdf_container_free() releases, and returns how many, or -1 if 'path'
+ * is neither.  pdf_member_open() returns a read-only stream over a member:
+ * stored members are read from a mapping of the archive, deflated ones are
+ * inflated into 'buf' (zeroed before its first use), which is reused from one
+ * member to the next and whose 'data' is to be freed once done.  'buf' must
+ * be left alone until the stream is closed.  Members over 64MB inflated are
+ * put in a temporary file instead.
+ */
+#define PDF_MEMBER_STORED   0
+#define PDF_MEMBER_DEFLATED 8
+
+typedef struct _pdf_member_t
+{
+    char *name;     /* Path within the archive */
+    long  offset;   /* Of its data within the archive */
+    long  size;     /* Of its data */
+    long  raw_size; /* Once inflated */
+    int   method;   /* PDF_MEMBER_* */
+} pdf_member_t;
+
+typedef struct _pdf_member_buf_t
+{
+    char   *data;
+    size_t  size;
+} pdf_member_buf_t;
+
+extern int pdf_container_list(const char *path, pdf_member_t **members);
+extern void pdf_container_free(pdf_member_t *members, int n_members);
+extern FILE *pdf_member_open(
+    const char         *path,
+    const pdf_member_t *member,
+    pdf_member_buf_t   *buf);
+
+/* Object lineage (lineage.c).  pdf_lineage_new() indexes every entry of the
+ * versioned xrefs of a loaded document by object id, in one counting sort.
+ * pdf_lineage_get() then points 'recs' at the history of 'obj_id', oldest
+ * first, and returns its length (0 if the object is in no version).  The
+ * status of each record is that of pdf_get_object_status(), hashes should be
+ * known (pdf_hash_objects()) for it to tell 'R' from 'M'.
+ */
+typedef struct _pdf_lineage_rec_t
+{
+    int  version;
+    int  xref_idx;
+    long offset;
+    int  gen_num;
+    char status;
+} pdf_lineage_rec_t;
+
+typedef struct _pdf_lineage_t pdf_lineage_t;
+extern pdf_lineage_t *pdf_lineage_new(const pdf_t *pdf);
+extern int pdf_lineage_get(
+    const pdf_lineage_t      *lin,
+    int                       obj_id,
+    const pdf_lineage_rec_t **recs);
+extern void pdf_lineage_delete(pdf_lineage_t *lin);
+
+/* Object maps (objmap.c).  pdf_objmap_new() builds the whole object table of
+ * every version of a loaded document (all earlier revisions with the entries
+ * of the version applied on top), sharing what did not change with the
+ * version before.  pdf_objmap_count() returns the number of objects in use in
+ * 'version', pdf_objmap_get() fills in the entry for 'obj_id' and returns 1
+ * if the version lists it, and pdf_objmap_list() stores the ids in use in
+ * 'obj_ids' (pdf_objmap_count() of them), in order, and returns how many.
+ */
+typedef struct _pdf_objmap_t pdf_objmap_t;
+extern pdf_objmap_t *pdf_objmap_new(const pdf_t *pdf);
+extern int pdf_objmap_count(const pdf_objmap_t *map, int version);
+extern int pdf_objmap_get(
+    const pdf_objmap_t *map,
+    int                 version,
+    int                 obj_id,
+    xref_entry_t       *entry);
+extern int pdf_objmap_list(const pdf_objmap_t *map, int version, int *obj_ids);
+extern void pdf_objmap_delete(pdf_objmap_t *map);
+
+/* Hash the body of every in use object, so that pdf_get_object_status() can
+ * tell objects that were rewritten unchanged ('R'elocated) from 'M'odified
+ * ones.  Each distinct offset is only read once, hashes that are already known
+ * (e.g. restored by pdf_load_index()) are kept.
+ */
+extern void pdf_hash_objects(FILE *fp, pdf_t *pdf);
+
+/* Returns 'A'dded, 'M'odified, 'R'elocated (same content at a new offset),
+ * 'D'eleted or '?' for the entry_idx'th entry of the xref at 'xref_idx'.
+ */
 extern char pdf_get_object_status(
     const pdf_t *pdf,
     int          xref_idx,
     int          entry_idx);
 
-extern void pdf_zero_object(
-    FILE        *fp,
+/* pdf_get_object_status() of every entry of the xref at 'xref_idx', into
+ * 'status' (n_entries of them).  Xrefs listing the same ids as the one before
+ * them are compared as whole vectors.
+ */
+extern void pdf_get_object_statuses(
     const pdf_t *pdf,
     int          xref_idx,
-    int          entry_idx);
+    char        *status);
+
+/* Let the kernel drop the cached pages of a document that is done with */
+extern void pdf_release(FILE *fp);
+
+/* Write the document to 'dst' as it was at the version that the xref at
+ * 'xref_idx' belongs to.  Returns 0 on success.
+ */
+extern int pdf_write_version(FILE *fp, pdf_t *pdf, int xref_idx, FILE *dst);
+
+/* Number of bytes that pdf_write_version() writes for 'xref_idx' */
+extern long pdf_version_size(FILE *fp, const pdf_t *pdf, int xref_idx);
+
+/* Copy the bytes of the document up to the %%EOF that closes the xref at
+ * 'xref_idx', i.e. the file as it was when that revision was saved, to 'dst'.
+ * Only the xrefs need to be loaded.  'dst' is flushed and then written
+ * through its descriptor, without going through user space where the system
+ * allows.  Returns 0 on success.
+ */
+extern int pdf_copy_version(FILE *fp, pdf_t *pdf, int xref_idx, FILE *dst);
+
+/* Write a single revision document made of only the objects that are live
+ * in the newest version of 'pdf', with a freshly generated xref, to 'dst'.
+ * Returns the number of objects written or -1 on error.
+ */
+extern int pdf_write_scrubbed(FILE *fp, pdf_t *pdf, FILE *dst);
+
+/* Print a unified diff of the entry_idx'th object of the xref at 'xref_idx'
+ * against its previous version to 'out'.  Stream data is compared too with
+ * PDF_FLAG_DIFF_STREAMS in 'flags' (inflated if built with zlib).  Returns 0,
+ * or -1 if there is no previous version of the object to compare with.
+ */
+extern int pdf_diff_object(
+    FILE        *fp,
+    pdf_t       *pdf,
+    int          xref_idx,
+    int          entry_idx,
+    pdf_flag_t   flags,
+    FILE        *out);
 
 extern void pdf_summarize(
     FILE        *fp,
-    const pdf_t *pdf,
+    pdf_t       *pdf,
     const char  *name,
     pdf_flag_t   flags);
 
 /* Returns '1' if we successfully display data (means its probably not xml) */
 extern int pdf_display_creator(const pdf_t *pdf, int xref_idx);
 
+/* Statistics.  pdf_get_stats() returns the counters of 'pdf' so far,
+ * pdf_stats_add() accumulates them (e.g. into a total over many documents),
+ * and pdf_stats_print() displays them.
+ */
+extern const pdf_stats_t *pdf_get_stats(const pdf_t *pdf);
+extern void pdf_stats_add(pdf_stats_t *total, const pdf_stats_t *stats);
+extern void pdf_stats_print(FILE *out, const char *name, const pdf_stats_t *stats);
+extern const char *pdf_phase_name(pdf_phase_t phase);
+
+/* Decode a literal "(...)" or hex "<...>" text string as UTF-8 into 'out'.
+ * The result is always nul terminated (and truncated on a character boundary
+ * if 'out_size' is too small).  Returns the number of bytes stored, excluding
+ * the nul, which is the length to use: a string can decode to U+0000.
+ * Anything that is not a string is copied verbatim.
+ */
+extern size_t pdf_decode_text_string(
+    const char *str,
+    size_t      str_len,
+    char       *out,
+    size_t      out_size);
+
 
 #endif /* PDF_H_INCLUDE */
@@ -0,0 +1,409 @@
+/******************************************************************************
+ * prefetch.c
+ *
+ * pdfresurrect - PDF history extraction tool
+ * https://github.com/enferex/pdfresurrect
+ *
+ * See https://github.com/enferex/pdfresurrect/blob/master/LICENSE for license
+ * information.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Special thanks to all of the contributors:  See AUTHORS.
+ * Special thanks to 757labs (757 crew), they are a great group
+ * of people to hack on projects and brainstorm with.
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "pdf.h"
+#include "main.h"
+
+
+/*
+ * Prefetching
+ *
+ * The parser reads through stdio, one small read after the other, which
+ * leaves cold storage idle for most of a document.  A pool of threads reads
+ * what the parser is about to ask for with pread(), so that it is in the page
+ * cache by the time the parser gets there.  Of a document, only the head and
+ * the tail are read, where the header, the last xref and the trailer are: the
+ * parser's scan for %%EOF markers reads the rest sequentially, which the
+ * kernel reads ahead for by itself, and reading whole documents here would
+ * only push more out of the page cache.  Once the xrefs of a document are
+ * known the start of each of its objects is read.  Nothing read here is kept,
+ * and errors are ignored: the parser will run into them itself.
+ *
+ * Requests are tagged with the file they read, so that pdf_prefetch_drop()
+ * can withdraw those of a document that is done with before its pages are
+ * released: nothing read here should bring them back into the page cache.
+ */
+
+#define PREFETCH_CHUNK    (1024 * 1024)
+#define PREFETCH_OBJECT   4096               /* Read at each object offset */
+#define PREFETCH_BATCH    64                 /* Ranges per request         */
+
+
+typedef struct _prefetch_req_t
+{
+    struct _prefetch_req_t *next;
+
+    /* A whole document, opened and split up into ranges by a worker, or */
+    char *path;
+
+    /* ranges of this descriptor, which the request owns */
+    int   fd;
+    int   n_ranges;
+    long  ranges[PREFETCH_BATCH][2];
+
+    /* The file either one is */
+    dev_t dev;
+    ino_t ino;
+} prefetch_req_t;
+
+
+struct _pdf_prefetch_t
+{
+    pthread_t       *threads;
+    int              n_threads;
+    pthread_mutex_t  lock;
+    pthread_cond_t   ready;
+    pthread_cond_t   idle;     /* A worker is done with a request */
+    prefetch_req_t  *head;
+    prefetch_req_t  *tail;
+    prefetch_req_t **active;   /* The request of each worker, or NULL */
+    int              n_started;
+    int              quit;
+};
+
+
+static void push(pdf_prefetch_t *pf, prefetch_req_t *req)
+{
+    pthread_mutex_lock(&pf->lock);
+    if (pf->tail)
+      pf->tail->next = req;
+    else
+      pf->head = req;
+    pf->tail = req;
+    pthread_cond_signal(&pf->ready);
+    pthread_mutex_unlock(&pf->lock);
+}
+
+
+static prefetch_req_t *new_req(int fd, const struct stat *st)
+{
+    prefetch_req_t *req;
+
+    req = safe_calloc(sizeof(prefetch_req_t));
+    req->fd = fd;
+    req->dev = st->st_dev;
+    req->ino = st->st_ino;
+    return req;
+}
+
+
+static void free_req(prefetch_req_t *req)
+{
+    if (!req->path)
+      close(req->fd);
+    free(req->path);
+    free(req);
+}
+
+
+/* Queue 'len' bytes at 'offset' of 'fd' (the file 'st') on '*req', which is
+ * pushed once full (with a new request on a dup() of 'fd' taking its place).
+ */
+static void add_range(
+    pdf_prefetch_t    *pf,
+    prefetch_req_t   **req,
+    int                fd,
+    const struct stat *st,
+    long               offset,
+    long               len)
+{
+    int dup_fd;
+
+    if (!*req)
+    {
+        if ((dup_fd = dup(fd)) == -1)
+          return;
+        *req = new_req(dup_fd, st);
+    }
+
+    (*req)->ranges[(*req)->n_ranges][0] = offset;
+    (*req)->ranges[(*req)->n_ranges][1] = len;
+    if (++(*req)->n_ranges == PREFETCH_BATCH)
+    {
+        push(pf, *req);
+        *req = NULL;
+    }
+}
+
+
+static void flush_ranges(pdf_prefetch_t *pf, prefetch_req_t **req)
+{
+    if (*req)
+      push(pf, *req);
+    *req = NULL;
+}
+
+
+/* Split the head and tail of a document into chunks for the other workers */
+static void split_file(pdf_prefetch_t *pf, const char *path)
+{
+    int             fd;
+    long            pos, size;
+    struct stat     st;
+    prefetch_req_t *req;
+
+    if ((fd = open(path, O_RDONLY)) == -1)
+      return;
+
+    if ((fstat(fd, &st) != 0) || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return;
+    }
+
+    /* One chunk per request, so that every worker gets some */
+    size = st.st_size;
+    for (pos=0; pos<size; pos+=PREFETCH_CHUNK)
+    {
+        if ((pos >= PREFETCH_CHUNK) && (pos < size - PREFETCH_CHUNK * 2))
+          pos = size - PREFETCH_CHUNK * 2;
+
+        req = NULL;
+        add_range(pf, &req, fd, &st, pos, PREFETCH_CHUNK);
+        flush_ranges(pf, &req);
+    }
+
+    close(fd);
+}
+
+
+static void *worker(void *arg)
+{
+    int             i, id;
+    char           *buf;
+    long            done;
+    ssize_t         n;
+    pdf_prefetch_t *pf;
+    prefetch_req_t *req;
+
+    pf = arg;
+    buf = safe_calloc(PREFETCH_CHUNK);
+
+    pthread_mutex_lock(&pf->lock);
+    id = pf->n_started++;
+    pthread_mutex_unlock(&pf->lock);
+
+    for ( ;; )
+    {
+        pthread_mutex_lock(&pf->lock);
+        while (!pf->head && !pf->quit)
+          pthread_cond_wait(&pf->ready, &pf->lock);
+        if (pf->quit)
+        {
+            pthread_mutex_unlock(&pf->lock);
+            break;
+        }
+        req = pf->head;
+        if (!(pf->head = req->next))
+          pf->tail = NULL;
+        pf->active[id] = req;
+        pthread_mutex_unlock(&pf->lock);
+
+        if (req->path)
+          split_file(pf, req->path);
+
+        for (i=0; i<req->n_ranges; ++i)
+          for (done=0; done<req->ranges[i][1]; done+=n)
+          {
+              n = req->ranges[i][1] - done;
+              if (n > PREFETCH_CHUNK)
+                n = PREFETCH_CHUNK;
+              if ((n = pread(req->fd, buf, n, req->ranges[i][0] + done)) <= 0)
+                break;
+          }
+
+        pthread_mutex_lock(&pf->lock);
+        pf->active[id] = NULL;
+        pthread_cond_broadcast(&pf->idle);
+        pthread_mutex_unlock(&pf->lock);
+        free_req(req);
+    }
+
+    free(buf);
+    return NULL;
+}
+
+
+pdf_prefetch_t *pdf_prefetch_new(int n_threads)
+{
+    int             i;
+    pdf_prefetch_t *pf;
+
+    pf = safe_calloc(sizeof(pdf_prefetch_t));
+    pthread_mutex_init(&pf->lock, NULL);
+    pthread_cond_init(&pf->ready, NULL);
+    pthread_cond_init(&pf->idle, NULL);
+
+    pf->active = safe_calloc(sizeof(prefetch_req_t *) * n_threads);
+    pf->threads = safe_calloc(sizeof(pthread_t) * n_threads);
+    for (i=0; i<n_threads; ++i)
+      if (pthread_create(&pf->threads[pf->n_threads], NULL, worker, pf) == 0)
+        ++pf->n_threads;
+
+    if (!pf->n_threads)
+    {
+        ERR("Could not start any prefetch threads\n");
+        pdf_prefetch_delete(pf);
+        return NULL;
+    }
+
+    return pf;
+}
+
+
+void pdf_prefetch_delete(pdf_prefetch_t *pf)
+{
+    int             i;
+    prefetch_req_t *req;
+
+    if (!pf)
+      return;
+
+    /* Whatever is still queued is of no use anymore */
+    pthread_mutex_lock(&pf->lock);
+    pf->quit = 1;
+    pthread_cond_broadcast(&pf->ready);
+    pthread_mutex_unlock(&pf->lock);
+
+    for (i=0; i<pf->n_threads; ++i)
+      pthread_join(pf->threads[i], NULL);
+
+    while ((req = pf->head))
+    {
+        pf->head = req->next;
+        free_req(req);
+    }
+
+    pthread_mutex_destroy(&pf->lock);
+    pthread_cond_destroy(&pf->ready);
+    pthread_cond_destroy(&pf->idle);
+    free(pf->active);
+    free(pf->threads);
+    free(pf);
+}
+
+
+void pdf_prefetch_file(pdf_prefetch_t *pf, const char *path)
+{
+    struct stat     st;
+    prefetch_req_t *req;
+
+    if (stat(path, &st) != 0)
+      return;
+
+    req = new_req(-1, &st);
+    req->path = safe_calloc(strlen(path) + 1);
+    strcpy(req->path, path);
+    push(pf, req);
+}
+
+
+static int cmp_offsets(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+
+void pdf_prefetch_objects(pdf_prefetch_t *pf, FILE *fp, const pdf_t *pdf)
+{
+    int             i, j, n;
+    long           *offsets, start, end;
+    struct stat     st;
+    prefetch_req_t *req;
+
+    /* Streams without a descriptor (container members) are in memory */
+    if ((fileno(fp) < 0) || (fstat(fileno(fp), &st) != 0))
+      return;
+
+    for (i=0, n=0; i<pdf->n_xrefs; ++i)
+      n += pdf->xrefs[i].n_entries;
+    if (!n)
+      return;
+
+    offsets = safe_calloc(sizeof(long) * n);
+    for (i=0, n=0; i<pdf->n_xrefs; ++i)
+      for (j=0; j<pdf->xrefs[i].n_entries; ++j)
+        if (XREF_IN_USE(&pdf->xrefs[i], j) && (pdf->xrefs[i].offsets[j] > 0))
+          offsets[n++] = pdf->xrefs[i].offsets[j];
+    qsort(offsets, n, sizeof(long), cmp_offsets);
+
+    /* Objects that are close together make a single range */
+    req = NULL;
+    for (i=0; i<n; i=j)
+    {
+        start = offsets[i];
+        end = start + PREFETCH_OBJECT;
+        for (j=i+1; j<n && offsets[j]<=end && end-start<PREFETCH_CHUNK; ++j)
+          end = offsets[j] + PREFETCH_OBJECT;
+        add_range(pf, &req, fileno(fp), &st, start, end - start);
+    }
+    flush_ranges(pf, &req);
+
+    free(offsets);
+}
+
+
+static int is_of(const prefetch_req_t *req, const struct stat *st)
+{
+    return req && (req->dev == st->st_dev) && (req->ino == st->st_ino);
+}
+
+
+void pdf_prefetch_drop(pdf_prefetch_t *pf, FILE *fp)
+{
+    int              i;
+    struct stat      st;
+    prefetch_req_t **link, *req, *last;
+
+    if ((fileno(fp) < 0) || (fstat(fileno(fp), &st) != 0))
+      return;
+
+    pthread_mutex_lock(&pf->lock);
+    for ( ;; )
+    {
+        /* Unlink whatever is queued for it */
+        last = NULL;
+        for (link=&pf->head; (req = *link); )
+        {
+            if (is_of(req, &st))
+            {
+                *link = req->next;
+                free_req(req);
+            }
+            else
+            {
+                last = req;
+                link = &req->next;
+            }
+        }
+        pf->tail = last;
+
+        /* A worker reading it (or splitting it up) has to finish first */
+        for (i=0; i<pf->n_threads; ++i)
+          if (is_of(pf->active[i], &st))
+            break;
+        if (i == pf->n_threads)
+          break;
+        pthread_cond_wait(&pf->idle, &pf->lock);
+    }
+    pthread_mutex_unlock(&pf->lock);
+}
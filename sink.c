@@ -0,0 +1,163 @@
+/******************************************************************************
+ * sink.c
+ *
+ * pdfresurrect - PDF history extraction tool
+ * https://github.com/enferex/pdfresurrect
+ *
+ * See https://github.com/enferex/pdfresurrect/blob/master/LICENSE for license
+ * information.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Special thanks to all of the contributors:  See AUTHORS.
+ * Special thanks to 757labs (757 crew), they are a great group
+ * of people to hack on projects and brainstorm with.
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "pdf.h"
+#include "main.h"
+
+
+/*
+ * Output sink
+ *
+ * Workers print everything about a document into a buffer of their own, and
+ * hand the whole block to the sink once the document is done.  Blocks are
+ * pushed onto a lock-free stack, a single writer thread takes the stack over
+ * in one exchange and writes the blocks out.  When the output is ordered,
+ * blocks that arrive ahead of their turn wait on a list sorted by sequence
+ * number until the ones before them have been written.
+ */
+
+typedef struct _sink_block_t
+{
+    struct _sink_block_t *next;
+    int                   seq;
+    char                 *data;
+    size_t                len;
+} sink_block_t;
+
+
+struct _pdf_sink_t
+{
+    FILE                    *out;
+    int                      ordered;
+    int                      next_seq;
+    _Atomic(sink_block_t *)  head;
+    atomic_int               done;
+    sem_t                    ready;
+    pthread_t                writer;
+
+    /* Writer only: blocks that are not to be written yet, by sequence */
+    sink_block_t            *pending;
+};
+
+
+static void write_block(pdf_sink_t *sink, sink_block_t *blk)
+{
+    if (blk->len)
+      fwrite(blk->data, 1, blk->len, sink->out);
+    free(blk->data);
+    free(blk);
+}
+
+
+/* Write what can be written, everything if 'all' */
+static void drain(pdf_sink_t *sink, int all)
+{
+    sink_block_t *blk, *next, **ins;
+
+    /* Sort the newly arrived blocks into the pending list */
+    for (blk=atomic_exchange(&sink->head, NULL); blk; blk=next)
+    {
+        next = blk->next;
+        for (ins=&sink->pending; *ins && (*ins)->seq < blk->seq;
+             ins=&(*ins)->next)
+          ;
+        blk->next = *ins;
+        *ins = blk;
+    }
+
+    while ((blk = sink->pending) &&
+           (all || !sink->ordered || (blk->seq == sink->next_seq)))
+    {
+        sink->pending = blk->next;
+        sink->next_seq = blk->seq + 1;
+        write_block(sink, blk);
+    }
+
+    fflush(sink->out);
+}
+
+
+static void *writer(void *arg)
+{
+    pdf_sink_t *sink = arg;
+
+    for ( ;; )
+    {
+        sem_wait(&sink->ready);
+        if (atomic_load(&sink->done))
+          break;
+        drain(sink, 0);
+    }
+
+    drain(sink, 1);
+    return NULL;
+}
+
+
+pdf_sink_t *pdf_sink_new(FILE *out, int ordered)
+{
+    pdf_sink_t *sink;
+
+    sink = safe_calloc(sizeof(pdf_sink_t));
+    sink->out = out;
+    sink->ordered = ordered;
+    atomic_init(&sink->head, NULL);
+    atomic_init(&sink->done, 0);
+    sem_init(&sink->ready, 0, 0);
+
+    if (pthread_create(&sink->writer, NULL, writer, sink) != 0)
+    {
+        ERR("Could not start the output writer thread\n");
+        sem_destroy(&sink->ready);
+        free(sink);
+        return NULL;
+    }
+
+    return sink;
+}
+
+
+void pdf_sink_put(pdf_sink_t *sink, int seq, char *data, size_t len)
+{
+    sink_block_t *blk;
+
+    blk = safe_calloc(sizeof(sink_block_t));
+    blk->seq = seq;
+    blk->data = data;
+    blk->len = len;
+
+    blk->next = atomic_load(&sink->head);
+    while (!atomic_compare_exchange_weak(&sink->head, &blk->next, blk))
+      ;
+    sem_post(&sink->ready);
+}
+
+
+void pdf_sink_delete(pdf_sink_t *sink)
+{
+    if (!sink)
+      return;
+
+    atomic_store(&sink->done, 1);
+    sem_post(&sink->ready);
+    pthread_join(sink->writer, NULL);
+
+    sem_destroy(&sink->ready);
+    free(sink);
+}
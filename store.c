@@ -0,0 +1,511 @@
+/******************************************************************************
+ * store.c
+ *
+ * pdfresurrect - PDF history extraction tool
+ * https://github.com/enferex/pdfresurrect
+ *
+ * See https://github.com/enferex/pdfresurrect/blob/master/LICENSE for license
+ * information.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Special thanks to all of the contributors:  See AUTHORS.
+ * Special thanks to 757labs (757 crew), they are a great group
+ * of people to hack on projects and brainstorm with.
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "pdf.h"
+#include "main.h"
+
+
+/*
+ * Object store
+ *
+ * A content addressed record of every object body seen across documents,
+ * keyed by the hash from pdf_hash_objects().  The file is a single open
+ * addressing hash table that is mapped as is:
+ *
+ *   header: magic, format, byte order mark, slot count and name pool size
+ *   slots:  n_slots records (hash, document, version, type), hash 0 is free
+ *   names:  names_len bytes of nul terminated document names
+ *
+ * Lookups probe the mapping directly.  Objects recorded during a run are kept
+ * in a table of their own, and both are merged into a new file that replaces
+ * the old one when the store is closed.  Only that table is locked, name pools
+ * that are outgrown are kept until then, so that names handed out by
+ * pdf_store_find() stay valid.
+ */
+
+#define STORE_MAGIC     "PDFRSTO"
+#define STORE_FORMAT    3
+#define STORE_BOM       0x01020304
+#define STORE_MIN_SLOTS 1024
+
+
+typedef struct _store_header_t
+{
+    char     magic[8];
+    uint32_t format;
+    uint32_t bom;
+    uint64_t n_slots;
+    uint64_t n_used;
+    uint64_t names_len;
+} store_header_t;
+
+
+typedef struct _store_slot_t
+{
+    uint64_t hash;
+    uint32_t doc;       /* Offset of the document name in the name pool */
+    int32_t  version;
+    char     type[PDF_STORE_TYPE_LEN];
+} store_slot_t;
+
+
+typedef struct _store_table_t
+{
+    store_slot_t *slots;
+    uint64_t      n_slots;  /* Always a power of two */
+    uint64_t      n_used;
+} store_table_t;
+
+
+struct _pdf_store_t
+{
+    char *path;
+
+    /* The store as it was opened */
+    void          *map;
+    size_t         map_size;
+    store_table_t  old;
+    const char    *old_names;
+    uint64_t       old_names_len;
+
+    /* What was recorded since, names continue after 'old_names' */
+    pthread_mutex_t lock;
+    store_table_t  added;
+    char          *names;
+    size_t         names_len;
+    size_t         names_cap;
+    char         **retired;
+    int            n_retired;
+
+    /* Open addressed by name, the offsets of both pools' names plus one */
+    uint32_t      *name_slots;
+    size_t         n_name_slots;
+    size_t         n_names;
+
+    /* Name offset of the document that was last recorded */
+    const char    *doc;
+    uint32_t       doc_off;
+};
+
+
+static const store_slot_t *table_find(const store_table_t *t, uint64_t hash)
+{
+    uint64_t i, n;
+
+    /* Bounded, a damaged store might not have a free slot left */
+    for (i=hash & (t->n_slots - 1), n=0; n<t->n_slots && t->slots[i].hash;
+         i=(i + 1) & (t->n_slots - 1), ++n)
+      if (t->slots[i].hash == hash)
+        return &t->slots[i];
+
+    return NULL;
+}
+
+
+/* The table must have a free slot */
+static void table_put(store_table_t *t, const store_slot_t *slot)
+{
+    uint64_t i;
+
+    for (i=slot->hash & (t->n_slots - 1); t->slots[i].hash;
+         i=(i + 1) & (t->n_slots - 1))
+      ;
+
+    t->slots[i] = *slot;
+    ++t->n_used;
+}
+
+
+static void table_init(store_table_t *t, uint64_t n_slots)
+{
+    t->n_slots = n_slots;
+    t->n_used = 0;
+    t->slots = safe_calloc(sizeof(store_slot_t) * n_slots);
+}
+
+
+static const char *store_name(const pdf_store_t *store, uint32_t off)
+{
+    if (off < store->old_names_len)
+      return store->old_names + off;
+    else if (off - store->old_names_len < store->names_len)
+      return store->names + (off - store->old_names_len);
+
+    return "Unknown";
+}
+
+
+static uint64_t name_hash(const char *name)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for ( ; *name; ++name)
+      h = (h ^ (unsigned char)*name) * 0x100000001b3ULL;
+    return h;
+}
+
+
+/* Slot of 'name' in the name table, or the free slot it would go in */
+static uint32_t *name_slot(const pdf_store_t *store, const char *name)
+{
+    uint64_t i;
+
+    for (i=name_hash(name) & (store->n_name_slots - 1);
+         store->name_slots[i];
+         i=(i + 1) & (store->n_name_slots - 1))
+      if (strcmp(store_name(store, store->name_slots[i] - 1), name) == 0)
+        break;
+
+    return &store->name_slots[i];
+}
+
+
+/* Index the names of both pools, in a table with room for as many again */
+static void name_table_init(pdf_store_t *store)
+{
+    size_t      n_slots;
+    uint32_t   *slot;
+    const char *c;
+
+    n_slots = STORE_MIN_SLOTS;
+    while (n_slots < (store->n_names + 1) * 4)
+      n_slots *= 2;
+
+    free(store->name_slots);
+    store->name_slots = safe_calloc(sizeof(uint32_t) * n_slots);
+    store->n_name_slots = n_slots;
+    store->n_names = 0;
+
+    for (c=store->old_names; c && c<store->old_names + store->old_names_len;
+         c+=strlen(c) + 1)
+      if (!*(slot = name_slot(store, c)))
+      {
+          *slot = (c - store->old_names) + 1;
+          ++store->n_names;
+      }
+
+    for (c=store->names; c && c<store->names + store->names_len;
+         c+=strlen(c) + 1)
+      if (!*(slot = name_slot(store, c)))
+      {
+          *slot = store->old_names_len + (c - store->names) + 1;
+          ++store->n_names;
+      }
+}
+
+
+/* Offset of 'doc' in the name pools, it is added if it is not there yet */
+static int64_t store_name_off(pdf_store_t *store, const char *doc)
+{
+    size_t      len;
+    char       *names;
+    uint32_t   *slot;
+    const char *c;
+
+    if (store->doc && (strcmp(store->doc, doc) == 0))
+      return store->doc_off;
+
+    /* The table is made on first use, and kept at most half full */
+    if (!store->name_slots)
+    {
+        for (c=store->old_names; c && c<store->old_names + store->old_names_len;
+             c+=strlen(c) + 1)
+          ++store->n_names;
+        name_table_init(store);
+    }
+    else if ((store->n_names + 1) * 2 > store->n_name_slots)
+      name_table_init(store);
+
+    if (*(slot = name_slot(store, doc)))
+      store->doc_off = *slot - 1;
+    else
+    {
+        len = strlen(doc) + 1;
+        if (store->old_names_len + store->names_len + len >= UINT32_MAX)
+          return -1;
+
+        if (store->names_len + len > store->names_cap)
+        {
+            store->names_cap = (store->names_len + len) * 2;
+            names = safe_calloc(store->names_cap);
+            if (store->names_len)
+              memcpy(names, store->names, store->names_len);
+
+            store->retired = realloc(store->retired,
+                sizeof(char *) * (store->n_retired + 1));
+            if (!store->retired)
+            {
+                ERR("Failed to grow the object store name pool\n");
+                exit(EXIT_FAILURE);
+            }
+            store->retired[store->n_retired++] = store->names;
+            store->names = names;
+        }
+
+        memcpy(store->names + store->names_len, doc, len);
+        store->doc_off = store->old_names_len + store->names_len;
+        store->names_len += len;
+        *slot = store->doc_off + 1;
+        ++store->n_names;
+    }
+
+    store->doc = store_name(store, store->doc_off);
+    return store->doc_off;
+}
+
+
+pdf_store_t *pdf_store_open(const char *path)
+{
+    int             fd;
+    struct stat     st;
+    pdf_store_t    *store;
+    const store_header_t *hdr;
+
+    store = safe_calloc(sizeof(pdf_store_t));
+    pthread_mutex_init(&store->lock, NULL);
+    store->path = safe_calloc(strlen(path) + 1);
+    strcpy(store->path, path);
+
+    /* A store that does not exist yet starts out empty */
+    if ((fd = open(path, O_RDONLY)) == -1)
+      return store;
+
+    if ((fstat(fd, &st) != 0) || (st.st_size < sizeof(store_header_t)))
+    {
+        ERR("Ignoring unreadable object store '%s'\n", path);
+        close(fd);
+        return store;
+    }
+
+    store->map_size = st.st_size;
+    store->map = mmap(NULL, store->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (store->map == MAP_FAILED)
+    {
+        ERR("Could not map object store '%s'\n", path);
+        store->map = NULL;
+        return store;
+    }
+
+    hdr = store->map;
+    if (memcmp(hdr->magic, STORE_MAGIC, sizeof(hdr->magic)) != 0          ||
+        hdr->format != STORE_FORMAT || hdr->bom != STORE_BOM              ||
+        !hdr->n_slots || (hdr->n_slots & (hdr->n_slots - 1))              ||
+        hdr->n_used >= hdr->n_slots                                       ||
+        hdr->n_slots > store->map_size / sizeof(store_slot_t)             ||
+        hdr->names_len < 1 || hdr->names_len > UINT32_MAX                 ||
+        store->map_size != sizeof(store_header_t) +
+                           hdr->n_slots * sizeof(store_slot_t) +
+                           hdr->names_len                                 ||
+        ((const char *)store->map)[store->map_size - 1] != '\0')
+    {
+        ERR("Ignoring invalid object store '%s'\n", path);
+        munmap(store->map, store->map_size);
+        store->map = NULL;
+        return store;
+    }
+
+    /* Lookups land anywhere in the table */
+    madvise(store->map, store->map_size, MADV_RANDOM);
+
+    store->old.slots = (store_slot_t *)(hdr + 1);
+    store->old.n_slots = hdr->n_slots;
+    store->old.n_used = hdr->n_used;
+    store->old_names = (const char *)(store->old.slots + hdr->n_slots);
+    store->old_names_len = hdr->names_len;
+    return store;
+}
+
+
+static void get_slot(
+    const pdf_store_t   *store,
+    const store_slot_t  *slot,
+    const char         **doc,
+    int                 *version,
+    char                 type[PDF_STORE_TYPE_LEN])
+{
+    *doc = store_name(store, slot->doc);
+    *version = slot->version;
+    memcpy(type, slot->type, PDF_STORE_TYPE_LEN);
+    type[PDF_STORE_TYPE_LEN - 1] = '\0';
+}
+
+
+int pdf_store_find(
+    const pdf_store_t  *store,
+    uint64_t            hash,
+    const char        **doc,
+    int                *version,
+    char                type[PDF_STORE_TYPE_LEN])
+{
+    int                 found;
+    const store_slot_t *slot;
+    pthread_mutex_t    *lock = (pthread_mutex_t *)&store->lock;
+
+    if (!hash)
+      return 0;
+
+    /* The mapped table never changes */
+    if ((slot = table_find(&store->old, hash)))
+    {
+        get_slot(store, slot, doc, version, type);
+        return 1;
+    }
+
+    pthread_mutex_lock(lock);
+    if ((found = !!(slot = table_find(&store->added, hash))))
+      get_slot(store, slot, doc, version, type);
+    pthread_mutex_unlock(lock);
+
+    return found;
+}
+
+
+void pdf_store_add(
+    pdf_store_t *store,
+    uint64_t     hash,
+    const char  *doc,
+    int          version,
+    const char  *type)
+{
+    int64_t       off;
+    uint64_t      i;
+    store_table_t grown;
+    store_slot_t  slot;
+
+    if (!hash || table_find(&store->old, hash))
+      return;
+
+    pthread_mutex_lock(&store->lock);
+    if (table_find(&store->added, hash) ||
+        ((off = store_name_off(store, doc)) < 0))
+    {
+        pthread_mutex_unlock(&store->lock);
+        return;
+    }
+
+    /* Keep the table at most half full */
+    if ((store->added.n_used + 1) * 2 > store->added.n_slots)
+    {
+        table_init(&grown, store->added.n_slots ?
+                           store->added.n_slots * 2 : STORE_MIN_SLOTS);
+        for (i=0; i<store->added.n_slots; ++i)
+          if (store->added.slots[i].hash)
+            table_put(&grown, &store->added.slots[i]);
+        free(store->added.slots);
+        store->added = grown;
+    }
+
+    memset(&slot, 0, sizeof(slot));
+    slot.hash = hash;
+    slot.doc = off;
+    slot.version = version;
+    strncpy(slot.type, type, PDF_STORE_TYPE_LEN - 1);
+    table_put(&store->added, &slot);
+    pthread_mutex_unlock(&store->lock);
+}
+
+
+/* Write the old and added objects to a new file, which replaces the store */
+static int store_write(const pdf_store_t *store)
+{
+    int            ok;
+    char          *tmp_name;
+    FILE          *fp;
+    uint64_t       i, n_slots;
+    store_table_t  merged;
+    store_header_t hdr;
+
+    n_slots = STORE_MIN_SLOTS;
+    while (n_slots < (store->old.n_used + store->added.n_used) * 2)
+      n_slots *= 2;
+
+    table_init(&merged, n_slots);
+    for (i=0; i<store->old.n_slots; ++i)
+      if (store->old.slots[i].hash)
+        table_put(&merged, &store->old.slots[i]);
+    for (i=0; i<store->added.n_slots; ++i)
+      if (store->added.slots[i].hash)
+        table_put(&merged, &store->added.slots[i]);
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, STORE_MAGIC, sizeof(hdr.magic));
+    hdr.format = STORE_FORMAT;
+    hdr.bom = STORE_BOM;
+    hdr.n_slots = merged.n_slots;
+    hdr.n_used = merged.n_used;
+    hdr.names_len = store->old_names_len + store->names_len;
+
+    tmp_name = safe_calloc(strlen(store->path) + 8);
+    sprintf(tmp_name, "%s.tmp", store->path);
+    if (!(fp = fopen(tmp_name, "w")))
+    {
+        ERR("Could not open '%s' for writing\n", tmp_name);
+        free(merged.slots);
+        free(tmp_name);
+        return -1;
+    }
+
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    fwrite(merged.slots, sizeof(store_slot_t), merged.n_slots, fp);
+    if (store->old_names_len)
+      fwrite(store->old_names, 1, store->old_names_len, fp);
+    if (store->names_len)
+      fwrite(store->names, 1, store->names_len, fp);
+    ok = !ferror(fp);
+    ok = (fclose(fp) == 0) && ok;
+    ok = ok && (rename(tmp_name, store->path) == 0);
+    if (!ok)
+    {
+        ERR("Failed to write object store '%s'\n", store->path);
+        remove(tmp_name);
+    }
+
+    free(merged.slots);
+    free(tmp_name);
+    return ok ? 0 : -1;
+}
+
+
+int pdf_store_close(pdf_store_t *store)
+{
+    int i, ret;
+
+    if (!store)
+      return 0;
+
+    ret = store->added.n_used ? store_write(store) : 0;
+
+    if (store->map)
+      munmap(store->map, store->map_size);
+    for (i=0; i<store->n_retired; ++i)
+      free(store->retired[i]);
+    free(store->retired);
+    free(store->name_slots);
+    pthread_mutex_destroy(&store->lock);
+    free(store->added.slots);
+    free(store->names);
+    free(store->path);
+    free(store);
+    return ret;
+}
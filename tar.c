@@ -0,0 +1,292 @@
+/******************************************************************************
+ * tar.c
+ *
+ * pdfresurrect - PDF history extraction tool
+ * https://github.com/enferex/pdfresurrect
+ *
+ * See https://github.com/enferex/pdfresurrect/blob/master/LICENSE for license
+ * information.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Special thanks to all of the contributors:  See AUTHORS.
+ * Special thanks to 757labs (757 crew), they are a great group
+ * of people to hack on projects and brainstorm with.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "pdf.h"
+#include "main.h"
+
+
+/*
+ * Tar output
+ *
+ * Members are written one after the other to a stream that is never seeked,
+ * so that it can be a pipe.  Each is a 512 byte ustar header, its data, and
+ * zeros up to the next 512 byte boundary.  Names that do not fit the ustar
+ * name and prefix fields, and sizes of 8GB or more, are carried by a pax
+ * extended header in front of the member.  The data of versions is copied by
+ * pdf_write_version(), straight from the document to the descriptor of the
+ * stream.
+ */
+
+#define TAR_BLOCK 512
+#define TAR_MAX_SIZE 077777777777ULL
+
+
+/* ustar header, POSIX.1-1988 */
+typedef struct _tar_header_t
+{
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+} tar_header_t;
+
+
+struct _pdf_tar_t
+{
+    FILE            *out;
+    time_t           mtime;
+    int              err;      /* Anything failed, reported at the end */
+
+    /* Members of concurrently processed documents are written in turn */
+    pthread_mutex_t  lock;
+};
+
+
+pdf_tar_t *pdf_tar_new(FILE *out)
+{
+    pdf_tar_t *tar;
+
+    tar = safe_calloc(sizeof(pdf_tar_t));
+    tar->out = out;
+    tar->mtime = time(NULL);
+    pthread_mutex_init(&tar->lock, NULL);
+    return tar;
+}
+
+
+/* Where 'name' is split over the prefix and name fields of the header: 0 if
+ * it fits the name field as it is, the length of the prefix, or -1 if there
+ * is no '/' to split it at.
+ */
+static int split_name(const char *name)
+{
+    const char   *slash;
+    const size_t  len = strlen(name);
+
+    if (len <= sizeof(((tar_header_t *)0)->name))
+      return 0;
+
+    for (slash=name+len-1; slash>name; --slash)
+      if ((*slash == '/') &&
+          (slash - name <= sizeof(((tar_header_t *)0)->prefix)) &&
+          (len - (slash - name) - 1 <= sizeof(((tar_header_t *)0)->name)))
+        return slash - name;
+
+    return -1;
+}
+
+
+static void put_padding(pdf_tar_t *tar, unsigned long long len)
+{
+    static const char zeros[TAR_BLOCK];
+
+    if (len % TAR_BLOCK)
+      fwrite(zeros, 1, TAR_BLOCK - (len % TAR_BLOCK), tar->out);
+}
+
+
+static void put_header(
+    pdf_tar_t          *tar,
+    const char         *name,
+    unsigned long long  size,
+    char                type)
+{
+    int           i, split;
+    unsigned int  sum;
+    tar_header_t  hdr;
+    const size_t  len = strlen(name);
+
+    memset(&hdr, 0, sizeof(hdr));
+
+    /* Long names are split over the prefix and name fields at a '/' */
+    if ((split = split_name(name)) == 0)
+      memcpy(hdr.name, name, len);
+    else if (split > 0)
+    {
+        memcpy(hdr.prefix, name, split);
+        memcpy(hdr.name, name + split + 1, len - split - 1);
+    }
+    else /* The pax header has it, this is only for older readers */
+      memcpy(hdr.name, name + len - sizeof(hdr.name), sizeof(hdr.name));
+
+    snprintf(hdr.mode, sizeof(hdr.mode), "%07o", 0644);
+    snprintf(hdr.uid, sizeof(hdr.uid), "%07o", 0);
+    snprintf(hdr.gid, sizeof(hdr.gid), "%07o", 0);
+    snprintf(hdr.size, sizeof(hdr.size), "%011llo",
+             size > TAR_MAX_SIZE ? 0 : size);
+    snprintf(hdr.mtime, sizeof(hdr.mtime), "%011llo",
+             (unsigned long long)tar->mtime);
+    hdr.typeflag = type;
+    memcpy(hdr.magic, "ustar", 6);
+    memcpy(hdr.version, "00", 2);
+
+    /* The checksum is taken with its own field set to spaces */
+    memset(hdr.chksum, ' ', sizeof(hdr.chksum));
+    for (i=0, sum=0; i<sizeof(hdr); ++i)
+      sum += ((unsigned char *)&hdr)[i];
+    snprintf(hdr.chksum, sizeof(hdr.chksum), "%06o", sum);
+    hdr.chksum[7] = ' ';
+
+    fwrite(&hdr, 1, sizeof(hdr), tar->out);
+}
+
+
+/* "<length> <key>=<value>\n", the length counting its own digits */
+static int pax_record(char *dst, size_t dst_sz, const char *key, const char *val)
+{
+    int len, digits;
+
+    len = strlen(key) + strlen(val) + 3;
+    for (digits=1; snprintf(NULL, 0, "%d", len + digits) > digits; ++digits)
+      ;
+    return snprintf(dst, dst_sz, "%d %s=%s\n", len + digits, key, val);
+}
+
+
+/* Header(s) of a member of 'size' bytes */
+static void put_member(
+    pdf_tar_t          *tar,
+    const char         *name,
+    unsigned long long  size)
+{
+    int   len;
+    char *pax, val[32];
+    const size_t name_len = strlen(name);
+
+    /* Anything ustar cannot hold goes into a pax header first */
+    len = 0;
+    pax = safe_calloc(name_len + 128);
+    if (split_name(name) < 0)
+      len += pax_record(pax + len, name_len + 128 - len, "path", name);
+    if (size > TAR_MAX_SIZE)
+    {
+        snprintf(val, sizeof(val), "%llu", size);
+        len += pax_record(pax + len, name_len + 128 - len, "size", val);
+    }
+
+    if (len)
+    {
+        put_header(tar, "././@PaxHeader", len, 'x');
+        fwrite(pax, 1, len, tar->out);
+        put_padding(tar, len);
+    }
+    free(pax);
+
+    put_header(tar, name, size, '0');
+}
+
+
+/* Whether the member just written made it out whole.  The error indicator of
+ * the stream is cleared, so that the next member is judged by its own writes,
+ * and kept in 'err' for pdf_tar_delete().
+ */
+static int put_result(pdf_tar_t *tar, int ret)
+{
+    if (ferror(tar->out))
+    {
+        clearerr(tar->out);
+        ret = -1;
+    }
+    if (ret != 0)
+      tar->err = 1;
+    return ret;
+}
+
+
+int pdf_tar_add(
+    pdf_tar_t  *tar,
+    const char *name,
+    const char *data,
+    size_t      len)
+{
+    int ret;
+
+    ret = 0;
+    pthread_mutex_lock(&tar->lock);
+    put_member(tar, name, len);
+    if (len && (fwrite(data, 1, len, tar->out) != len))
+      ret = -1;
+    put_padding(tar, len);
+    ret = put_result(tar, ret);
+    pthread_mutex_unlock(&tar->lock);
+    return ret;
+}
+
+
+int pdf_tar_add_version(
+    pdf_tar_t   *tar,
+    const char  *name,
+    FILE        *fp,
+    pdf_t       *pdf,
+    int          xref_idx)
+{
+    int  ret;
+    long size;
+
+    if ((size = pdf_version_size(fp, pdf, xref_idx)) < 0)
+      return -1;
+
+    ret = 0;
+    pthread_mutex_lock(&tar->lock);
+    put_member(tar, name, size);
+    if (pdf_write_version(fp, pdf, xref_idx, tar->out) != 0)
+    {
+        /* A short member would throw every header after it off */
+        ERR("Failed to write '%s' to the archive\n", name);
+        ret = -1;
+    }
+    put_padding(tar, size);
+    ret = put_result(tar, ret);
+    pthread_mutex_unlock(&tar->lock);
+    return ret;
+}
+
+
+int pdf_tar_delete(pdf_tar_t *tar)
+{
+    int ret;
+    static const char zeros[TAR_BLOCK * 2];
+
+    if (!tar)
+      return 0;
+
+    /* Two zero blocks end the archive */
+    fwrite(zeros, 1, sizeof(zeros), tar->out);
+    if ((fflush(tar->out) != 0) || ferror(tar->out))
+      tar->err = 1;
+
+    ret = tar->err ? -1 : 0;
+    pthread_mutex_destroy(&tar->lock);
+    free(tar);
+    return ret;
+}
@@ -0,0 +1,447 @@
+#!/bin/sh
+#
+# pdfresurrect - PDF history extraction tool
+# https://github.com/enferex/pdfresurrect
+#
+# See https://github.com/enferex/pdfresurrect/blob/master/LICENSE for license
+# information.
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# Regression tests.  Each test generates its documents with bench/pdfgen, or
+# writes small ones by hand with pdf_begin/pdf_obj/pdf_xref, runs pdfresurrect
+# on them and checks the result.  One PASS or FAIL line is written per test,
+# and the exit status is the number of failed tests.
+#
+# Environment:
+#   TEST_DIR    Where the generated PDFs go (default: a temporary directory)
+#   PDFR        The pdfresurrect to test (default: the one built here)
+
+TOP=$(cd "$(dirname "$0")/.." && pwd)
+PDFR=${PDFR:-$TOP/pdfresurrect}
+PDFGEN=$TOP/bench/pdfgen
+DIR=${TEST_DIR:-$(mktemp -d)}
+mkdir -p "$DIR" || exit 1
+
+# Print why the current test failed, and fail it
+fail()
+{
+    echo "    $*"
+    return 1
+}
+
+
+# Milliseconds of the wall clock (GNU date)
+now_ms()
+{
+    echo $(($(date +%s%N) / 1000000))
+}
+
+
+# Copy the document $1 to $2 with xref entries too long to be parsed
+break_xrefs()
+{
+    sed 's/^\([0-9]\{10\}\) 00000 n $/\1\1\1\1/' "$1" > "$2"
+}
+
+
+# Start the document $1.  Objects and revisions are appended to it with
+# pdf_obj and pdf_xref, which keep their state in $1.objs and $1.xref.
+pdf_begin()
+{
+    printf '%%PDF-1.4\n' > "$1"
+    : > "$1.objs"
+    echo "0 0" > "$1.xref"
+}
+
+
+# Append object $2 with the body $3 to the document $1
+pdf_obj()
+{
+    echo "$2 $(wc -c < "$1")" >> "$1.objs"
+    printf '%s 0 obj\n%s\nendobj\n' "$2" "$3" >> "$1"
+}
+
+
+# Close a revision of the document $1: an xref of the objects appended since
+# the last one, and a trailer with the entries $2 besides /Size and /Prev
+pdf_xref()
+{
+    start=$(wc -c < "$1")
+    read -r prev size < "$1.xref"
+    {
+        echo "xref"
+        [ "$prev" -gt 0 ] || printf '0 1\n0000000000 65535 f \n'
+        while read -r id off; do
+            printf '%s 1\n%010d 00000 n \n' "$id" "$off"
+            [ "$id" -lt "$size" ] || size=$((id + 1))
+        done < "$1.objs"
+        printf 'trailer\n<< /Size %d' "$size"
+        [ "$prev" -eq 0 ] || printf ' /Prev %d' "$prev"
+        printf ' %s >>\nstartxref\n%d\n%%%%EOF\n' "$2" "$start"
+    } >> "$1"
+    echo "$start $size" > "$1.xref"
+    : > "$1.objs"
+}
+
+
+# -v 1 of a linearized document copies it through the %%EOF of the xref that
+# closes the first version, not just through the first-page xref before it
+linearized_version()
+{
+    "$PDFGEN" -o "$DIR/linear.pdf" -r 3 -n 5 -l || return 1
+    "$PDFR" -v 1 -o - "$DIR/linear.pdf" > "$DIR/linear-1.pdf" || return 1
+
+    n=$(wc -c < "$DIR/linear-1.pdf")
+    if ! head -c "$n" "$DIR/linear.pdf" | cmp -s - "$DIR/linear-1.pdf"; then
+        fail "version 1 is not a prefix of the document"
+        return
+    fi
+    if [ "$(grep -a -c '%%EOF' "$DIR/linear-1.pdf")" -ne 2 ]; then
+        fail "version 1 is $n bytes, it ends at the first-page xref"
+        return
+    fi
+}
+
+
+# -v on an archive member writes the version next to the archive, named after
+# the archive and the member
+member_version()
+{
+    mkdir -p "$DIR/tree/a" || return 1
+    "$PDFGEN" -o "$DIR/tree/a/x.pdf" -r 3 -n 5 || return 1
+    (cd "$DIR/tree" && tar cf ../docs.tar a) || return 1
+
+    rm -f "$DIR/docs.tar-a-x-version-2.pdf"
+    if ! "$PDFR" -v 2 "$DIR/docs.tar"; then
+        fail "-v 2 of the member failed"
+        return
+    fi
+    n=$(wc -c < "$DIR/docs.tar-a-x-version-2.pdf") || return 1
+    if ! head -c "$n" "$DIR/tree/a/x.pdf" | cmp -s - \
+        "$DIR/docs.tar-a-x-version-2.pdf"; then
+        fail "version 2 is not a prefix of the member"
+        return
+    fi
+}
+
+
+# An xref table that cannot be parsed skips its document, the run goes on
+broken_xref()
+{
+    "$PDFGEN" -o "$DIR/good.pdf" -r 3 -n 5 || return 1
+    break_xrefs "$DIR/good.pdf" "$DIR/broken.pdf"
+
+    if "$PDFR" "$DIR/good.pdf" "$DIR/broken.pdf" "$DIR/good.pdf" \
+        > "$DIR/broken.out" 2> "$DIR/broken.err"; then
+        fail "a broken document does not fail the run"
+        return
+    fi
+    if ! grep -q "could not be loaded" "$DIR/broken.err"; then
+        fail "the broken document is not reported"
+        return
+    fi
+    if [ "$(grep -c '^---------- .*good.pdf' "$DIR/broken.out")" -ne 2 ]; then
+        fail "the documents around the broken one are missing"
+        return
+    fi
+}
+
+
+# A document without any %%EOF is recovered from a scan through its last
+# byte, the object it ends on included, with or without an end of line
+no_eof()
+{
+    f=$DIR/no-eof.pdf
+    pdf_begin "$f"
+    pdf_obj "$f" 1 "<< /Type /Catalog /Pages 2 0 R >>"
+    pdf_obj "$f" 2 "<< /Type /Pages /Kids [] /Count 0 >>"
+    head -c -1 "$f" > "$DIR/no-eol.pdf" || return 1
+
+    for f in "$f" "$DIR/no-eol.pdf"; do
+        if ! "$PDFR" "$f" 2> /dev/null |
+            grep -q '^Version 1 -- 2 objects (recovered)$'; then
+            fail "$(basename "$f"): the objects are not all recovered"
+            return
+        fi
+    done
+}
+
+
+# -s keeps the live objects whole, a stream that holds the word "endobj"
+# included, and the scrubbed document loads back as a single version
+scrub_objects()
+{
+    text="BT (this text says endobj inside) Tj ET"
+    catalog="<< /Type /Catalog /Pages 2 0 R >>"
+    stream="<< /Length ${#text} >>
+stream
+$text
+endstream"
+    pages="<< /Type /Pages /Kids [] /Count 0 /Rev 2 >>"
+
+    f=$DIR/scrub.pdf
+    pdf_begin "$f"
+    pdf_obj "$f" 1 "$catalog"
+    pdf_obj "$f" 2 "<< /Type /Pages /Kids [] /Count 0 >>"
+    pdf_obj "$f" 3 "$stream"
+    pdf_xref "$f" "/Root 1 0 R"
+    pdf_obj "$f" 2 "$pages"
+    pdf_xref "$f" "/Root 1 0 R"
+
+    # The objects of the newest version, in the order of the source (after
+    # the header that pdf_begin writes)
+    pdf_begin "$DIR/scrub.want"
+    pdf_obj "$DIR/scrub.want" 1 "$catalog"
+    pdf_obj "$DIR/scrub.want" 3 "$stream"
+    pdf_obj "$DIR/scrub.want" 2 "$pages"
+
+    rm -f "$DIR/scrub-scrubbed.pdf"
+    if ! (cd "$DIR" && "$PDFR" -s scrub.pdf > /dev/null); then
+        fail "-s failed"
+        return
+    fi
+    if [ "$("$PDFR" -q "$DIR/scrub-scrubbed.pdf")" != \
+         "scrub-scrubbed.pdf: 1" ]; then
+        fail "the scrubbed document is not a single version"
+        return
+    fi
+    sed -n '3,/^xref$/p' "$DIR/scrub-scrubbed.pdf" | sed '$d' \
+        > "$DIR/scrub.got"
+    if ! tail -n +2 "$DIR/scrub.want" | cmp -s - "$DIR/scrub.got"; then
+        fail "the scrubbed objects differ from the live ones"
+        return
+    fi
+}
+
+
+# -i decodes the Info strings: hex and octal-escaped UTF-16 (a surrogate pair
+# too), PDFDocEncoding and the literal escapes
+info_strings()
+{
+    f=$DIR/info.pdf
+    pdf_begin "$f"
+    pdf_obj "$f" 1 "<< /Type /Catalog /Pages 2 0 R >>"
+    pdf_obj "$f" 2 "<< /Type /Pages /Kids [] /Count 0 >>"
+    pdf_obj "$f" 3 '<< /Title <FEFF00480069>
+/Author (\376\377\000C\000a\000f\000\351)
+/Subject (Caf\351) /Keywords (a\(b\) \143) /Creator <FEFFD83DDE00> >>'
+    pdf_xref "$f" "/Root 1 0 R /Info 3 0 R"
+
+    "$PDFR" -i "$f" > "$DIR/info.out" || return 1
+    for want in "Title: Hi" "Author: Café" "Subject: Café" \
+        "Keywords: a(b) c" "Creator: 😀"; do
+        if ! grep -q -x "$want" "$DIR/info.out"; then
+            fail "no '$want' line"
+            return
+        fi
+    done
+}
+
+
+# --diff shows the entries that changed in a modified object
+diff_object()
+{
+    f=$DIR/diff.pdf
+    pdf_begin "$f"
+    pdf_obj "$f" 1 "<< /Type /Catalog /Pages 2 0 R >>"
+    pdf_obj "$f" 2 "<< /Type /Pages /Kids [] /Count 0 >>"
+    pdf_xref "$f" "/Root 1 0 R"
+    pdf_obj "$f" 2 "<< /Type /Pages /Kids [] /Count 1 >>"
+    pdf_xref "$f" "/Root 1 0 R"
+
+    "$PDFR" --diff "$f" > "$DIR/diff.out" || return 1
+    sed -n '/^--- Object 2 (Version 1)$/,/^[^-+@ ]/p' "$DIR/diff.out" |
+        grep '^[-+]/' > "$DIR/diff.got"
+    printf -- '-/Count 0\n+/Count 1\n' | cmp -s - "$DIR/diff.got" || {
+        fail "the diff of object 2 is not the /Count change"
+        return
+    }
+}
+
+
+# -x restores the xrefs of the part of a document that was indexed: the
+# output is the same whether the document grew or was replaced since
+index_reuse()
+{
+    "$PDFGEN" -o "$DIR/grow-2.pdf" -r 2 -n 20 || return 1
+    "$PDFGEN" -o "$DIR/grow-3.pdf" -r 3 -n 20 || return 1
+    "$PDFGEN" -o "$DIR/other-3.pdf" -r 3 -n 20 -S 2 || return 1
+
+    f=$DIR/grow.pdf
+    rm -f "$f.pdfr-index"
+    cp "$DIR/grow-2.pdf" "$f"
+    "$PDFR" -x "$f" > /dev/null || return 1
+    if [ ! -s "$f.pdfr-index" ]; then
+        fail "no index was written"
+        return
+    fi
+
+    for next in grow-3 other-3; do
+        cp "$DIR/$next.pdf" "$f"
+        "$PDFR" "$f" > "$DIR/index.want" || return 1
+        "$PDFR" -x "$f" > "$DIR/index.got" || return 1
+        if ! cmp -s "$DIR/index.want" "$DIR/index.got"; then
+            fail "$next: the output differs with the index"
+            return
+        fi
+    done
+}
+
+
+# --tar writes the same versions and summary as -w, into one archive
+tar_output()
+{
+    "$PDFGEN" -o "$DIR/tar.pdf" -r 3 -n 5 || return 1
+    rm -rf "$DIR/tar-versions" "$DIR/untar"
+    mkdir -p "$DIR/untar" || return 1
+
+    (cd "$DIR" && "$PDFR" -w tar.pdf > /dev/null) || return 1
+    "$PDFR" --tar=- "$DIR/tar.pdf" 2> /dev/null |
+        (cd "$DIR/untar" && tar xf -) || return 1
+    if ! diff -r "$DIR/tar-versions" "$DIR/untar/tar-versions" > /dev/null
+    then
+        fail "the archive differs from what -w writes"
+        return
+    fi
+}
+
+
+# The members of a zip, stored or deflated, read the same as the files
+zip_members()
+{
+    if ! command -v zip > /dev/null; then
+        echo "    zip not found, skipped"
+        return 0
+    fi
+    mkdir -p "$DIR/zip" || return 1
+    "$PDFGEN" -o "$DIR/zip/a.pdf" -r 3 -n 5 || return 1
+    "$PDFGEN" -o "$DIR/zip/b.pdf" -r 2 -n 5 -S 2 || return 1
+    rm -f "$DIR/stored.zip" "$DIR/deflated.zip"
+    (cd "$DIR/zip" && zip -q -0 ../stored.zip a.pdf b.pdf &&
+        zip -q -9 ../deflated.zip a.pdf b.pdf) || return 1
+
+    (cd "$DIR/zip" && "$PDFR" a.pdf b.pdf) > "$DIR/zip.want" || return 1
+    for z in stored deflated; do
+        if ! (cd "$DIR" && "$PDFR" $z.zip) 2> "$DIR/zip.err" \
+            > "$DIR/zip.out"; then
+            if [ $z = deflated ] && grep -q "without zlib" "$DIR/zip.err"
+            then
+                continue
+            fi
+            fail "$z.zip could not be read"
+            return
+        fi
+        if ! sed "s|$z.zip/||" "$DIR/zip.out" | cmp -s - "$DIR/zip.want"
+        then
+            fail "the members of $z.zip read differently"
+            return
+        fi
+    done
+}
+
+
+# -q counts the versions from the xrefs at the end of the document, tables or
+# streams, without reading the rest of it.  What -w writes points back at an
+# earlier version, -q counts every version of it as the summary does.
+quiet_count()
+{
+    for x in "" -x; do
+        "$PDFGEN" -o "$DIR/quiet.pdf" -r 5 -n 2000 -s 64 $x || return 1
+        "$PDFR" -q --stats "$DIR/quiet.pdf" > "$DIR/quiet.out" || return 1
+        if ! grep -q -x "quiet.pdf: 5" "$DIR/quiet.out"; then
+            fail "pdfgen${x:+ $x}: the versions are miscounted"
+            return
+        fi
+        size=$(wc -c < "$DIR/quiet.pdf")
+        n=$(sed -n 's/^bytes_read *//p' "$DIR/quiet.out" | head -n 1)
+        if [ "$n" -gt $((size / 4)) ]; then
+            fail "pdfgen${x:+ $x}: read $n of the $size bytes"
+            return
+        fi
+    done
+
+    rm -rf "$DIR/quiet-versions"
+    (cd "$DIR" && "$PDFR" -w quiet.pdf > /dev/null) || return 1
+    f=$DIR/quiet-versions/quiet-version-2.pdf
+    want=$("$PDFR" "$f" | sed -n 's/^Versions: //p')
+    got=$("$PDFR" -q "$f" | sed 's/.*: //')
+    if [ "$got" != "$want" ]; then
+        fail "-q counts $got versions of a -w version, the summary $want"
+        return
+    fi
+}
+
+
+# --max-time bounds how long a document takes, the summary included (this
+# one takes most of a second without it)
+max_time_deadline()
+{
+    "$PDFGEN" -o "$DIR/objects.pdf" -r 4 -n 20000 -s 64 || return 1
+
+    start=$(now_ms)
+    if "$PDFR" --max-time=100 "$DIR/objects.pdf" > /dev/null \
+        2> "$DIR/deadline.err"; then
+        fail "the document did not go over its time budget"
+        return
+    fi
+    ms=$(($(now_ms) - start))
+
+    if ! grep -q "time budget" "$DIR/deadline.err"; then
+        fail "the time budget is not reported"
+        return
+    fi
+    if [ "$ms" -ge 400 ]; then
+        fail "took $ms ms with --max-time=100"
+        return
+    fi
+}
+
+# With -j, a document that fails in the middle of a batch still takes its
+# turn in the ordered output: the ones after it are printed, in order
+parallel_broken()
+{
+    for n in 2 3 4 5 6; do
+        "$PDFGEN" -o "$DIR/par-$n.pdf" -r $n -n 50 -S $n || return 1
+    done
+    break_xrefs "$DIR/par-4.pdf" "$DIR/par-broken.pdf"
+
+    if "$PDFR" -j3 "$DIR/par-2.pdf" "$DIR/par-3.pdf" "$DIR/par-broken.pdf" \
+        "$DIR/par-5.pdf" "$DIR/par-6.pdf" > "$DIR/par.out" 2> /dev/null; then
+        fail "a broken document does not fail the run"
+        return
+    fi
+    order=$(sed -n 's/^---------- .*par-\([0-9]\).pdf ----------$/\1/p' \
+            "$DIR/par.out" | tr -d '\n')
+    if [ "$order" != "2356" ]; then
+        fail "printed '$order', expected '2356'"
+        return
+    fi
+}
+
+
+FAILED=0
+for t in \
+    linearized_version \
+    member_version \
+    broken_xref \
+    no_eof \
+    scrub_objects \
+    info_strings \
+    diff_object \
+    index_reuse \
+    tar_output \
+    zip_members \
+    quiet_count \
+    max_time_deadline \
+    parallel_broken
+do
+    if $t; then
+        echo "PASS: $t"
+    else
+        echo "FAIL: $t"
+        FAILED=$((FAILED + 1))
+    fi
+done
+
+[ -z "$TEST_DIR" ] && rm -rf "$DIR"
+exit $FAILED